@@ -0,0 +1,612 @@
+/*
+ * End-to-end control loop benchmark.
+ *
+ * For each scenario: spawns a private dbus-daemon, clightd-stub and Clight,
+ * drives the scenario through stub control interface and Clight bus API,
+ * then reports capture-to-Set latency percentiles, number of bus calls to Clightd,
+ * Clight CPU time, wakeups (context switches) and peak RSS.
+ */
+
+#include <getopt.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <systemd/sd-bus.h>
+
+#define STUB_SERVICE        "org.clightd.clightd"
+#define STUB_PATH           "/org/clightd/stub"
+#define STUB_IFACE          "org.clightd.stub.Control"
+#define CLIGHT_SERVICE      "org.clight.clight"
+#define CLIGHT_PATH         "/org/clight/clight"
+#define SC_SERVICE          "org.freedesktop.ScreenSaver"
+#define SC_PATH             "/org/freedesktop/ScreenSaver"
+#define READY_TIMEOUT_MS    10000
+#define SETTLE_MS           1000
+#define MAX_ENV             32
+
+typedef struct {
+    const char *name;
+    const char *desc;
+    const char *conf;       // scenario specific clight config
+    int clock_speed;        // simulated clock speed; 0 for real clock
+    int (*run)(sd_bus *bus);
+} scenario_t;
+
+typedef struct {
+    unsigned long cpu_ticks;
+    unsigned long ctx_switches;
+    unsigned long peak_rss_kb;
+} proc_stats_t;
+
+typedef struct {
+    const char *name;
+    int num_latencies;
+    double lat_p50, lat_p90, lat_p99, lat_max;  // ms
+    unsigned long bus_calls;
+    double cpu_ms;
+    unsigned long wakeups;
+    unsigned long peak_rss_kb;
+    double duration_s;
+    int ret;
+} result_t;
+
+static int parse_opts(int argc, char *argv[]);
+static void msleep(int ms);
+static double now_ms(void);
+static pid_t spawn(char *const argv[], char *const envp[], int out_fd);
+static void stop(pid_t pid);
+static int start_bus(void);
+static int open_bus(sd_bus **bus);
+static int wait_name(sd_bus *bus, const char *name);
+static int write_conf(const scenario_t *s, char *path, size_t size);
+static int read_proc_stats(pid_t pid, proc_stats_t *st);
+static int collect_stub_stats(sd_bus *bus, result_t *res);
+static int cmp_u64(const void *a, const void *b);
+static int run_scenario(const scenario_t *s, result_t *res);
+static void print_results(const result_t *res, int num);
+static int ctl_set_ambient(sd_bus *bus, double val);
+static int ctl_monitor(sd_bus *bus, const char *member, const char *id);
+static int ctl_idle(sd_bus *bus, bool idle);
+static int run_ambient_ramp(sd_bus *bus);
+static int run_hotplug(sd_bus *bus);
+static int run_dimmer(sd_bus *bus);
+static int run_inhibit(sd_bus *bus);
+static int run_daynight(sd_bus *bus);
+
+static const char *clight_path = CLIGHT_BIN;
+static const char *stub_path = STUB_BIN;
+static const char *bus_conf = BUS_CONF;
+static const char *latency = "0", *jitter = "0";
+static const char *only_scenario;
+static int num_monitors = 8;
+static int cycles = 20;
+static bool json;
+static char tmp_dir[] = "/tmp/clight-bench-XXXXXX";
+static char bus_address[512];
+static pid_t bus_pid = -1;
+
+static const char base_conf[] =
+    "backlight: { no_smooth_transition = true; hotplug_delay = 0; };\n"
+    "gamma: { no_smooth_transition = true; };\n"
+    "daytime: { latitude = 45.0; longitude = 9.0; };\n";
+
+static const scenario_t scenarios[] = {
+    { "ambient-ramp", "ambient brightness ramp, one capture per step", "", 0, run_ambient_ramp },
+    { "hotplug", "hotplug and removal of N monitors", "", 0, run_hotplug },
+    { "dimmer", "idle/active cycles", "dimmer: { no_smooth_transition = true; };\n", 0, run_dimmer },
+    { "inhibit-storm", "ScreenSaver Inhibit/UnInhibit storm", "", 0, run_inhibit },
+    { "day-night", "two simulated days (long gamma transitions)", "gamma: { long_transition = true; };\n", 7200, run_daynight },
+};
+
+int main(int argc, char *argv[]) {
+    if (parse_opts(argc, argv) < 0) {
+        return EXIT_FAILURE;
+    }
+    if (!mkdtemp(tmp_dir)) {
+        fprintf(stderr, "Failed to create temp dir: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    const int num = sizeof(scenarios) / sizeof(scenarios[0]);
+    result_t res[num];
+    int done = 0, ret = EXIT_SUCCESS;
+    for (int i = 0; i < num; i++) {
+        if (only_scenario && strcmp(only_scenario, scenarios[i].name)) {
+            continue;
+        }
+        if (!json) {
+            fprintf(stderr, "Running '%s': %s...\n", scenarios[i].name, scenarios[i].desc);
+        }
+        if (run_scenario(&scenarios[i], &res[done]) < 0) {
+            ret = EXIT_FAILURE;
+        }
+        done++;
+    }
+    print_results(res, done);
+    return ret;
+}
+
+static int parse_opts(int argc, char *argv[]) {
+    static const struct option opts[] = {
+        { "clight", required_argument, NULL, 'c' },
+        { "stub", required_argument, NULL, 's' },
+        { "bus-conf", required_argument, NULL, 'b' },
+        { "latency", required_argument, NULL, 'l' },
+        { "jitter", required_argument, NULL, 'j' },
+        { "monitors", required_argument, NULL, 'm' },
+        { "cycles", required_argument, NULL, 'n' },
+        { "scenario", required_argument, NULL, 'S' },
+        { "json", no_argument, NULL, 'J' },
+        { "help", no_argument, NULL, 'h' },
+        { 0 }
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "c:s:b:l:j:m:n:S:Jh", opts, NULL)) != -1) {
+        switch (c) {
+        case 'c':
+            clight_path = optarg;
+            break;
+        case 's':
+            stub_path = optarg;
+            break;
+        case 'b':
+            bus_conf = optarg;
+            break;
+        case 'l':
+            latency = optarg;
+            break;
+        case 'j':
+            jitter = optarg;
+            break;
+        case 'm':
+            num_monitors = atoi(optarg);
+            break;
+        case 'n':
+            cycles = atoi(optarg);
+            break;
+        case 'S':
+            only_scenario = optarg;
+            break;
+        case 'J':
+            json = true;
+            break;
+        default:
+            printf("Usage: %s [--clight path] [--stub path] [--bus-conf path] [--latency ms] [--jitter ms] "
+                   "[--monitors n] [--cycles n] [--scenario name] [--json]\n", argv[0]);
+            printf("Scenarios:\n");
+            for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+                printf("  %-16s%s\n", scenarios[i].name, scenarios[i].desc);
+            }
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void msleep(int ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR);
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/* Spawn a child; if out_fd >= 0, its stdout is redirected there */
+static pid_t spawn(char *const argv[], char *const envp[], int out_fd) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (out_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    } else {
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    }
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    pid_t pid;
+    int r = posix_spawn(&pid, argv[0], &actions, NULL, argv, envp);
+    posix_spawn_file_actions_destroy(&actions);
+    if (r != 0) {
+        fprintf(stderr, "Failed to spawn '%s': %s\n", argv[0], strerror(r));
+        return -1;
+    }
+    return pid;
+}
+
+static void stop(pid_t pid) {
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        for (int i = 0; i < 50; i++) {
+            if (waitpid(pid, NULL, WNOHANG) == pid) {
+                return;
+            }
+            msleep(100);
+        }
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+    }
+}
+
+/* Start a private dbus-daemon; its address is stored in bus_address */
+static int start_bus(void) {
+    int fds[2];
+    if (pipe(fds) == -1) {
+        return -errno;
+    }
+    char conf_arg[PATH_MAX + 32];
+    snprintf(conf_arg, sizeof(conf_arg), "--config-file=%s", bus_conf);
+    char *argv[] = { "/usr/bin/dbus-daemon", conf_arg, "--nofork", "--print-address", NULL };
+    extern char **environ;
+    bus_pid = spawn(argv, environ, fds[1]);
+    close(fds[1]);
+    if (bus_pid < 0) {
+        close(fds[0]);
+        return -1;
+    }
+
+    FILE *f = fdopen(fds[0], "r");
+    if (!f || !fgets(bus_address, sizeof(bus_address), f)) {
+        if (f) {
+            fclose(f);
+        }
+        stop(bus_pid);
+        return -1;
+    }
+    bus_address[strcspn(bus_address, "\n")] = '\0';
+    fclose(f);
+    return 0;
+}
+
+static int open_bus(sd_bus **bus) {
+    int r = sd_bus_new(bus);
+    if (r >= 0) {
+        r = sd_bus_set_address(*bus, bus_address);
+    }
+    if (r >= 0) {
+        r = sd_bus_set_bus_client(*bus, true);
+    }
+    if (r >= 0) {
+        r = sd_bus_start(*bus);
+    }
+    return r;
+}
+
+static int wait_name(sd_bus *bus, const char *name) {
+    for (int waited = 0; waited < READY_TIMEOUT_MS; waited += 50) {
+        sd_bus_message *reply = NULL;
+        int has_owner = 0;
+        int r = sd_bus_call_method(bus, "org.freedesktop.DBus", "/org/freedesktop/DBus", "org.freedesktop.DBus",
+                                   "NameHasOwner", NULL, &reply, "s", name);
+        if (r >= 0) {
+            sd_bus_message_read(reply, "b", &has_owner);
+            sd_bus_message_unref(reply);
+            if (has_owner) {
+                return 0;
+            }
+        }
+        msleep(50);
+    }
+    return -ETIMEDOUT;
+}
+
+static int write_conf(const scenario_t *s, char *path, size_t size) {
+    snprintf(path, size, "%s/%s.conf", tmp_dir, s->name);
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        return -errno;
+    }
+    /* libconfig does not allow duplicated groups: scenario conf replaces base one where they overlap */
+    const char *groups[] = { "backlight:", "gamma:", "daytime:" };
+    char *base = strdup(base_conf);
+    for (char *line = strtok(base, "\n"); line; line = strtok(NULL, "\n")) {
+        bool overridden = false;
+        for (size_t i = 0; i < sizeof(groups) / sizeof(groups[0]); i++) {
+            if (!strncmp(line, groups[i], strlen(groups[i])) && strstr(s->conf, groups[i])) {
+                overridden = true;
+            }
+        }
+        if (!overridden) {
+            fprintf(f, "%s\n", line);
+        }
+    }
+    free(base);
+    fprintf(f, "%s", s->conf);
+    fclose(f);
+    return 0;
+}
+
+static int read_proc_stats(pid_t pid, proc_stats_t *st) {
+    char path[64], line[512];
+    memset(st, 0, sizeof(proc_stats_t));
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -errno;
+    }
+    if (fgets(line, sizeof(line), f)) {
+        /* Skip "pid (comm)", that can contain spaces */
+        char *p = strrchr(line, ')');
+        unsigned long utime = 0, stime = 0;
+        if (p && sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) == 2) {
+            st->cpu_ticks = utime + stime;
+        }
+    }
+    fclose(f);
+
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    f = fopen(path, "r");
+    if (!f) {
+        return -errno;
+    }
+    unsigned long val;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "VmHWM: %lu", &val) == 1) {
+            st->peak_rss_kb = val;
+        } else if (sscanf(line, "voluntary_ctxt_switches: %lu", &val) == 1 ||
+                   sscanf(line, "nonvoluntary_ctxt_switches: %lu", &val) == 1) {
+            st->ctx_switches += val;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int collect_stub_stats(sd_bus *bus, result_t *res) {
+    sd_bus_message *reply = NULL;
+    int r = sd_bus_call_method(bus, STUB_SERVICE, STUB_PATH, STUB_IFACE, "GetStats", NULL, &reply, NULL);
+    if (r < 0) {
+        return r;
+    }
+    r = sd_bus_message_enter_container(reply, SD_BUS_TYPE_ARRAY, "{st}");
+    while (r > 0 && sd_bus_message_enter_container(reply, SD_BUS_TYPE_DICT_ENTRY, "st") > 0) {
+        const char *key;
+        uint64_t count;
+        sd_bus_message_read(reply, "st", &key, &count);
+        res->bus_calls += count;
+        sd_bus_message_exit_container(reply);
+    }
+    sd_bus_message_unref(reply);
+
+    reply = NULL;
+    r = sd_bus_call_method(bus, STUB_SERVICE, STUB_PATH, STUB_IFACE, "GetLatencies", NULL, &reply, NULL);
+    if (r < 0) {
+        return r;
+    }
+    const uint64_t *lat = NULL;
+    size_t size = 0;
+    r = sd_bus_message_read_array(reply, 't', (const void **)&lat, &size);
+    res->num_latencies = size / sizeof(uint64_t);
+    if (r >= 0 && res->num_latencies > 0) {
+        uint64_t *sorted = malloc(size);
+        memcpy(sorted, lat, size);
+        qsort(sorted, res->num_latencies, sizeof(uint64_t), cmp_u64);
+        const int n = res->num_latencies;
+        res->lat_p50 = sorted[(n - 1) * 50 / 100] / 1000.0;
+        res->lat_p90 = sorted[(n - 1) * 90 / 100] / 1000.0;
+        res->lat_p99 = sorted[(n - 1) * 99 / 100] / 1000.0;
+        res->lat_max = sorted[n - 1] / 1000.0;
+        free(sorted);
+    }
+    sd_bus_message_unref(reply);
+    return r;
+}
+
+static int run_scenario(const scenario_t *s, result_t *res) {
+    char conf_path[PATH_MAX];
+    pid_t stub_pid = -1, clight_pid = -1;
+    sd_bus *bus = NULL;
+
+    memset(res, 0, sizeof(result_t));
+    res->name = s->name;
+    res->ret = -1;
+
+    if (write_conf(s, conf_path, sizeof(conf_path)) < 0 || start_bus() < 0) {
+        fprintf(stderr, "Failed to setup '%s' scenario.\n", s->name);
+        return -1;
+    }
+
+    /* Clight and stub share the private bus as both system and session bus */
+    char env[MAX_ENV][PATH_MAX + 64];
+    char *envp[MAX_ENV] = { 0 };
+    int n = 0;
+    snprintf(env[n++], sizeof(env[0]), "DBUS_SYSTEM_BUS_ADDRESS=%s", bus_address);
+    snprintf(env[n++], sizeof(env[0]), "DBUS_SESSION_BUS_ADDRESS=%s", bus_address);
+    snprintf(env[n++], sizeof(env[0]), "XDG_RUNTIME_DIR=%s", tmp_dir);
+    snprintf(env[n++], sizeof(env[0]), "XDG_CONFIG_HOME=%s", tmp_dir);
+    snprintf(env[n++], sizeof(env[0]), "XDG_CACHE_HOME=%s", tmp_dir);
+    snprintf(env[n++], sizeof(env[0]), "XDG_DATA_HOME=%s", tmp_dir);
+    snprintf(env[n++], sizeof(env[0]), "HOME=%s", tmp_dir);
+    snprintf(env[n++], sizeof(env[0]), "DISPLAY=:0");
+    snprintf(env[n++], sizeof(env[0]), "XAUTHORITY=/dev/null");
+    if (s->clock_speed > 0) {
+        snprintf(env[n++], sizeof(env[0]), "CLIGHT_CLOCK=sim:%d", s->clock_speed);
+    }
+    for (int i = 0; i < n; i++) {
+        envp[i] = env[i];
+    }
+
+    char mons[16], speed[16];
+    snprintf(mons, sizeof(mons), "%d", 1);
+    snprintf(speed, sizeof(speed), "%d", s->clock_speed > 0 ? s->clock_speed : 1);
+    char *stub_argv[] = { (char *)stub_path, "--latency", (char *)latency, "--jitter", (char *)jitter,
+                          "--monitors", mons, "--speed", speed, NULL };
+    stub_pid = spawn(stub_argv, envp, -1);
+
+    if (stub_pid < 0 || open_bus(&bus) < 0 || wait_name(bus, STUB_SERVICE) < 0) {
+        fprintf(stderr, "Failed to start clightd-stub.\n");
+        goto end;
+    }
+
+    char *clight_argv[] = { (char *)clight_path, "-c", conf_path, NULL };
+    clight_pid = spawn(clight_argv, envp, -1);
+    if (clight_pid < 0 || wait_name(bus, CLIGHT_SERVICE) < 0) {
+        fprintf(stderr, "Failed to start clight.\n");
+        goto end;
+    }
+
+    /* Let startup captures and sets settle, then measure only the scenario */
+    msleep(SETTLE_MS);
+    sd_bus_call_method(bus, STUB_SERVICE, STUB_PATH, STUB_IFACE, "ResetStats", NULL, NULL, NULL);
+
+    proc_stats_t before, after;
+    read_proc_stats(clight_pid, &before);
+    const double start = now_ms();
+    res->ret = s->run(bus);
+    /* Give Clight some time to process last requests */
+    msleep(SETTLE_MS);
+    res->duration_s = (now_ms() - start) / 1000;
+    if (read_proc_stats(clight_pid, &after) < 0) {
+        fprintf(stderr, "Clight died during '%s' scenario.\n", s->name);
+        res->ret = -1;
+        goto end;
+    }
+    res->cpu_ms = (after.cpu_ticks - before.cpu_ticks) * 1000.0 / sysconf(_SC_CLK_TCK);
+    res->wakeups = after.ctx_switches - before.ctx_switches;
+    res->peak_rss_kb = after.peak_rss_kb;
+    collect_stub_stats(bus, res);
+
+end:
+    stop(clight_pid);
+    if (bus) {
+        sd_bus_flush_close_unref(bus);
+    }
+    stop(stub_pid);
+    stop(bus_pid);
+    return res->ret;
+}
+
+static void print_results(const result_t *res, int num) {
+    if (json) {
+        printf("[\n");
+        for (int i = 0; i < num; i++) {
+            const result_t *r = &res[i];
+            printf("  { \"scenario\": \"%s\", \"ok\": %s, \"duration_s\": %.2f, \"latency_samples\": %d, "
+                   "\"latency_ms\": { \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f }, "
+                   "\"bus_calls\": %lu, \"cpu_ms\": %.1f, \"wakeups\": %lu, \"peak_rss_kb\": %lu }%s\n",
+                   r->name, r->ret == 0 ? "true" : "false", r->duration_s, r->num_latencies,
+                   r->lat_p50, r->lat_p90, r->lat_p99, r->lat_max,
+                   r->bus_calls, r->cpu_ms, r->wakeups, r->peak_rss_kb, i < num - 1 ? "," : "");
+        }
+        printf("]\n");
+        return;
+    }
+
+    printf("%-14s %4s %8s %8s %8s %8s %8s %9s %8s %9s\n", "scenario", "ok", "samples",
+           "p50(ms)", "p90(ms)", "p99(ms)", "bus", "cpu(ms)", "wakeups", "rss(kB)");
+    for (int i = 0; i < num; i++) {
+        const result_t *r = &res[i];
+        printf("%-14s %4s %8d %8.2f %8.2f %8.2f %8lu %9.1f %8lu %9lu\n", r->name, r->ret == 0 ? "yes" : "no",
+               r->num_latencies, r->lat_p50, r->lat_p90, r->lat_p99, r->bus_calls,
+               r->cpu_ms, r->wakeups, r->peak_rss_kb);
+    }
+}
+
+static int ctl_set_ambient(sd_bus *bus, double val) {
+    return sd_bus_call_method(bus, STUB_SERVICE, STUB_PATH, STUB_IFACE, "SetAmbient", NULL, NULL, "d", val);
+}
+
+static int ctl_monitor(sd_bus *bus, const char *member, const char *id) {
+    return sd_bus_call_method(bus, STUB_SERVICE, STUB_PATH, STUB_IFACE, member, NULL, NULL, "s", id);
+}
+
+static int ctl_idle(sd_bus *bus, bool idle) {
+    return sd_bus_call_method(bus, STUB_SERVICE, STUB_PATH, STUB_IFACE, "EmitIdle", NULL, NULL, "b", idle);
+}
+
+static int run_ambient_ramp(sd_bus *bus) {
+    for (int i = 0; i < cycles; i++) {
+        /* Triangle wave between 0 and 1 */
+        const double step = (double)(i % 10) / 10;
+        const double ambient = (i / 10) % 2 ? 1.0 - step : step;
+        int r = ctl_set_ambient(bus, ambient);
+        if (r >= 0) {
+            r = sd_bus_call_method(bus, CLIGHT_SERVICE, CLIGHT_PATH, CLIGHT_SERVICE, "Capture", NULL, NULL, "bb", false, false);
+        }
+        if (r < 0) {
+            return r;
+        }
+        msleep(200);
+    }
+    return 0;
+}
+
+static int run_hotplug(sd_bus *bus) {
+    char id[32];
+    for (int i = 0; i < num_monitors; i++) {
+        snprintf(id, sizeof(id), "bench%d", i);
+        int r = ctl_monitor(bus, "AddMonitor", id);
+        if (r < 0) {
+            return r;
+        }
+        msleep(100);
+    }
+    for (int i = 0; i < num_monitors; i++) {
+        snprintf(id, sizeof(id), "bench%d", i);
+        int r = ctl_monitor(bus, "RemoveMonitor", id);
+        if (r < 0) {
+            return r;
+        }
+        msleep(100);
+    }
+    return 0;
+}
+
+static int run_dimmer(sd_bus *bus) {
+    for (int i = 0; i < cycles; i++) {
+        int r = ctl_idle(bus, true);
+        if (r >= 0) {
+            msleep(200);
+            r = ctl_idle(bus, false);
+        }
+        if (r < 0) {
+            return r;
+        }
+        msleep(200);
+    }
+    return 0;
+}
+
+static int run_inhibit(sd_bus *bus) {
+    for (int i = 0; i < cycles * 10; i++) {
+        sd_bus_message *reply = NULL;
+        unsigned int cookie;
+        int r = sd_bus_call_method(bus, SC_SERVICE, SC_PATH, SC_SERVICE, "Inhibit", NULL, &reply, "ss", "clight-bench", "storm");
+        if (r < 0) {
+            return r;
+        }
+        sd_bus_message_read(reply, "u", &cookie);
+        sd_bus_message_unref(reply);
+        r = sd_bus_call_method(bus, SC_SERVICE, SC_PATH, SC_SERVICE, "UnInhibit", NULL, NULL, "u", cookie);
+        if (r < 0) {
+            return r;
+        }
+    }
+    return 0;
+}
+
+/* With a 7200x simulated clock, 24s are 2 days */
+static int run_daynight(sd_bus *bus) {
+    (void)bus;
+    msleep(24 * 1000);
+    return 0;
+}
@@ -0,0 +1,798 @@
+/*
+ * Clightd stand-in service.
+ *
+ * Implements the subset of org.clightd.clightd API used by Clight,
+ * with configurable reply latency/jitter and a scripted ambient brightness trace.
+ * It also exposes org.clightd.stub.Control on /org/clightd/stub,
+ * that lets a harness drive it (ambient, monitors hotplug, idle signals) and collect stats.
+ *
+ * It connects to the system bus; run it on a private dbus-daemon
+ * by exporting DBUS_SYSTEM_BUS_ADDRESS (see bench/README.md).
+ */
+
+#include <getopt.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <systemd/sd-bus.h>
+#include <systemd/sd-event.h>
+
+#define SERVICE             "org.clightd.clightd"
+#define OBJ_PATH            "/org/clightd/clightd"
+#define CONTROL_PATH        "/org/clightd/stub"
+#define CONTROL_IFACE       "org.clightd.stub.Control"
+#define STUB_VERSION        "5.9"
+#define MAX_MONITORS        64
+#define MAX_CLIENTS         16
+#define MAX_TRACE           4096
+#define MAX_STATS           64
+#define MAX_LATENCIES       65536
+#define DEF_TEMP            6500
+
+typedef struct {
+    char id[64];
+    char path[128];
+    double pct;
+    sd_bus_slot *slot;
+} monitor_t;
+
+typedef struct {
+    char path[128];
+    unsigned int timeout;
+    bool running;
+    sd_bus_slot *slot;
+} idle_client_t;
+
+typedef struct {
+    double t;       // trace time, in seconds
+    double value;   // ambient brightness [0, 1]
+} trace_point_t;
+
+typedef struct {
+    char key[96];
+    unsigned long count;
+} stat_t;
+
+typedef struct {
+    sd_bus_message *reply;
+    sd_event_source *src;
+    bool is_capture;
+} delayed_reply_t;
+
+static int parse_opts(int argc, char *argv[]);
+static int load_trace(const char *path);
+static double get_ambient(void);
+static uint64_t now_usec(void);
+static uint64_t reply_delay_usec(void);
+static int reply_later(sd_bus_message *reply, bool is_capture);
+static int on_delayed_reply(sd_event_source *s, uint64_t usec, void *userdata);
+static void account(sd_bus_message *m);
+static void account_set(void);
+static monitor_t *find_monitor(const char *id);
+static int add_monitor(const char *id, bool emit);
+static int remove_monitor(const char *id);
+static void set_all_monitors(double pct);
+static int method_capture(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_is_available(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_bl_get(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_bl_set(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_bl_server_get(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_bl_server_set(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_gamma_get(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_gamma_set(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_dpms_set(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_idle_get_client(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_idle_destroy_client(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_idle_client_start(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_idle_client_stop(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_screen_get(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_kbd_set(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_set_ambient(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_add_monitor(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_remove_monitor(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_emit_idle(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_get_stats(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_get_latencies(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_reset_stats(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+
+static sd_bus *bus;
+static sd_event *event;
+static int latency_ms, jitter_ms;
+static double trace_speed = 1.0, fixed_ambient = 0.5, screen_br = 0.3;
+static bool with_kbd;
+static uint64_t start_usec;
+static int gamma_temp = DEF_TEMP;
+static monitor_t *monitors[MAX_MONITORS];
+static int num_monitors;
+static idle_client_t clients[MAX_CLIENTS];
+static int num_clients;
+static trace_point_t trace[MAX_TRACE];
+static int trace_len;
+static stat_t stats[MAX_STATS];
+static int num_stats;
+static uint64_t last_capture_usec;
+static uint64_t latencies[MAX_LATENCIES];
+static int num_latencies;
+
+static const sd_bus_vtable clightd_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_PROPERTY("Version", "s", NULL, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+    SD_BUS_VTABLE_END
+};
+
+static const sd_bus_vtable sensor_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_METHOD("IsAvailable", "s", "sb", method_is_available, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("Capture", "sis", "sad", method_capture, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_SIGNAL("Changed", "ss", 0),
+    SD_BUS_VTABLE_END
+};
+
+static const sd_bus_vtable bl_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_METHOD("Get", NULL, "a(sd)", method_bl_get, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("Set", "d(du)", "b", method_bl_set, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_SIGNAL("Changed", "sd", 0),
+    SD_BUS_VTABLE_END
+};
+
+static const sd_bus_vtable bl_server_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_METHOD("Get", NULL, "d", method_bl_server_get, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("Set", "d(du)", "b", method_bl_server_set, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_VTABLE_END
+};
+
+static const sd_bus_vtable gamma_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_METHOD("Get", "ss", "i", method_gamma_get, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("Set", "ssi(buu)", "b", method_gamma_set, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_SIGNAL("Changed", "si", 0),
+    SD_BUS_VTABLE_END
+};
+
+static const sd_bus_vtable dpms_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_METHOD("Set", "ssi", "b", method_dpms_set, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_SIGNAL("Changed", "si", 0),
+    SD_BUS_VTABLE_END
+};
+
+static const sd_bus_vtable idle_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_METHOD("GetClient", NULL, "o", method_idle_get_client, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("DestroyClient", "o", NULL, method_idle_destroy_client, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_VTABLE_END
+};
+
+static const sd_bus_vtable idle_client_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_WRITABLE_PROPERTY("Timeout", "u", NULL, NULL, offsetof(idle_client_t, timeout), 0),
+    SD_BUS_METHOD("Start", NULL, NULL, method_idle_client_start, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("Stop", NULL, NULL, method_idle_client_stop, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_SIGNAL("Idle", "b", 0),
+    SD_BUS_VTABLE_END
+};
+
+static const sd_bus_vtable screen_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_METHOD("GetEmittedBrightness", "ss", "d", method_screen_get, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_VTABLE_END
+};
+
+static const sd_bus_vtable kbd_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_METHOD("Set", "d", "b", method_kbd_set, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("SetTimeout", "i", "b", method_kbd_set, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_VTABLE_END
+};
+
+static const sd_bus_vtable control_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_METHOD("SetAmbient", "d", NULL, method_set_ambient, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("AddMonitor", "s", NULL, method_add_monitor, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("RemoveMonitor", "s", NULL, method_remove_monitor, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("EmitIdle", "b", NULL, method_emit_idle, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("GetStats", NULL, "a{st}", method_get_stats, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("GetLatencies", NULL, "at", method_get_latencies, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("ResetStats", NULL, NULL, method_reset_stats, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_VTABLE_END
+};
+
+int main(int argc, char *argv[]) {
+    int initial_monitors = parse_opts(argc, argv);
+    if (initial_monitors < 0) {
+        return EXIT_FAILURE;
+    }
+
+    srand(time(NULL));
+    start_usec = now_usec();
+
+    int r = sd_event_default(&event);
+    if (r >= 0) {
+        r = sd_bus_open_system(&bus);
+    }
+    if (r < 0) {
+        fprintf(stderr, "Failed to connect to bus: %s\n", strerror(-r));
+        return EXIT_FAILURE;
+    }
+
+    const char *version = STUB_VERSION;
+    sd_bus_add_object_vtable(bus, NULL, OBJ_PATH, SERVICE, clightd_vtable, &version);
+    sd_bus_add_object_vtable(bus, NULL, OBJ_PATH "/Sensor", SERVICE ".Sensor", sensor_vtable, NULL);
+    sd_bus_add_object_vtable(bus, NULL, OBJ_PATH "/Backlight2", SERVICE ".Backlight2", bl_vtable, NULL);
+    sd_bus_add_object_manager(bus, NULL, OBJ_PATH "/Backlight2");
+    sd_bus_add_object_vtable(bus, NULL, OBJ_PATH "/Gamma", SERVICE ".Gamma", gamma_vtable, NULL);
+    sd_bus_add_object_vtable(bus, NULL, OBJ_PATH "/Dpms", SERVICE ".Dpms", dpms_vtable, NULL);
+    sd_bus_add_object_vtable(bus, NULL, OBJ_PATH "/Idle", SERVICE ".Idle", idle_vtable, NULL);
+    sd_bus_add_object_vtable(bus, NULL, OBJ_PATH "/Screen", SERVICE ".Screen", screen_vtable, NULL);
+    if (with_kbd) {
+        /* Clight checks that KbdBacklight object has got children nodes */
+        sd_bus_add_object_vtable(bus, NULL, OBJ_PATH "/KbdBacklight", SERVICE ".KbdBacklight", kbd_vtable, NULL);
+        sd_bus_add_object_vtable(bus, NULL, OBJ_PATH "/KbdBacklight/kbd0", SERVICE ".KbdBacklight", kbd_vtable, NULL);
+    }
+    sd_bus_add_object_vtable(bus, NULL, CONTROL_PATH, CONTROL_IFACE, control_vtable, NULL);
+
+    for (int i = 0; i < initial_monitors; i++) {
+        char id[32];
+        snprintf(id, sizeof(id), "mon%d", i);
+        add_monitor(id, false);
+    }
+
+    r = sd_bus_request_name(bus, SERVICE, 0);
+    if (r < 0) {
+        fprintf(stderr, "Failed to acquire '%s' name: %s\n", SERVICE, strerror(-r));
+        return EXIT_FAILURE;
+    }
+    sd_bus_attach_event(bus, event, 0);
+
+    printf("Clightd stub ready: latency %dms, jitter %dms, %d monitors, %d trace points.\n",
+           latency_ms, jitter_ms, num_monitors, trace_len);
+    fflush(stdout);
+
+    r = sd_event_loop(event);
+    sd_bus_flush_close_unref(bus);
+    sd_event_unref(event);
+    return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Returns number of initial monitors, or -1 on error */
+static int parse_opts(int argc, char *argv[]) {
+    static const struct option opts[] = {
+        { "latency", required_argument, NULL, 'l' },
+        { "jitter", required_argument, NULL, 'j' },
+        { "trace", required_argument, NULL, 't' },
+        { "speed", required_argument, NULL, 's' },
+        { "monitors", required_argument, NULL, 'm' },
+        { "ambient", required_argument, NULL, 'a' },
+        { "screen", required_argument, NULL, 'S' },
+        { "kbd", no_argument, NULL, 'k' },
+        { "help", no_argument, NULL, 'h' },
+        { 0 }
+    };
+
+    int c, mons = 1;
+    while ((c = getopt_long(argc, argv, "l:j:t:s:m:a:S:kh", opts, NULL)) != -1) {
+        switch (c) {
+        case 'l':
+            latency_ms = atoi(optarg);
+            break;
+        case 'j':
+            jitter_ms = atoi(optarg);
+            break;
+        case 't':
+            if (load_trace(optarg) < 0) {
+                fprintf(stderr, "Failed to load trace '%s'.\n", optarg);
+                return -1;
+            }
+            break;
+        case 's':
+            trace_speed = strtod(optarg, NULL);
+            break;
+        case 'm':
+            mons = atoi(optarg);
+            break;
+        case 'a':
+            fixed_ambient = strtod(optarg, NULL);
+            break;
+        case 'S':
+            screen_br = strtod(optarg, NULL);
+            break;
+        case 'k':
+            with_kbd = true;
+            break;
+        default:
+            printf("Usage: %s [--latency ms] [--jitter ms] [--trace file] [--speed x] "
+                   "[--monitors n] [--ambient pct] [--screen pct] [--kbd]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (latency_ms < 0 || jitter_ms < 0 || trace_speed <= 0 || mons < 0 || mons > MAX_MONITORS) {
+        fprintf(stderr, "Wrong parameters.\n");
+        return -1;
+    }
+    return mons;
+}
+
+/*
+ * Trace file: one "<seconds> <ambient>" couple per line, sorted by time.
+ * Lines starting with '#' are skipped.
+ */
+static int load_trace(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -errno;
+    }
+    char line[256];
+    while (trace_len < MAX_TRACE && fgets(line, sizeof(line), f)) {
+        if (line[0] == '#') {
+            continue;
+        }
+        trace_point_t *p = &trace[trace_len];
+        if (sscanf(line, "%lf %lf", &p->t, &p->value) == 2) {
+            trace_len++;
+        }
+    }
+    fclose(f);
+    return trace_len > 0 ? 0 : -EINVAL;
+}
+
+/* Linear interpolation over the trace; trace time is real elapsed time times trace_speed */
+static double get_ambient(void) {
+    if (trace_len == 0) {
+        return fixed_ambient;
+    }
+    const double t = (now_usec() - start_usec) / 1e6 * trace_speed;
+    if (t <= trace[0].t) {
+        return trace[0].value;
+    }
+    for (int i = 1; i < trace_len; i++) {
+        if (t < trace[i].t) {
+            const trace_point_t *a = &trace[i - 1], *b = &trace[i];
+            return a->value + (b->value - a->value) * (t - a->t) / (b->t - a->t);
+        }
+    }
+    return trace[trace_len - 1].value;
+}
+
+static uint64_t now_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t reply_delay_usec(void) {
+    int delay = latency_ms;
+    if (jitter_ms > 0) {
+        delay += (rand() % (2 * jitter_ms + 1)) - jitter_ms;
+    }
+    return delay > 0 ? (uint64_t)delay * 1000 : 0;
+}
+
+/* Sends reply after configured latency; takes ownership of reply */
+static int reply_later(sd_bus_message *reply, bool is_capture) {
+    const uint64_t delay = reply_delay_usec();
+    if (delay == 0) {
+        if (is_capture) {
+            last_capture_usec = now_usec();
+        }
+        int r = sd_bus_send(bus, reply, NULL);
+        sd_bus_message_unref(reply);
+        return r < 0 ? r : 1;
+    }
+
+    delayed_reply_t *d = calloc(1, sizeof(delayed_reply_t));
+    if (!d) {
+        sd_bus_message_unref(reply);
+        return -ENOMEM;
+    }
+    d->reply = reply;
+    d->is_capture = is_capture;
+    uint64_t now;
+    sd_event_now(event, CLOCK_MONOTONIC, &now);
+    int r = sd_event_add_time(event, &d->src, CLOCK_MONOTONIC, now + delay, 0, on_delayed_reply, d);
+    if (r < 0) {
+        sd_bus_message_unref(reply);
+        free(d);
+        return r;
+    }
+    return 1;
+}
+
+static int on_delayed_reply(sd_event_source *s, uint64_t usec, void *userdata) {
+    delayed_reply_t *d = (delayed_reply_t *)userdata;
+    if (d->is_capture) {
+        last_capture_usec = now_usec();
+    }
+    sd_bus_send(bus, d->reply, NULL);
+    sd_bus_message_unref(d->reply);
+    sd_event_source_unref(s);
+    free(d);
+    return 0;
+}
+
+/* Count received method calls by "Interface.Member" */
+static void account(sd_bus_message *m) {
+    char key[sizeof(stats[0].key)];
+    snprintf(key, sizeof(key), "%s.%s", sd_bus_message_get_interface(m), sd_bus_message_get_member(m));
+    for (int i = 0; i < num_stats; i++) {
+        if (!strcmp(stats[i].key, key)) {
+            stats[i].count++;
+            return;
+        }
+    }
+    if (num_stats < MAX_STATS) {
+        strcpy(stats[num_stats].key, key);
+        stats[num_stats++].count = 1;
+    }
+}
+
+/* Store capture-to-Set latency for first backlight Set following a Capture */
+static void account_set(void) {
+    if (last_capture_usec != 0 && num_latencies < MAX_LATENCIES) {
+        latencies[num_latencies++] = now_usec() - last_capture_usec;
+    }
+    last_capture_usec = 0;
+}
+
+static monitor_t *find_monitor(const char *id) {
+    for (int i = 0; i < num_monitors; i++) {
+        if (!strcmp(monitors[i]->id, id)) {
+            return monitors[i];
+        }
+    }
+    return NULL;
+}
+
+static int add_monitor(const char *id, bool emit) {
+    if (num_monitors == MAX_MONITORS) {
+        return -ENOSPC;
+    }
+    if (find_monitor(id)) {
+        return -EEXIST;
+    }
+    monitor_t *mon = calloc(1, sizeof(monitor_t));
+    if (!mon) {
+        return -ENOMEM;
+    }
+    snprintf(mon->id, sizeof(mon->id), "%s", id);
+    snprintf(mon->path, sizeof(mon->path), OBJ_PATH "/Backlight2/%s", id);
+    mon->pct = 1.0;
+    int r = sd_bus_add_object_vtable(bus, &mon->slot, mon->path, SERVICE ".Backlight2.Server", bl_server_vtable, mon);
+    if (r < 0) {
+        free(mon);
+        return r;
+    }
+    monitors[num_monitors++] = mon;
+    if (emit) {
+        sd_bus_emit_object_added(bus, mon->path);
+    }
+    return 0;
+}
+
+static int remove_monitor(const char *id) {
+    for (int i = 0; i < num_monitors; i++) {
+        if (!strcmp(monitors[i]->id, id)) {
+            sd_bus_emit_object_removed(bus, monitors[i]->path);
+            sd_bus_slot_unref(monitors[i]->slot);
+            free(monitors[i]);
+            memmove(&monitors[i], &monitors[i + 1], (num_monitors - i - 1) * sizeof(monitor_t *));
+            num_monitors--;
+            return 0;
+        }
+    }
+    return -ENOENT;
+}
+
+static void set_all_monitors(double pct) {
+    for (int i = 0; i < num_monitors; i++) {
+        monitors[i]->pct = pct;
+        sd_bus_emit_signal(bus, OBJ_PATH "/Backlight2", SERVICE ".Backlight2", "Changed", "sd", monitors[i]->id, pct);
+    }
+}
+
+static int method_capture(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    const char *sensor, *opts;
+    int num_captures;
+    account(m);
+    int r = sd_bus_message_read(m, "sis", &sensor, &num_captures, &opts);
+    if (r < 0) {
+        return r;
+    }
+    if (num_captures <= 0 || num_captures > 20) {
+        sd_bus_error_set_const(ret_error, SD_BUS_ERROR_INVALID_ARGS, "Wrong number of captures.");
+        return -EINVAL;
+    }
+
+    double frames[20];
+    const double ambient = get_ambient();
+    for (int i = 0; i < num_captures; i++) {
+        frames[i] = ambient;
+    }
+
+    sd_bus_message *reply = NULL;
+    sd_bus_message_new_method_return(m, &reply);
+    sd_bus_message_append(reply, "s", "video0");
+    sd_bus_message_append_array(reply, 'd', frames, num_captures * sizeof(double));
+    return reply_later(reply, true);
+}
+
+static int method_is_available(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    account(m);
+    sd_bus_message *reply = NULL;
+    sd_bus_message_new_method_return(m, &reply);
+    sd_bus_message_append(reply, "sb", "video0", true);
+    return reply_later(reply, false);
+}
+
+static int method_bl_get(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    account(m);
+    sd_bus_message *reply = NULL;
+    sd_bus_message_new_method_return(m, &reply);
+    sd_bus_message_open_container(reply, SD_BUS_TYPE_ARRAY, "(sd)");
+    for (int i = 0; i < num_monitors; i++) {
+        sd_bus_message_append(reply, "(sd)", monitors[i]->id, monitors[i]->pct);
+    }
+    sd_bus_message_close_container(reply);
+    return reply_later(reply, false);
+}
+
+static int method_bl_set(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    double pct, step;
+    unsigned int timeout;
+    account(m);
+    account_set();
+    int r = sd_bus_message_read(m, "d(du)", &pct, &step, &timeout);
+    if (r < 0) {
+        return r;
+    }
+    set_all_monitors(pct);
+
+    sd_bus_message *reply = NULL;
+    sd_bus_message_new_method_return(m, &reply);
+    sd_bus_message_append(reply, "b", true);
+    return reply_later(reply, false);
+}
+
+static int method_bl_server_get(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    monitor_t *mon = (monitor_t *)userdata;
+    account(m);
+    sd_bus_message *reply = NULL;
+    sd_bus_message_new_method_return(m, &reply);
+    sd_bus_message_append(reply, "d", mon->pct);
+    return reply_later(reply, false);
+}
+
+static int method_bl_server_set(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    monitor_t *mon = (monitor_t *)userdata;
+    double pct, step;
+    unsigned int timeout;
+    account(m);
+    account_set();
+    int r = sd_bus_message_read(m, "d(du)", &pct, &step, &timeout);
+    if (r < 0) {
+        return r;
+    }
+    mon->pct = pct;
+    sd_bus_emit_signal(bus, OBJ_PATH "/Backlight2", SERVICE ".Backlight2", "Changed", "sd", mon->id, pct);
+
+    sd_bus_message *reply = NULL;
+    sd_bus_message_new_method_return(m, &reply);
+    sd_bus_message_append(reply, "b", true);
+    return reply_later(reply, false);
+}
+
+static int method_gamma_get(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    account(m);
+    sd_bus_message *reply = NULL;
+    sd_bus_message_new_method_return(m, &reply);
+    sd_bus_message_append(reply, "i", gamma_temp);
+    return reply_later(reply, false);
+}
+
+static int method_gamma_set(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    const char *display, *env;
+    int temp, smooth;
+    unsigned int step, timeout;
+    account(m);
+    int r = sd_bus_message_read(m, "ssi(buu)", &display, &env, &temp, &smooth, &step, &timeout);
+    if (r < 0) {
+        return r;
+    }
+    if (temp < 1000 || temp > 10000) {
+        sd_bus_error_set_const(ret_error, SD_BUS_ERROR_INVALID_ARGS, "Wrong temperature.");
+        return -EINVAL;
+    }
+    /* Transitions are not simulated: jump straight to target temperature */
+    gamma_temp = temp;
+    sd_bus_emit_signal(bus, OBJ_PATH "/Gamma", SERVICE ".Gamma", "Changed", "si", display ? display : "", temp);
+
+    sd_bus_message *reply = NULL;
+    sd_bus_message_new_method_return(m, &reply);
+    sd_bus_message_append(reply, "b", true);
+    return reply_later(reply, false);
+}
+
+static int method_dpms_set(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    const char *display, *env;
+    int level;
+    account(m);
+    int r = sd_bus_message_read(m, "ssi", &display, &env, &level);
+    if (r < 0) {
+        return r;
+    }
+    sd_bus_emit_signal(bus, OBJ_PATH "/Dpms", SERVICE ".Dpms", "Changed", "si", display ? display : "", level);
+
+    sd_bus_message *reply = NULL;
+    sd_bus_message_new_method_return(m, &reply);
+    sd_bus_message_append(reply, "b", true);
+    return reply_later(reply, false);
+}
+
+static int method_idle_get_client(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    static int client_id = 0;
+    account(m);
+    /* Reuse destroyed clients entries: their address is the client object userdata */
+    idle_client_t *cl = NULL;
+    for (int i = 0; i < num_clients && !cl; i++) {
+        if (!clients[i].slot) {
+            cl = &clients[i];
+        }
+    }
+    if (!cl) {
+        if (num_clients == MAX_CLIENTS) {
+            sd_bus_error_set_const(ret_error, SD_BUS_ERROR_FAILED, "Too many clients.");
+            return -ENOSPC;
+        }
+        cl = &clients[num_clients++];
+    }
+    memset(cl, 0, sizeof(idle_client_t));
+    snprintf(cl->path, sizeof(cl->path), OBJ_PATH "/Idle/Client%d", client_id++);
+    int r = sd_bus_add_object_vtable(bus, &cl->slot, cl->path, SERVICE ".Idle.Client", idle_client_vtable, cl);
+    if (r < 0) {
+        return r;
+    }
+
+    sd_bus_message *reply = NULL;
+    sd_bus_message_new_method_return(m, &reply);
+    sd_bus_message_append(reply, "o", cl->path);
+    return reply_later(reply, false);
+}
+
+static int method_idle_destroy_client(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    const char *path;
+    account(m);
+    int r = sd_bus_message_read(m, "o", &path);
+    if (r < 0) {
+        return r;
+    }
+    for (int i = 0; i < num_clients; i++) {
+        if (!strcmp(clients[i].path, path)) {
+            sd_bus_slot_unref(clients[i].slot);
+            memset(&clients[i], 0, sizeof(idle_client_t));
+            break;
+        }
+    }
+    sd_bus_message *reply = NULL;
+    sd_bus_message_new_method_return(m, &reply);
+    return reply_later(reply, false);
+}
+
+static int method_idle_client_start(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    idle_client_t *cl = (idle_client_t *)userdata;
+    account(m);
+    cl->running = true;
+    sd_bus_message *reply = NULL;
+    sd_bus_message_new_method_return(m, &reply);
+    return reply_later(reply, false);
+}
+
+static int method_idle_client_stop(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    idle_client_t *cl = (idle_client_t *)userdata;
+    account(m);
+    cl->running = false;
+    sd_bus_message *reply = NULL;
+    sd_bus_message_new_method_return(m, &reply);
+    return reply_later(reply, false);
+}
+
+static int method_screen_get(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    account(m);
+    sd_bus_message *reply = NULL;
+    sd_bus_message_new_method_return(m, &reply);
+    sd_bus_message_append(reply, "d", screen_br);
+    return reply_later(reply, false);
+}
+
+static int method_kbd_set(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    account(m);
+    sd_bus_message *reply = NULL;
+    sd_bus_message_new_method_return(m, &reply);
+    sd_bus_message_append(reply, "b", true);
+    return reply_later(reply, false);
+}
+
+static int method_set_ambient(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    int r = sd_bus_message_read(m, "d", &fixed_ambient);
+    if (r < 0) {
+        return r;
+    }
+    /* An explicit ambient value overrides the trace */
+    trace_len = 0;
+    return sd_bus_reply_method_return(m, NULL);
+}
+
+static int method_add_monitor(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    const char *id;
+    int r = sd_bus_message_read(m, "s", &id);
+    if (r >= 0) {
+        r = add_monitor(id, true);
+    }
+    if (r < 0) {
+        sd_bus_error_set_errno(ret_error, -r);
+        return r;
+    }
+    return sd_bus_reply_method_return(m, NULL);
+}
+
+static int method_remove_monitor(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    const char *id;
+    int r = sd_bus_message_read(m, "s", &id);
+    if (r >= 0) {
+        r = remove_monitor(id);
+    }
+    if (r < 0) {
+        sd_bus_error_set_errno(ret_error, -r);
+        return r;
+    }
+    return sd_bus_reply_method_return(m, NULL);
+}
+
+/* Emit Idle signal on every started idle client */
+static int method_emit_idle(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    int idle;
+    int r = sd_bus_message_read(m, "b", &idle);
+    if (r < 0) {
+        return r;
+    }
+    for (int i = 0; i < num_clients; i++) {
+        if (clients[i].slot && clients[i].running) {
+            sd_bus_emit_signal(bus, clients[i].path, SERVICE ".Idle.Client", "Idle", "b", idle);
+        }
+    }
+    return sd_bus_reply_method_return(m, NULL);
+}
+
+static int method_get_stats(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    sd_bus_message *reply = NULL;
+    sd_bus_message_new_method_return(m, &reply);
+    sd_bus_message_open_container(reply, SD_BUS_TYPE_ARRAY, "{st}");
+    for (int i = 0; i < num_stats; i++) {
+        sd_bus_message_append(reply, "{st}", stats[i].key, (uint64_t)stats[i].count);
+    }
+    sd_bus_message_close_container(reply);
+    int r = sd_bus_send(NULL, reply, NULL);
+    sd_bus_message_unref(reply);
+    return r;
+}
+
+/* Capture-to-Set latencies, in us */
+static int method_get_latencies(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    sd_bus_message *reply = NULL;
+    sd_bus_message_new_method_return(m, &reply);
+    sd_bus_message_append_array(reply, 't', latencies, num_latencies * sizeof(uint64_t));
+    int r = sd_bus_send(NULL, reply, NULL);
+    sd_bus_message_unref(reply);
+    return r;
+}
+
+static int method_reset_stats(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    num_stats = 0;
+    num_latencies = 0;
+    last_capture_usec = 0;
+    return sd_bus_reply_method_return(m, NULL);
+}
@@ -0,0 +1,273 @@
+/*
+ * Microbenchmarks for my_math hot functions.
+ *
+ * It is linked against my_math, clock, utils and profile sources;
+ * conf/state globals and log functions are provided here.
+ * Results are printed as CSV (default) or JSON, one row per function/parameter,
+ * so that they can be diffed between commits.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "my_math.h"
+#include "clock.h"
+
+#define DEFAULT_ITERATIONS  100000
+
+typedef struct {
+    const char *func;
+    char param[32];
+    long iterations;
+    double ns_per_op;
+    int failures;       // eg: no sunrise/sunset on polar latitudes
+} result_t;
+
+static int parse_opts(int argc, char *argv[]);
+static double now_ns(void);
+static void fill_curve(curve_t *curve, int num_points);
+static void add_result(const char *func, const char *param, long iterations, double elapsed, int failures);
+static void bench_polynomialfit(void);
+static void bench_get_value_from_curve(void);
+static void bench_compute_average(void);
+static void bench_sunrise_sunset(void);
+static void bench_get_distance(void);
+static void print_results(void);
+
+state_t state;
+conf_t conf;
+
+static long iterations = DEFAULT_ITERATIONS;
+static bool json;
+static result_t *results;
+static int num_results;
+static volatile double sink; // avoid dead code elimination of benchmarked calls
+
+static const int curve_sizes[] = { 2, 3, 5, 11, 25, MAX_SIZE_POINTS };
+static const float latitudes[] = { -89.0, -70.0, -45.0, 0.0, 45.0, 66.5, 70.0, 80.0, 89.0 };
+
+int main(int argc, char *argv[]) {
+    if (parse_opts(argc, argv) < 0) {
+        return EXIT_FAILURE;
+    }
+    init_clock();
+
+    /* Solar events table gets cached on disk: keep it away from user's cache */
+    char cache_dir[] = "/tmp/math-bench.XXXXXX";
+    if (!mkdtemp(cache_dir)) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    setenv("XDG_CACHE_HOME", cache_dir, 1);
+
+    bench_polynomialfit();
+    bench_get_value_from_curve();
+    bench_compute_average();
+    bench_sunrise_sunset();
+    bench_get_distance();
+
+    print_results();
+    free(results);
+
+    char cache_file[PATH_MAX];
+    snprintf(cache_file, sizeof(cache_file), "%s/clight_solar", cache_dir);
+    unlink(cache_file);
+    rmdir(cache_dir);
+    return EXIT_SUCCESS;
+}
+
+/* Logging is disabled: plotting and debug output would dominate timings */
+void log_message(const char *filename, int lineno, const char type, const char *log_msg, ...) {
+    (void)filename;
+    (void)lineno;
+    (void)type;
+    (void)log_msg;
+}
+
+bool log_verbose_enabled(void) {
+    return false;
+}
+
+static int parse_opts(int argc, char *argv[]) {
+    static const struct option opts[] = {
+        { "iterations", required_argument, NULL, 'n' },
+        { "json", no_argument, NULL, 'j' },
+        { "help", no_argument, NULL, 'h' },
+        { 0 }
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "n:jh", opts, NULL)) != -1) {
+        switch (c) {
+        case 'n':
+            iterations = strtol(optarg, NULL, 10);
+            if (iterations <= 0) {
+                fprintf(stderr, "Wrong iterations value: '%s'.\n", optarg);
+                return -1;
+            }
+            break;
+        case 'j':
+            json = true;
+            break;
+        default:
+            printf("Usage: %s [--iterations n] [--json]\n", argv[0]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Default-like backlight curve: monotonic, slightly concave */
+static void fill_curve(curve_t *curve, int num_points) {
+    curve->num_points = num_points;
+    for (int i = 0; i < num_points; i++) {
+        const double x = (double)i / (num_points - 1);
+        curve->points[i] = sqrt(x) * 0.8 + x * 0.2;
+    }
+}
+
+static void add_result(const char *func, const char *param, long iters, double elapsed, int failures) {
+    results = realloc(results, (num_results + 1) * sizeof(result_t));
+    result_t *r = &results[num_results++];
+    r->func = func;
+    snprintf(r->param, sizeof(r->param), "%s", param);
+    r->iterations = iters;
+    r->ns_per_op = elapsed / iters;
+    r->failures = failures;
+}
+
+/*
+ * "polynomialfit" rows force a fit on each call, by invalidating the cached fit;
+ * "polynomialfit_cached" rows measure the unchanged points path, that only hashes them.
+ */
+static void bench_polynomialfit(void) {
+    char param[32];
+    curve_t curve;
+    for (size_t s = 0; s < sizeof(curve_sizes) / sizeof(curve_sizes[0]); s++) {
+        fill_curve(&curve, curve_sizes[s]);
+        snprintf(param, sizeof(param), "points=%d", curve_sizes[s]);
+        
+        /* Fits are way slower than everything else */
+        const long iters = iterations / 10 > 0 ? iterations / 10 : 1;
+        double start = now_ns();
+        for (long i = 0; i < iters; i++) {
+            curve.fit_hash = 0;
+            polynomialfit(NULL, &curve, "bench");
+        }
+        sink = curve.fit_parameters[0];
+        add_result("polynomialfit", param, iters, now_ns() - start, 0);
+        
+        start = now_ns();
+        for (long i = 0; i < iterations; i++) {
+            polynomialfit(NULL, &curve, "bench");
+        }
+        sink = curve.fit_parameters[0];
+        add_result("polynomialfit_cached", param, iterations, now_ns() - start, 0);
+    }
+}
+
+static void bench_get_value_from_curve(void) {
+    char param[32];
+    curve_t curve;
+    for (size_t s = 0; s < sizeof(curve_sizes) / sizeof(curve_sizes[0]); s++) {
+        fill_curve(&curve, curve_sizes[s]);
+        polynomialfit(NULL, &curve, "bench");
+        double acc = 0;
+        const double start = now_ns();
+        for (long i = 0; i < iterations; i++) {
+            acc += get_value_from_curve((double)(i % 101) / 100, &curve);
+        }
+        sink = acc;
+        snprintf(param, sizeof(param), "points=%d", curve_sizes[s]);
+        add_result("get_value_from_curve", param, iterations, now_ns() - start, 0);
+    }
+}
+
+static void bench_compute_average(void) {
+    static const int frames[] = { 1, 5, 10, 20, 50 };
+    char param[32];
+    double intensity[50];
+    for (int i = 0; i < 50; i++) {
+        intensity[i] = (double)(i * 37 % 50) / 50;
+    }
+    for (size_t s = 0; s < sizeof(frames) / sizeof(frames[0]); s++) {
+        double acc = 0;
+        const double start = now_ns();
+        for (long i = 0; i < iterations; i++) {
+            acc += compute_average(intensity, frames[s]);
+        }
+        sink = acc;
+        snprintf(param, sizeof(param), "frames=%d", frames[s]);
+        add_result("compute_average", param, iterations, now_ns() - start, 0);
+    }
+}
+
+/*
+ * Iterations span a whole year through dayshift, to include polar day/night at high latitudes.
+ * First call for each latitude computes (and caches) the solar events table: it is amortized over iterations.
+ */
+static void bench_sunrise_sunset(void) {
+    static const struct {
+        const char *name;
+        int (*fn)(const float, const float, time_t *, int);
+    } funcs[] = { { "calculate_sunrise", calculate_sunrise }, { "calculate_sunset", calculate_sunset } };
+
+    char param[32];
+    for (size_t f = 0; f < sizeof(funcs) / sizeof(funcs[0]); f++) {
+        for (size_t l = 0; l < sizeof(latitudes) / sizeof(latitudes[0]); l++) {
+            int failures = 0;
+            time_t t;
+            const double start = now_ns();
+            for (long i = 0; i < iterations; i++) {
+                if (funcs[f].fn(latitudes[l], 9.0, &t, i % 365) != 0) {
+                    failures++;
+                }
+            }
+            sink = t;
+            snprintf(param, sizeof(param), "lat=%.1f", latitudes[l]);
+            add_result(funcs[f].name, param, iterations, now_ns() - start, failures);
+        }
+    }
+}
+
+static void bench_get_distance(void) {
+    char param[32];
+    for (size_t l = 0; l < sizeof(latitudes) / sizeof(latitudes[0]); l++) {
+        loc_t a = { latitudes[l], 9.0 };
+        double acc = 0;
+        const double start = now_ns();
+        for (long i = 0; i < iterations; i++) {
+            loc_t b = { latitudes[l] + (double)(i % 100) / 1000, 9.0 + (double)(i % 37) / 100 };
+            acc += get_distance(&a, &b);
+        }
+        sink = acc;
+        snprintf(param, sizeof(param), "lat=%.1f", latitudes[l]);
+        add_result("get_distance", param, iterations, now_ns() - start, 0);
+    }
+}
+
+static void print_results(void) {
+    if (json) {
+        printf("[\n");
+        for (int i = 0; i < num_results; i++) {
+            const result_t *r = &results[i];
+            printf("  { \"function\": \"%s\", \"param\": \"%s\", \"iterations\": %ld, \"ns_per_op\": %.2f, \"failures\": %d }%s\n",
+                   r->func, r->param, r->iterations, r->ns_per_op, r->failures, i < num_results - 1 ? "," : "");
+        }
+        printf("]\n");
+        return;
+    }
+
+    printf("function,param,iterations,ns_per_op,failures\n");
+    for (int i = 0; i < num_results; i++) {
+        const result_t *r = &results[i];
+        printf("%s,%s,%ld,%.2f,%d\n", r->func, r->param, r->iterations, r->ns_per_op, r->failures);
+    }
+}
@@ -6,9 +6,11 @@
 #include <errno.h>
 #include <math.h>
 #include <pwd.h>
+#define CLIGHT_CORE                         // Clight own modules: no execution budget
 #include "public.h"
 #include "validations.h"
 #include "log.h"
+#include "profile.h"
 #include <module/modules_easy.h>
 #include <module/map.h>
 
@@ -17,6 +19,8 @@
 #define MAX_SIZE_POINTS 50                  // max number of points used for polynomial regression
 #define DEF_SIZE_POINTS 11                  // default number of points used for polynomial regression
 #define DEGREE 3                            // number of parameters for polynomial regression
+#define MAX_GAMMA_OUTPUTS 8                 // max number of additional gamma outputs
+#define MAX_MODULE_BUDGETS 16               // max number of custom modules with their own execution budget
 
 #define IN_EVENT SIZE_STATES                // Backlight module has 1 more state: IN_EVENT
 
@@ -33,6 +37,7 @@ typedef struct {
     int num_points;
     double points[MAX_SIZE_POINTS];
     double fit_parameters[DEGREE]; // best-fit parameters
+    uint64_t fit_hash;             // hash of the points fit_parameters were computed from; 0 if none
 } curve_t;
 
 typedef struct {
@@ -60,6 +65,7 @@ typedef struct {
     int capture_on_lid_opened;              // whether to trigger a new capture whenever lid gets opened
     int restore;                            // whether backlight should be restored on Clight exit
     int sync_monitors_delay;                // delay before syncing gamma and backlight when monitors are hotplugged
+    int timer_slack[SIZE_AC];               // window (s) in which capture timer can be coalesced with other timers
 } bl_conf_t;
 
 typedef struct {
@@ -68,6 +74,12 @@ typedef struct {
     curve_t curve[SIZE_AC];                 // curve used to match ambient brightness to certain keyboard backlight level
 } kbd_conf_t;
 
+typedef struct {
+    char *display;                          // X or wayland display of the output
+    char *env;                              // xauthority or xdg runtime dir for display; NULL to use clight's one
+    int offset;                             // temperature offset from main display temperature
+} gamma_output_t;
+
 typedef struct {
     int disabled;
     int temp[SIZE_STATES];                  // screen temperature for each daytime
@@ -76,7 +88,13 @@ typedef struct {
     int trans_timeout;                      // every gamma transition timeout value, used when smooth GAMMA transitions are enabled
     int long_transition;                    // flag to enable a very long smooth transition for gamma (redshift-like)
     int ambient_gamma;                      // enable gamma adjustments based on ambient backlight
+    int ambient_deadband;                   // minimum temperature change (K) to issue a new gamma set with ambient_gamma
+    int ambient_interval;                   // minimum interval (s) between 2 gamma sets with ambient_gamma
+    int solar_transition;                   // enable gamma temperature following sun elevation angle
+    int solar_step;                         // minimum temperature change (K) to issue a new gamma set with solar_transition
     int restore;                            // whether gamma should be restored on Clight exit
+    gamma_output_t outputs[MAX_GAMMA_OUTPUTS]; // additional displays whose temperature follows the main one
+    int num_outputs;
 } gamma_conf_t;
 
 typedef struct {
@@ -84,6 +102,7 @@ typedef struct {
     int event_duration;                     // duration of an event (by default 30mins, ie: it starts 30mins before an event and ends 30mins after)
     loc_t loc;                              // user location as loaded by config
     int events_os[SIZE_EVENTS];             // offset for each event
+    int timer_slack[SIZE_AC];               // window (s) in which daytime timer can be coalesced with other timers
 } daytime_conf_t;
 
 typedef struct {
@@ -102,6 +121,7 @@ typedef struct {
     int disabled;
     double contrib;
     int timeout[SIZE_AC];                   // screen timeouts
+    int timer_slack[SIZE_AC];               // window (s) in which screen timer can be coalesced with other timers
 } screen_conf_t;
 
 typedef struct {
@@ -111,6 +131,28 @@ typedef struct {
     int inhibit_bl;                         // whether to inhibit backlight module too
 } inh_conf_t;
 
+typedef struct {
+    char *name;                             // custom module name, as passed to CLIGHT_MODULE()
+    int budget;                             // max duration (ms) of module receive(); 0 to disable tracking
+} module_budget_t;
+
+typedef struct {
+    int budget;                             // default max duration (ms) of custom modules receive(); 0 to disable tracking
+    int throttle;                           // consecutive overruns before dropping frequent updates to a custom module; 0 to never throttle
+    module_budget_t modules[MAX_MODULE_BUDGETS]; // per-module budgets
+    int num_modules;
+} budget_conf_t;
+
+typedef struct {
+    char file[PATH_MAX + 1];                // OpenMetrics textfile periodically written with Clight metrics; empty to disable
+    int interval;                           // seconds between each metrics file update
+} metrics_conf_t;
+
+typedef struct {
+    int interval;                           // seconds between each loop lag probe; 0 to disable
+    int threshold;                          // loop lag (ms) above which a warning is logged
+} lag_conf_t;
+
 /* Struct that holds global config as passed through cmdline args/config file reading */
 typedef struct {
     bl_conf_t bl_conf;
@@ -122,6 +164,9 @@ typedef struct {
     dpms_conf_t dpms_conf;
     screen_conf_t screen_conf;
     inh_conf_t inh_conf;
+    budget_conf_t budget_conf;
+    metrics_conf_t metrics_conf;
+    lag_conf_t lag_conf;
     int verbose;                            // whether verbose mode is enabled
     int wizard;                             // whether wizard mode is enabled
     int resumedelay;                        // delay on resume from suspend
@@ -7,12 +7,16 @@ static void load_backlight_settings(config_t *cfg, bl_conf_t *bl_conf);
 static void load_sensor_settings(config_t *cfg, sensor_conf_t *sens_conf);
 static void load_override_settings(config_t *cfg, sensor_conf_t *sens_conf);
 static void load_kbd_settings(config_t *cfg, kbd_conf_t *kbd_conf);
+static void load_gamma_outputs(config_setting_t *outputs, gamma_conf_t *gamma_conf);
 static void load_gamma_settings(config_t *cfg, gamma_conf_t *gamma_conf);
 static void load_day_settings(config_t *cfg, daytime_conf_t *day_conf);
 static void load_dimmer_settings(config_t *cfg, dimmer_conf_t *dim_conf);
 static void load_dpms_settings(config_t *cfg, dpms_conf_t *dpms_conf);
 static void load_screen_settings(config_t *cfg, screen_conf_t *screen_conf);
 static void load_inh_settings(config_t *cfg, inh_conf_t *inh_conf);
+static void load_budget_settings(config_t *cfg, budget_conf_t *budget_conf);
+static void load_metrics_settings(config_t *cfg, metrics_conf_t *metrics_conf);
+static void load_lag_settings(config_t *cfg, lag_conf_t *lag_conf);
 
 static void store_backlight_settings(config_t *cfg, bl_conf_t *bl_conf);
 static void store_sensors_settings(config_t *cfg, sensor_conf_t *sens_conf);
@@ -24,6 +28,9 @@ static void store_dimmer_settings(config_t *cfg, dimmer_conf_t *dim_conf);
 static void store_dpms_settings(config_t *cfg, dpms_conf_t *dpms_conf);
 static void store_screen_settings(config_t *cfg, screen_conf_t *screen_conf);
 static void store_inh_settings(config_t *cfg, inh_conf_t *inh_conf);
+static void store_budget_settings(config_t *cfg, budget_conf_t *budget_conf);
+static void store_metrics_settings(config_t *cfg, metrics_conf_t *metrics_conf);
+static void store_lag_settings(config_t *cfg, lag_conf_t *lag_conf);
 
 static void load_backlight_settings(config_t *cfg, bl_conf_t *bl_conf) {
     config_setting_t *bl = config_lookup(cfg, "backlight");
@@ -63,6 +70,16 @@ static void load_backlight_settings(config_t *cfg, bl_conf_t *bl_conf) {
                 WARN("Wrong number of backlight 'batt_timeouts' array elements.\n");
             }
         }
+        
+        if ((timeouts = config_setting_get_member(bl, "timer_slack"))) {
+            if (config_setting_length(timeouts) == SIZE_AC) {
+                for (int i = 0; i < SIZE_AC; i++) {
+                    bl_conf->timer_slack[i] = config_setting_get_int_elem(timeouts, i);
+                }
+            } else {
+                WARN("Wrong number of backlight 'timer_slack' array elements.\n");
+            }
+        }
     }
 }
 
@@ -224,6 +241,39 @@ static void load_kbd_settings(config_t *cfg, kbd_conf_t *kbd_conf) {
     }
 }
 
+static void load_gamma_outputs(config_setting_t *outputs, gamma_conf_t *gamma_conf) {
+    if (outputs) {
+        /* Outputs from a later config file replace previous ones */
+        for (int i = 0; i < gamma_conf->num_outputs; i++) {
+            free(gamma_conf->outputs[i].display);
+            free(gamma_conf->outputs[i].env);
+        }
+        memset(gamma_conf->outputs, 0, sizeof(gamma_conf->outputs));
+        gamma_conf->num_outputs = 0;
+        
+        int count = config_setting_length(outputs);
+        if (count > MAX_GAMMA_OUTPUTS) {
+            WARN("Too many gamma 'outputs'; only first %d will be used.\n", MAX_GAMMA_OUTPUTS);
+            count = MAX_GAMMA_OUTPUTS;
+        }
+        for (int i = 0; i < count; i++) {
+            config_setting_t *setting = config_setting_get_elem(outputs, i);
+            
+            const char *display = NULL, *env = NULL;
+            if (config_setting_lookup_string(setting, "display", &display) == CONFIG_TRUE && !is_string_empty(display)) {
+                gamma_output_t *o = &gamma_conf->outputs[gamma_conf->num_outputs++];
+                o->display = strdup(display);
+                if (config_setting_lookup_string(setting, "env", &env) == CONFIG_TRUE && !is_string_empty(env)) {
+                    o->env = strdup(env);
+                }
+                config_setting_lookup_int(setting, "offset", &o->offset);
+            } else {
+                WARN("Missing gamma output 'display'.\n");
+            }
+        }
+    }
+}
+
 static void load_gamma_settings(config_t *cfg, gamma_conf_t *gamma_conf) {
     config_setting_t *gamma = config_lookup(cfg, "gamma");
     if (gamma) {        
@@ -234,6 +284,10 @@ static void load_gamma_settings(config_t *cfg, gamma_conf_t *gamma_conf) {
         config_setting_lookup_int(gamma, "trans_timeout", &gamma_conf->trans_timeout);
         config_setting_lookup_bool(gamma, "long_transition", &gamma_conf->long_transition);
         config_setting_lookup_bool(gamma, "ambient_gamma", &gamma_conf->ambient_gamma);
+        config_setting_lookup_int(gamma, "ambient_deadband", &gamma_conf->ambient_deadband);
+        config_setting_lookup_int(gamma, "ambient_interval", &gamma_conf->ambient_interval);
+        config_setting_lookup_bool(gamma, "solar_transition", &gamma_conf->solar_transition);
+        config_setting_lookup_int(gamma, "solar_step", &gamma_conf->solar_step);
         
         if ((gamma = config_setting_get_member(gamma, "temp"))) {
             if (config_setting_length(gamma) == SIZE_STATES) {
@@ -244,6 +298,8 @@ static void load_gamma_settings(config_t *cfg, gamma_conf_t *gamma_conf) {
                 WARN("Wrong number of gamma 'temp' array elements.\n");
             }
         }
+        
+        load_gamma_outputs(config_lookup(cfg, "gamma.outputs"), gamma_conf);
     }
 }
 
@@ -264,6 +320,17 @@ static void load_day_settings(config_t *cfg, daytime_conf_t *day_conf) {
         if (config_setting_lookup_string(daytime, "sunset", &sunset) == CONFIG_TRUE) {
             strncpy(day_conf->day_events[SUNSET], sunset, sizeof(day_conf->day_events[SUNSET]) - 1);
         }
+        
+        config_setting_t *slack;
+        if ((slack = config_setting_get_member(daytime, "timer_slack"))) {
+            if (config_setting_length(slack) == SIZE_AC) {
+                for (int i = 0; i < SIZE_AC; i++) {
+                    day_conf->timer_slack[i] = config_setting_get_int_elem(slack, i);
+                }
+            } else {
+                WARN("Wrong number of daytime 'timer_slack' array elements.\n");
+            }
+        }
     }
 }
 
@@ -366,6 +433,15 @@ static void load_screen_settings(config_t *cfg, screen_conf_t *screen_conf) {
                 WARN("Wrong number of screen 'timeouts' array elements.\n");
             }
         }
+        if ((timeouts = config_setting_get_member(screen, "timer_slack"))) {
+            if (config_setting_length(timeouts) == SIZE_AC) {
+                for (int i = 0; i < SIZE_AC; i++) {
+                    screen_conf->timer_slack[i] = config_setting_get_int_elem(timeouts, i);
+                }
+            } else {
+                WARN("Wrong number of screen 'timer_slack' array elements.\n");
+            }
+        }
     }
 }
 
@@ -399,7 +475,66 @@ void init_config_file(enum CONFIG file, char *filename) {
     }
 }
 
-int read_config(enum CONFIG file, char *config_file) {
+static void load_budget_settings(config_t *cfg, budget_conf_t *budget_conf) {
+    config_setting_t *budget = config_lookup(cfg, "budget");
+    if (budget) {
+        config_setting_lookup_int(budget, "default", &budget_conf->budget);
+        config_setting_lookup_int(budget, "throttle", &budget_conf->throttle);
+        
+        config_setting_t *modules = config_setting_get_member(budget, "modules");
+        if (modules) {
+            /* Modules from a later config file replace previous ones */
+            for (int i = 0; i < budget_conf->num_modules; i++) {
+                free(budget_conf->modules[i].name);
+            }
+            memset(budget_conf->modules, 0, sizeof(budget_conf->modules));
+            budget_conf->num_modules = 0;
+            
+            int count = config_setting_length(modules);
+            if (count > MAX_MODULE_BUDGETS) {
+                WARN("Too many budget 'modules'; only first %d will be used.\n", MAX_MODULE_BUDGETS);
+                count = MAX_MODULE_BUDGETS;
+            }
+            for (int i = 0; i < count; i++) {
+                config_setting_t *setting = config_setting_get_elem(modules, i);
+                
+                const char *name = NULL;
+                int ms;
+                if (config_setting_lookup_string(setting, "name", &name) == CONFIG_TRUE && !is_string_empty(name)
+                    && config_setting_lookup_int(setting, "budget", &ms) == CONFIG_TRUE) {
+                    
+                    module_budget_t *m = &budget_conf->modules[budget_conf->num_modules++];
+                    m->name = strdup(name);
+                    m->budget = ms;
+                } else {
+                    WARN("Missing budget module 'name' or 'budget'.\n");
+                }
+            }
+        }
+    }
+}
+
+static void load_metrics_settings(config_t *cfg, metrics_conf_t *metrics_conf) {
+    config_setting_t *metrics = config_lookup(cfg, "metrics");
+    if (metrics) {
+        const char *file = NULL;
+        if (config_setting_lookup_string(metrics, "file", &file) == CONFIG_TRUE) {
+            strncpy(metrics_conf->file, file, sizeof(metrics_conf->file) - 1);
+        }
+        config_setting_lookup_int(metrics, "interval", &metrics_conf->interval);
+    }
+}
+
+static void load_lag_settings(config_t *cfg, lag_conf_t *lag_conf) {
+    config_setting_t *lag = config_lookup(cfg, "lag_probe");
+    if (lag) {
+        config_setting_lookup_int(lag, "interval", &lag_conf->interval);
+        config_setting_lookup_int(lag, "threshold", &lag_conf->threshold);
+    }
+}
+
+int read_config(enum CONFIG file, char *config_file, conf_t *c) {
+    PROFILE_SPAN("read_config(%s)", config_file);
     int r = 0;
     config_t cfg;
     
@@ -420,19 +555,22 @@ int read_config(enum CONFIG file, char *config_file) {
     config_set_include_dir(&cfg, dirname(config_file_dup));
     free(config_file_dup);
     if (config_read_file(&cfg, config_file) == CONFIG_TRUE) {
-        config_lookup_bool(&cfg, "verbose", &conf.verbose);
-        config_lookup_int(&cfg, "resumedelay", &conf.resumedelay);
+        config_lookup_bool(&cfg, "verbose", &c->verbose);
+        config_lookup_int(&cfg, "resumedelay", &c->resumedelay);
         
-        load_backlight_settings(&cfg, &conf.bl_conf);
-        load_sensor_settings(&cfg, &conf.sens_conf);
-        load_override_settings(&cfg, &conf.sens_conf);
-        load_kbd_settings(&cfg, &conf.kbd_conf);
-        load_gamma_settings(&cfg, &conf.gamma_conf);
-        load_day_settings(&cfg, &conf.day_conf);
-        load_dimmer_settings(&cfg, &conf.dim_conf);
-        load_dpms_settings(&cfg, &conf.dpms_conf);
-        load_screen_settings(&cfg, &conf.screen_conf);
-        load_inh_settings(&cfg, &conf.inh_conf);
+        load_backlight_settings(&cfg, &c->bl_conf);
+        load_sensor_settings(&cfg, &c->sens_conf);
+        load_override_settings(&cfg, &c->sens_conf);
+        load_kbd_settings(&cfg, &c->kbd_conf);
+        load_gamma_settings(&cfg, &c->gamma_conf);
+        load_day_settings(&cfg, &c->day_conf);
+        load_dimmer_settings(&cfg, &c->dim_conf);
+        load_dpms_settings(&cfg, &c->dpms_conf);
+        load_screen_settings(&cfg, &c->screen_conf);
+        load_inh_settings(&cfg, &c->inh_conf);
+        load_budget_settings(&cfg, &c->budget_conf);
+        load_metrics_settings(&cfg, &c->metrics_conf);
+        load_lag_settings(&cfg, &c->lag_conf);
     } else {
         WARN("Config file: %s at line %d.\n",
              config_error_text(&cfg),
@@ -488,6 +626,11 @@ static void store_backlight_settings(config_t *cfg, bl_conf_t *bl_conf) {
     for (int i = 0; i < SIZE_STATES + 1; i++) {
         config_setting_set_int_elem(setting, -1, bl_conf->timeout[ON_BATTERY][i]);
     }
+    
+    setting = config_setting_add(bl, "timer_slack", CONFIG_TYPE_ARRAY);
+    for (int i = 0; i < SIZE_AC; i++) {
+        config_setting_set_int_elem(setting, -1, bl_conf->timer_slack[i]);
+    }
 }
 
 static void store_sensors_settings(config_t *cfg, sensor_conf_t *sens_conf) {
@@ -590,10 +733,41 @@ static void store_gamma_settings(config_t *cfg, gamma_conf_t *gamma_conf) {
     setting = config_setting_add(gamma, "ambient_gamma", CONFIG_TYPE_BOOL);
     config_setting_set_bool(setting, gamma_conf->ambient_gamma);
     
+    setting = config_setting_add(gamma, "ambient_deadband", CONFIG_TYPE_INT);
+    config_setting_set_int(setting, gamma_conf->ambient_deadband);
+    
+    setting = config_setting_add(gamma, "ambient_interval", CONFIG_TYPE_INT);
+    config_setting_set_int(setting, gamma_conf->ambient_interval);
+    
+    setting = config_setting_add(gamma, "solar_transition", CONFIG_TYPE_BOOL);
+    config_setting_set_bool(setting, gamma_conf->solar_transition);
+    
+    setting = config_setting_add(gamma, "solar_step", CONFIG_TYPE_INT);
+    config_setting_set_int(setting, gamma_conf->solar_step);
+    
     setting = config_setting_add(gamma, "temp", CONFIG_TYPE_ARRAY);
     for (int i = 0; i < SIZE_STATES; i++) {
         config_setting_set_int_elem(setting, -1, gamma_conf->temp[i]);
     }
+    
+    if (gamma_conf->num_outputs > 0) {
+        config_setting_t *outputs = config_setting_add(gamma, "outputs", CONFIG_TYPE_LIST);
+        for (int i = 0; i < gamma_conf->num_outputs; i++) {
+            const gamma_output_t *o = &gamma_conf->outputs[i];
+            config_setting_t *output = config_setting_add(outputs, NULL, CONFIG_TYPE_GROUP);
+            
+            setting = config_setting_add(output, "display", CONFIG_TYPE_STRING);
+            config_setting_set_string(setting, o->display);
+            
+            if (o->env) {
+                setting = config_setting_add(output, "env", CONFIG_TYPE_STRING);
+                config_setting_set_string(setting, o->env);
+            }
+            
+            setting = config_setting_add(output, "offset", CONFIG_TYPE_INT);
+            config_setting_set_int(setting, o->offset);
+        }
+    }
 }
 
 static void store_daytime_settings(config_t *cfg, daytime_conf_t *day_conf) {
@@ -621,6 +795,11 @@ static void store_daytime_settings(config_t *cfg, daytime_conf_t *day_conf) {
     
     setting = config_setting_add(daytime, "sunset", CONFIG_TYPE_STRING);
     config_setting_set_string(setting, day_conf->day_events[SUNSET]);
+    
+    setting = config_setting_add(daytime, "timer_slack", CONFIG_TYPE_ARRAY);
+    for (int i = 0; i < SIZE_AC; i++) {
+        config_setting_set_int_elem(setting, -1, day_conf->timer_slack[i]);
+    }
 }
 
 static void store_dimmer_settings(config_t *cfg, dimmer_conf_t *dim_conf) {
@@ -683,6 +862,11 @@ static void store_screen_settings(config_t *cfg, screen_conf_t *screen_conf) {
     for (int i = 0; i < SIZE_AC; i++) {
         config_setting_set_int_elem(setting, -1, screen_conf->timeout[i]);
     }
+    
+    setting = config_setting_add(screen, "timer_slack", CONFIG_TYPE_ARRAY);
+    for (int i = 0; i < SIZE_AC; i++) {
+        config_setting_set_int_elem(setting, -1, screen_conf->timer_slack[i]);
+    }
 }
 
 static void store_inh_settings(config_t *cfg, inh_conf_t *inh_conf) {
@@ -701,15 +885,50 @@ static void store_inh_settings(config_t *cfg, inh_conf_t *inh_conf) {
     config_setting_set_bool(setting, inh_conf->inhibit_bl);
 }
 
-int store_config(enum CONFIG file) {
-    int r = 0;
-    config_t cfg;
-    char config_file[PATH_MAX + 1] = {0};
-
-    init_config_file(file, config_file);
-    if (access(config_file, F_OK) != -1) {
-        WARN("Config file %s already present. Overwriting.\n", config_file);
+static void store_budget_settings(config_t *cfg, budget_conf_t *budget_conf) {
+    config_setting_t *budget = config_setting_add(cfg->root, "budget", CONFIG_TYPE_GROUP);
+    
+    config_setting_t *setting = config_setting_add(budget, "default", CONFIG_TYPE_INT);
+    config_setting_set_int(setting, budget_conf->budget);
+    
+    setting = config_setting_add(budget, "throttle", CONFIG_TYPE_INT);
+    config_setting_set_int(setting, budget_conf->throttle);
+    
+    if (budget_conf->num_modules > 0) {
+        config_setting_t *modules = config_setting_add(budget, "modules", CONFIG_TYPE_LIST);
+        for (int i = 0; i < budget_conf->num_modules; i++) {
+            config_setting_t *m = config_setting_add(modules, NULL, CONFIG_TYPE_GROUP);
+            setting = config_setting_add(m, "name", CONFIG_TYPE_STRING);
+            config_setting_set_string(setting, budget_conf->modules[i].name);
+            setting = config_setting_add(m, "budget", CONFIG_TYPE_INT);
+            config_setting_set_int(setting, budget_conf->modules[i].budget);
+        }
     }
+}
+
+static void store_metrics_settings(config_t *cfg, metrics_conf_t *metrics_conf) {
+    config_setting_t *metrics = config_setting_add(cfg->root, "metrics", CONFIG_TYPE_GROUP);
+    
+    config_setting_t *setting = config_setting_add(metrics, "file", CONFIG_TYPE_STRING);
+    config_setting_set_string(setting, metrics_conf->file);
+    
+    setting = config_setting_add(metrics, "interval", CONFIG_TYPE_INT);
+    config_setting_set_int(setting, metrics_conf->interval);
+}
+
+static void store_lag_settings(config_t *cfg, lag_conf_t *lag_conf) {
+    config_setting_t *lag = config_setting_add(cfg->root, "lag_probe", CONFIG_TYPE_GROUP);
+    
+    config_setting_t *setting = config_setting_add(lag, "interval", CONFIG_TYPE_INT);
+    config_setting_set_int(setting, lag_conf->interval);
+    
+    setting = config_setting_add(lag, "threshold", CONFIG_TYPE_INT);
+    config_setting_set_int(setting, lag_conf->threshold);
+}
+
+/* Serialize current conf as config file content, into a buffer to be freed by caller */
+char *serialize_config(size_t *size) {
+    config_t cfg;
     config_init(&cfg);
     
     config_setting_t *setting = config_setting_add(cfg.root, "verbose", CONFIG_TYPE_BOOL);
@@ -727,13 +946,55 @@ int store_config(enum CONFIG file) {
     store_dpms_settings(&cfg, &conf.dpms_conf);
     store_screen_settings(&cfg, &conf.screen_conf);
     store_inh_settings(&cfg, &conf.inh_conf);
+    store_budget_settings(&cfg, &conf.budget_conf);
+    store_metrics_settings(&cfg, &conf.metrics_conf);
+    store_lag_settings(&cfg, &conf.lag_conf);
     
-    if (config_write_file(&cfg, config_file) != CONFIG_TRUE) {
-        WARN("Failed to write new config to file.\n");
-        r = -1;
-    } else {
-        INFO("New configuration successfully written to: %s\n", config_file);
+    char *buf = NULL;
+    FILE *f = open_memstream(&buf, size);
+    if (f) {
+        config_write(&cfg, f);
+        fclose(f);
     }
     config_destroy(&cfg);
-    return r;
+    return buf;
+}
+
+static char *dup_str(const char *str) {
+    return str ? strdup(str) : NULL;
+}
+
+/* Deep copy src conf into dst, that must later be freed through free_conf() */
+void dup_conf(conf_t *dst, const conf_t *src) {
+    memcpy(dst, src, sizeof(conf_t));
+    dst->sens_conf.dev_name = dup_str(src->sens_conf.dev_name);
+    dst->sens_conf.dev_opts = dup_str(src->sens_conf.dev_opts);
+    dst->sens_conf.specific_curves = map_new(true, free);
+    for (map_itr_t *itr = map_itr_new(src->sens_conf.specific_curves); itr; itr = map_itr_next(itr)) {
+        curve_t *c = malloc(SIZE_AC * sizeof(curve_t));
+        memcpy(c, map_itr_get_data(itr), SIZE_AC * sizeof(curve_t));
+        map_put(dst->sens_conf.specific_curves, map_itr_get_key(itr), c);
+    }
+    for (int i = 0; i < src->gamma_conf.num_outputs; i++) {
+        dst->gamma_conf.outputs[i].display = dup_str(src->gamma_conf.outputs[i].display);
+        dst->gamma_conf.outputs[i].env = dup_str(src->gamma_conf.outputs[i].env);
+    }
+    for (int i = 0; i < src->budget_conf.num_modules; i++) {
+        dst->budget_conf.modules[i].name = dup_str(src->budget_conf.modules[i].name);
+    }
+}
+
+/* Free any heap allocated conf member; only to be used on confs other than global one */
+void free_conf(conf_t *c) {
+    free(c->sens_conf.dev_name);
+    free(c->sens_conf.dev_opts);
+    map_free(c->sens_conf.specific_curves);
+    for (int i = 0; i < c->gamma_conf.num_outputs; i++) {
+        free(c->gamma_conf.outputs[i].display);
+        free(c->gamma_conf.outputs[i].env);
+    }
+    for (int i = 0; i < c->budget_conf.num_modules; i++) {
+        free(c->budget_conf.modules[i].name);
+    }
+    memset(c, 0, sizeof(conf_t));
 }
@@ -4,6 +4,16 @@
 
 enum CONFIG { OLD_GLOBAL, GLOBAL, LOCAL, CUSTOM };
 
+/* Called once config file was written, with 0 or the errno of the failed write */
+typedef void (*store_cb)(int error, void *userdata);
+
 void init_config_file(enum CONFIG file, char *filename);
-int read_config(enum CONFIG file, char *config_file);
-int store_config(enum CONFIG file);
+int read_config(enum CONFIG file, char *config_file, conf_t *c);
+char *serialize_config(size_t *size);
+int store_config(enum CONFIG file, store_cb cb, void *userdata);
+int load_conf_snapshot(void);
+void store_conf_snapshot(void);
+void dup_conf(conf_t *dst, const conf_t *src);
+void free_conf(conf_t *c);
+int reload_config(void);
+int apply_conf(const conf_t *new, const char **invalid);
@@ -11,6 +11,10 @@ static void init_daytime_opts(daytime_conf_t *day_conf);
 static void init_dimmer_opts(dimmer_conf_t *dim_conf);
 static void init_dpms_opts(dpms_conf_t *dpms_conf);
 static void init_screen_opts(screen_conf_t *screen_conf);
+static void init_budget_opts(budget_conf_t *budget_conf);
+static void init_metrics_opts(metrics_conf_t *metrics_conf);
+static void init_lag_opts(lag_conf_t *lag_conf);
+static void init_default_opts(conf_t *c);
 static void parse_cmd(int argc, char *const argv[], char *conf_file, size_t size);
 static int parse_bus_reply(sd_bus_message *reply, const char *member, void *userdata);
 static void check_clightd_features(void);
@@ -24,8 +28,14 @@ static void check_dim_conf(dimmer_conf_t *dim_conf);
 static void check_dpms_conf(dpms_conf_t *dpms_conf);
 static void check_screen_conf(screen_conf_t *screen_conf);
 static void check_inh_conf(inh_conf_t *inh_conf);
+static void check_budget_conf(budget_conf_t *budget_conf);
+static void check_metrics_conf(metrics_conf_t *metrics_conf);
+static void check_lag_conf(lag_conf_t *lag_conf);
 static void check_conf(void);
 
+static conf_t file_conf;                     // conf as read from config files only, ie: without cmdline options; used to diff reloads
+static char custom_conf_file[PATH_MAX + 1];  // --conf-file option, if any
+
 static double *bl_default_curve[SIZE_AC] = { 
     (double[]){ 0.0, 0.15, 0.29, 0.45, 0.61, 0.74, 0.81, 0.88, 0.93, 0.97, 1.0 },
     (double[]){ 0.0, 0.15, 0.23, 0.36, 0.52, 0.59, 0.65, 0.71, 0.75, 0.78, 0.80 },
@@ -40,11 +50,13 @@ static void init_backlight_opts(bl_conf_t *bl_conf) {
     bl_conf->timeout[ON_AC][DAY] = 10 * 60;
     bl_conf->timeout[ON_AC][NIGHT] = 45 * 60;
     bl_conf->timeout[ON_AC][IN_EVENT] = 5 * 60;
-    bl_conf->timeout[ON_BATTERY][DAY] = 2 * conf.bl_conf.timeout[ON_AC][DAY];
-    bl_conf->timeout[ON_BATTERY][NIGHT] = 2 * conf.bl_conf.timeout[ON_AC][NIGHT];
-    bl_conf->timeout[ON_BATTERY][IN_EVENT] = 2 * conf.bl_conf.timeout[ON_AC][IN_EVENT];
+    bl_conf->timeout[ON_BATTERY][DAY] = 2 * bl_conf->timeout[ON_AC][DAY];
+    bl_conf->timeout[ON_BATTERY][NIGHT] = 2 * bl_conf->timeout[ON_AC][NIGHT];
+    bl_conf->timeout[ON_BATTERY][IN_EVENT] = 2 * bl_conf->timeout[ON_AC][IN_EVENT];
     bl_conf->smooth.trans_step = 0.05;
     bl_conf->smooth.trans_timeout = 30;
+    bl_conf->timer_slack[ON_AC] = 2;
+    bl_conf->timer_slack[ON_BATTERY] = 30;
 }
 
 static void init_sens_opts(sensor_conf_t *sens_conf) {
@@ -99,12 +111,16 @@ static void init_gamma_opts(gamma_conf_t *gamma_conf) {
     gamma_conf->temp[NIGHT] = 4000;
     gamma_conf->trans_step = 50;
     gamma_conf->trans_timeout = 300;
+    gamma_conf->solar_step = 100;
+    gamma_conf->ambient_deadband = 100;
+    gamma_conf->ambient_interval = 5;
 }
 
 static void init_daytime_opts(daytime_conf_t *day_conf) {
     day_conf->event_duration = 30 * 60;
     day_conf->loc.lat = LAT_UNDEFINED;
     day_conf->loc.lon = LON_UNDEFINED;
+    day_conf->timer_slack[ON_BATTERY] = 60;
 }
 
 static void init_dimmer_opts(dimmer_conf_t *dim_conf) {
@@ -126,6 +142,37 @@ static void init_screen_opts(screen_conf_t *screen_conf) {
     screen_conf->contrib = 0.2;
     screen_conf->timeout[ON_AC] = 5;
     screen_conf->timeout[ON_BATTERY] = -1; // disabled on battery by default
+    screen_conf->timer_slack[ON_BATTERY] = 2;
+}
+
+static void init_budget_opts(budget_conf_t *budget_conf) {
+    budget_conf->budget = 50;
+    budget_conf->throttle = 5;
+}
+
+static void init_metrics_opts(metrics_conf_t *metrics_conf) {
+    metrics_conf->interval = 30;
+}
+
+static void init_lag_opts(lag_conf_t *lag_conf) {
+    lag_conf->interval = 10;
+    lag_conf->threshold = 250;
+}
+
+static void init_default_opts(conf_t *c) {
+    init_backlight_opts(&c->bl_conf);
+    init_sens_opts(&c->sens_conf);
+    init_override_opts(&c->sens_conf);
+    init_kbd_opts(&c->kbd_conf);
+    init_gamma_opts(&c->gamma_conf);
+    init_daytime_opts(&c->day_conf);
+    init_dimmer_opts(&c->dim_conf);
+    init_dpms_opts(&c->dpms_conf);
+    init_screen_opts(&c->screen_conf);
+    init_budget_opts(&c->budget_conf);
+    init_metrics_opts(&c->metrics_conf);
+    init_lag_opts(&c->lag_conf);
+    // init_inh_opts NOT NEEDED
 }
 
 /*
@@ -135,38 +182,73 @@ static void init_screen_opts(screen_conf_t *screen_conf) {
  * Finally, check configuration values and log it.
  */
 void init_opts(int argc, char *argv[]) {
-    init_backlight_opts(&conf.bl_conf);
-    init_sens_opts(&conf.sens_conf);
-    init_override_opts(&conf.sens_conf);
-    init_kbd_opts(&conf.kbd_conf);
-    init_gamma_opts(&conf.gamma_conf);
-    init_daytime_opts(&conf.day_conf);
-    init_dimmer_opts(&conf.dim_conf);
-    init_dpms_opts(&conf.dpms_conf);
-    init_screen_opts(&conf.screen_conf);
-    // init_inh_opts NOT NEEDED
+    PROFILE_FUNC();
+    init_default_opts(&conf);
 
     char conf_file[PATH_MAX + 1] = {0};
     
-    for (int i = OLD_GLOBAL; i < CUSTOM; i++) {
-        init_config_file(i, conf_file);
-        read_config(i, conf_file);
+    /* Only parse config files if any of them changed since last snapshot */
+    if (load_conf_snapshot() != 0) {
+        for (int i = OLD_GLOBAL; i < CUSTOM; i++) {
+            init_config_file(i, conf_file);
+            read_config(i, conf_file, &conf);
+        }
+        store_conf_snapshot();
     }
+    dup_conf(&file_conf, &conf);
     
-    conf_file[0] = 0;
-    parse_cmd(argc, argv, conf_file, PATH_MAX);
+    parse_cmd(argc, argv, custom_conf_file, PATH_MAX);
     /* --conf-file option was passed! */
-    if (!is_string_empty(conf_file)) {
-        read_config(CUSTOM, conf_file);
+    if (!is_string_empty(custom_conf_file)) {
+        read_config(CUSTOM, custom_conf_file, &conf);
+        read_config(CUSTOM, custom_conf_file, &file_conf);
     }
     
     check_conf();
 }
 
+/*
+ * Parse again any existing config file into c, starting from default values.
+ * Returns -1 if any of them could not be parsed, eg: while it is being written.
+ */
+int parse_conf_files(conf_t *c) {
+    init_default_opts(c);
+    
+    char conf_file[PATH_MAX + 1] = {0};
+    for (int i = OLD_GLOBAL; i <= CUSTOM; i++) {
+        get_conf_file(i, conf_file);
+        if (!is_string_empty(conf_file) && access(conf_file, F_OK) == 0 && read_config(i, conf_file, c) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Like init_config_file(), but CUSTOM is the --conf-file option, if any */
+void get_conf_file(enum CONFIG file, char *filename) {
+    if (file == CUSTOM) {
+        strncpy(filename, custom_conf_file, PATH_MAX);
+    } else {
+        init_config_file(file, filename);
+    }
+}
+
+/* Conf as read from config files during last (re)load */
+const conf_t *get_file_conf(void) {
+    return &file_conf;
+}
+
+/* Store newly reloaded conf from config files, taking ownership of it */
+void set_file_conf(conf_t *c) {
+    free_conf(&file_conf);
+    memcpy(&file_conf, c, sizeof(conf_t));
+}
+
 /*
  * Parse cmdline to get cmd line options
  */
 static void parse_cmd(int argc, char *const argv[], char *conf_file, size_t size) {
+    PROFILE_FUNC();
     poptContext pc;
     const struct poptOption po[] = {
         {"frames", 'f', POPT_ARG_INT, NULL, 5, "Frames taken for each capture, Between 1 and 20", NULL},
@@ -195,7 +277,9 @@ static void parse_cmd(int argc, char *const argv[], char *conf_file, size_t size
         {"conf-file", 'c', POPT_ARG_STRING, NULL, 4, "Specify a conf file to be parsed", NULL},
         {"gamma-long-transition", 0, POPT_ARG_NONE, &conf.gamma_conf.long_transition, 100, "Enable a very long smooth transition for gamma (redshift-like)", NULL },
         {"ambient-gamma", 0, POPT_ARG_NONE, &conf.gamma_conf.ambient_gamma, 100, "Enable screen temperature matching ambient brightness instead of time based.", NULL },
+        {"gamma-solar-transition", 0, POPT_ARG_NONE, &conf.gamma_conf.solar_transition, 100, "Enable screen temperature following sun elevation angle", NULL },
         {"wizard", 'w', POPT_ARG_NONE, &conf.wizard, 100, "Enable wizard mode.", NULL},
+        {"profile-startup", 0, POPT_ARG_STRING | POPT_ARGFLAG_OPTIONAL, NULL, 6, "Log where startup time goes, until first backlight change. If a path is given, write a json report there instead", "path"},
         POPT_AUTOHELP
         POPT_TABLEEND
     };
@@ -226,6 +310,9 @@ static void parse_cmd(int argc, char *const argv[], char *conf_file, size_t size
                 conf.sens_conf.num_captures[ON_AC] = atoi(str);
                 conf.sens_conf.num_captures[ON_BATTERY] = atoi(str);
                 break;
+            case 6:
+                profile_set_json(str);
+                break;
             default:
                 break;
         }
@@ -292,6 +379,13 @@ static void check_bl_conf(bl_conf_t *bl_conf) {
         bl_conf->smooth.trans_timeout = 30;
     }
     
+    for (int i = 0; i < SIZE_AC; i++) {
+        if (bl_conf->timer_slack[i] < 0) {
+            WARN("BL_CONF: wrong 'timer_slack' value. Disabling timer coalescing.\n");
+            bl_conf->timer_slack[i] = 0;
+        }
+    }
+    
     if (bl_conf->shutter_threshold < 0 || bl_conf->shutter_threshold >= 1) {
         WARN("BL_CONF: wrong 'shutter_threshold' value. Resetting default value.\n");
         bl_conf->shutter_threshold = 0.0;
@@ -375,6 +469,23 @@ static void check_gamma_conf(gamma_conf_t *gamma_conf) {
         WARN("GAMMA_CONF: wrong 'trans_timeout' value. Resetting default value.\n");
         gamma_conf->trans_timeout = 300;
     }
+    
+    if (gamma_conf->ambient_deadband < 0) {
+        WARN("GAMMA_CONF: wrong 'ambient_deadband' value. Resetting default value.\n");
+        gamma_conf->ambient_deadband = 100;
+    }
+    if (gamma_conf->ambient_interval < 0) {
+        WARN("GAMMA_CONF: wrong 'ambient_interval' value. Resetting default value.\n");
+        gamma_conf->ambient_interval = 5;
+    }
+    
+    if (gamma_conf->solar_step <= 0) {
+        WARN("GAMMA_CONF: wrong 'solar_step' value. Resetting default value.\n");
+        gamma_conf->solar_step = 100;
+    }
+    if (gamma_conf->solar_transition && gamma_conf->ambient_gamma) {
+        INFO("GAMMA_CONF: 'solar_transition' is not used while 'ambient_gamma' is enabled.\n");
+    }
 }
 
 static void check_daytime_conf(daytime_conf_t *day_conf) {
@@ -383,6 +494,13 @@ static void check_daytime_conf(daytime_conf_t *day_conf) {
         day_conf->event_duration = 30 * 60;
     }
     
+    for (int i = 0; i < SIZE_AC; i++) {
+        if (day_conf->timer_slack[i] < 0) {
+            WARN("DAYTIME_CONF: wrong 'timer_slack' value. Disabling timer coalescing.\n");
+            day_conf->timer_slack[i] = 0;
+        }
+    }
+    
     if (fabs(day_conf->loc.lat) > 90.0f && day_conf->loc.lat != LAT_UNDEFINED) {
         WARN("DAYTIME_CONF: wrong 'latitude' value. Resetting default value.\n");
         day_conf->loc.lat = LAT_UNDEFINED;
@@ -456,6 +574,13 @@ static void check_screen_conf(screen_conf_t *screen_conf) {
         WARN("SCREEN_CONF: wrong 'contrib' value. Resetting default value.\n");
         screen_conf->contrib = 0.2;
     }
+    
+    for (int i = 0; i < SIZE_AC; i++) {
+        if (screen_conf->timer_slack[i] < 0) {
+            WARN("SCREEN_CONF: wrong 'timer_slack' value. Disabling timer coalescing.\n");
+            screen_conf->timer_slack[i] = 0;
+        }
+    }
 }
 
 static void check_inh_conf(inh_conf_t *inh_conf) {
@@ -467,6 +592,43 @@ static void check_inh_conf(inh_conf_t *inh_conf) {
     }
 }
 
+static void check_budget_conf(budget_conf_t *budget_conf) {
+    if (budget_conf->budget < 0) {
+        WARN("BUDGET_CONF: wrong 'default' value. Resetting default value.\n");
+        budget_conf->budget = 50;
+    }
+    
+    if (budget_conf->throttle < 0) {
+        WARN("BUDGET_CONF: wrong 'throttle' value. Resetting default value.\n");
+        budget_conf->throttle = 5;
+    }
+    
+    for (int i = 0; i < budget_conf->num_modules; i++) {
+        if (budget_conf->modules[i].budget < 0) {
+            WARN("BUDGET_CONF: wrong '%s' budget value. Using default budget.\n", budget_conf->modules[i].name);
+            budget_conf->modules[i].budget = budget_conf->budget;
+        }
+    }
+}
+
+static void check_metrics_conf(metrics_conf_t *metrics_conf) {
+    if (metrics_conf->interval <= 0) {
+        WARN("METRICS_CONF: wrong 'interval' value. Resetting default value.\n");
+        metrics_conf->interval = 30;
+    }
+}
+
+static void check_lag_conf(lag_conf_t *lag_conf) {
+    if (lag_conf->interval < 0) {
+        WARN("LAG_CONF: wrong 'interval' value. Resetting default value.\n");
+        lag_conf->interval = 10;
+    }
+    if (lag_conf->threshold <= 0) {
+        WARN("LAG_CONF: wrong 'threshold' value. Resetting default value.\n");
+        lag_conf->threshold = 250;
+    }
+}
+
 /*
  * It does all needed checks to correctly reset default values
  * in case of wrong options set.
@@ -485,31 +647,39 @@ static void check_conf(void) {
         check_clightd_features();
     }
     
-    if (conf.resumedelay < 0 || conf.resumedelay > 30) {
+    check_conf_values(&conf);
+}
+
+/* Reset any wrong value in c to its default */
+void check_conf_values(conf_t *c) {
+    if (c->resumedelay < 0 || c->resumedelay > 30) {
         WARN("CONF: wrong 'resumedelay' value. Resetting default value.\n");
-        conf.resumedelay = 0;
+        c->resumedelay = 0;
     }
     
-    if (!conf.bl_conf.disabled) {
-        check_bl_conf(&conf.bl_conf);
-        check_sens_conf(&conf.sens_conf);
-        check_override_conf(&conf.sens_conf);
+    if (!c->bl_conf.disabled) {
+        check_bl_conf(&c->bl_conf);
+        check_sens_conf(&c->sens_conf);
+        check_override_conf(&c->sens_conf);
     }
-    if (!conf.kbd_conf.disabled) {
-        check_kbd_conf(&conf.kbd_conf);
+    if (!c->kbd_conf.disabled) {
+        check_kbd_conf(&c->kbd_conf);
     }
-    if (!conf.gamma_conf.disabled) {
-        check_gamma_conf(&conf.gamma_conf);
+    if (!c->gamma_conf.disabled) {
+        check_gamma_conf(&c->gamma_conf);
     }
-    check_daytime_conf(&conf.day_conf);
-    if (!conf.dim_conf.disabled) {
-        check_dim_conf(&conf.dim_conf);
+    check_daytime_conf(&c->day_conf);
+    if (!c->dim_conf.disabled) {
+        check_dim_conf(&c->dim_conf);
     }
-    if (!conf.dpms_conf.disabled) {
-        check_dpms_conf(&conf.dpms_conf);
+    if (!c->dpms_conf.disabled) {
+        check_dpms_conf(&c->dpms_conf);
     }
-    if (!conf.screen_conf.disabled) {
-        check_screen_conf(&conf.screen_conf);
+    if (!c->screen_conf.disabled) {
+        check_screen_conf(&c->screen_conf);
     }
-    check_inh_conf(&conf.inh_conf);
+    check_inh_conf(&c->inh_conf);
+    check_budget_conf(&c->budget_conf);
+    check_metrics_conf(&c->metrics_conf);
+    check_lag_conf(&c->lag_conf);
 }
@@ -4,4 +4,9 @@
 #include "bus.h"
 
 void init_opts(int argc, char *argv[]);
+void get_conf_file(enum CONFIG file, char *filename);
+int parse_conf_files(conf_t *c);
+const conf_t *get_file_conf(void);
+void set_file_conf(conf_t *c);
+void check_conf_values(conf_t *c);
 
@@ -0,0 +1,617 @@
+#include <sys/inotify.h>
+#include <unistd.h>
+#include "opts.h"
+#include "timer.h"
+#include "utils.h"
+
+/**
+ * RELOAD service applies config files changes without restarting Clight.
+ *
+ * Config files folders (and their modules.conf.d/) are watched through inotify;
+ * on any change (or on Conf.Reload bus method call), config files are parsed into a shadow conf,
+ * that is diffed field by field against conf as read from config files during last (re)load.
+ * Thus, a value set through cmdline or bus api is only overridden if its config file value changes.
+ *
+ * Changed values are applied through their _REQ messages (eg: BL_TO_REQ, CURVE_REQ, TEMP_REQ, CONTRIB_REQ),
+ * or, for values that modules only read when needed, stored straight into conf, like bus api does.
+ * Subsystems whose values did not change are not touched at all.
+ * Values only read at startup (eg: modules 'disabled' flags) need a restart to be applied.
+ * Folders that did not exist when Clight started are not watched.
+ *
+ * Same machinery backs apply_conf(), used by Conf.Apply bus method to apply a batch of values at once.
+ */
+
+#define RELOAD_DELAY_NS     (200 * 1000 * 1000)  // coalesce bursts of events, eg: an editor writing a temp file then renaming it
+#define MAX_WATCHES         (2 * (CUSTOM + 1)) // each config file folder and its modules.conf.d/
+
+#define FIELD(f)            { #f, offsetof(conf_t, f), sizeof(((conf_t *)0)->f) }
+#define FIELD_PTR(c, f)     ((uint8_t *)(c) + (f)->offset)
+#define CHANGED(f)          (old->f != new->f && conf.f != new->f)
+
+typedef struct {
+    int wd;
+    char name[NAME_MAX + 1];                // only account for this file in folder; empty for any file
+} watch_t;
+
+typedef struct {
+    const char *name;
+    size_t offset;                          // offset in conf_t
+    size_t size;
+} field_t;
+
+static void add_watches(const char *conf_file);
+static void add_watch(const char *folder, const char *name);
+static bool is_watched(const struct inotify_event *ev);
+static void on_reload_timer(UNUSED void *userdata);
+static int apply_fields(const conf_t *old, const conf_t *new);
+static int apply_string(char **live, const char *old, const char *new, const char *name);
+static bool curve_changed(const curve_t *old, const curve_t *new, const curve_t *live);
+static int apply_requests(const conf_t *old, const conf_t *new);
+static void check_restart_fields(const conf_t *old, const conf_t *new);
+static const char *check_values(const conf_t *new);
+static const char *validate_requests(const conf_t *new);
+static bool curves_equal(map_t *a, map_t *b);
+
+/* Values read by modules when needed; applied by just storing them into conf */
+static const field_t fields[] = {
+    FIELD(verbose),
+    FIELD(resumedelay),
+    FIELD(bl_conf.smooth.no_smooth),
+    FIELD(bl_conf.smooth.trans_step),
+    FIELD(bl_conf.smooth.trans_timeout),
+    FIELD(bl_conf.smooth.trans_fixed),
+    FIELD(bl_conf.shutter_threshold),
+    FIELD(bl_conf.pause_on_lid_closed),
+    FIELD(bl_conf.capture_on_lid_opened),
+    FIELD(bl_conf.restore),
+    FIELD(bl_conf.sync_monitors_delay),
+    FIELD(bl_conf.timer_slack),
+    FIELD(sens_conf.num_captures),
+    FIELD(gamma_conf.no_smooth),
+    FIELD(gamma_conf.trans_step),
+    FIELD(gamma_conf.trans_timeout),
+    FIELD(gamma_conf.long_transition),
+    FIELD(gamma_conf.ambient_deadband),
+    FIELD(gamma_conf.ambient_interval),
+    FIELD(gamma_conf.solar_step),
+    FIELD(gamma_conf.restore),
+    FIELD(day_conf.event_duration),
+    FIELD(day_conf.timer_slack),
+    FIELD(dim_conf.dimmed_pct),
+    FIELD(dim_conf.smooth[ENTER].no_smooth),
+    FIELD(dim_conf.smooth[ENTER].trans_step),
+    FIELD(dim_conf.smooth[ENTER].trans_timeout),
+    FIELD(dim_conf.smooth[ENTER].trans_fixed),
+    FIELD(dim_conf.smooth[EXIT].no_smooth),
+    FIELD(dim_conf.smooth[EXIT].trans_step),
+    FIELD(dim_conf.smooth[EXIT].trans_timeout),
+    FIELD(dim_conf.smooth[EXIT].trans_fixed),
+    FIELD(screen_conf.timer_slack),
+    FIELD(inh_conf.inhibit_docked),
+    FIELD(inh_conf.inhibit_pm),
+    FIELD(inh_conf.inhibit_bl),
+    FIELD(budget_conf.throttle),
+    FIELD(lag_conf.threshold),
+};
+
+/* Values applied through _REQ messages, by apply_requests() */
+static const field_t req_fields[] = {
+    FIELD(bl_conf.timeout),
+    FIELD(bl_conf.no_auto_calib),
+    FIELD(sens_conf.default_curve),
+    FIELD(kbd_conf.timeout),
+    FIELD(kbd_conf.curve),
+    FIELD(gamma_conf.temp),
+    FIELD(gamma_conf.ambient_gamma),
+    FIELD(day_conf.day_events),
+    FIELD(day_conf.events_os),
+    FIELD(day_conf.loc),
+    FIELD(dim_conf.timeout),
+    FIELD(dpms_conf.timeout),
+    FIELD(screen_conf.contrib),
+    FIELD(screen_conf.timeout),
+};
+
+/* Values only read at startup */
+static const field_t restart_fields[] = {
+    FIELD(bl_conf.disabled),
+    FIELD(kbd_conf.disabled),
+    FIELD(gamma_conf.disabled),
+    FIELD(gamma_conf.solar_transition),
+    FIELD(dim_conf.disabled),
+    FIELD(dpms_conf.disabled),
+    FIELD(screen_conf.disabled),
+    FIELD(inh_conf.disabled),
+    FIELD(budget_conf.budget),
+    FIELD(metrics_conf),
+    FIELD(lag_conf.interval),
+};
+
+/* Curves points must outlive CURVE_REQ/KBD_CURVE_REQ messages */
+static double bl_points[SIZE_AC][MAX_SIZE_POINTS];
+static double kbd_points[SIZE_AC][MAX_SIZE_POINTS];
+static watch_t watches[MAX_WATCHES];
+static int num_watches;
+static int inot_fd = -1;
+static int reload_timer = -1;
+
+MODULE("RELOAD");
+
+static void init(void) {
+    PROFILE_FUNC();
+    reload_timer = start_timer(0, 0);
+    register_timer(reload_timer, on_reload_timer, NULL);
+
+    inot_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inot_fd == -1) {
+        WARN("Failed to watch config files: %s\n", strerror(errno));
+        return;
+    }
+
+    char conf_file[PATH_MAX + 1] = {0};
+    for (int i = OLD_GLOBAL; i <= CUSTOM; i++) {
+        get_conf_file(i, conf_file);
+        if (!is_string_empty(conf_file)) {
+            add_watches(conf_file);
+        }
+    }
+    m_register_fd(inot_fd, true, NULL);
+}
+
+static bool check(void) {
+    return true;
+}
+
+static bool evaluate(void) {
+    return !conf.wizard;
+}
+
+static void destroy(void) {
+    if (reload_timer >= 0) {
+        stop_timer(reload_timer);
+    }
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    switch (MSG_TYPE()) {
+    case FD_UPD: {
+        char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+        bool changed = false;
+        ssize_t len;
+        while ((len = read(msg->fd_msg->fd, buf, sizeof(buf))) > 0) {
+            const struct inotify_event *ev;
+            for (char *ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + ev->len) {
+                ev = (const struct inotify_event *)ptr;
+                changed |= is_watched(ev);
+            }
+        }
+        if (changed) {
+            /* Postpone reload until events stop flowing in */
+            set_timeout(0, RELOAD_DELAY_NS, reload_timer, 0);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/*
+ * Parse config files into a shadow conf and apply any changed value.
+ * Returns number of applied values, or -1 if config files could not be parsed.
+ */
+int reload_config(void) {
+    conf_t shadow = {0};
+    if (parse_conf_files(&shadow) != 0) {
+        WARN("Failed to parse config files. Keeping current configuration.\n");
+        free_conf(&shadow);
+        return -1;
+    }
+
+    const conf_t *old = get_file_conf();
+    int changes = apply_fields(old, &shadow);
+    changes += apply_requests(old, &shadow);
+    check_restart_fields(old, &shadow);
+    set_file_conf(&shadow);
+
+    if (changes > 0) {
+        INFO("Configuration reloaded: %d values changed.\n", changes);
+    } else {
+        DEBUG("Configuration reloaded: nothing changed.\n");
+    }
+    return changes;
+}
+
+/*
+ * Apply every value of new that differs from conf, as a single transaction:
+ * all changed values are validated first, and nothing is applied if any of them is wrong.
+ * Each changed value is applied once (eg: a single CURVE_REQ, thus a single curve fit, per curve).
+ * Returns number of applied values, or -1 storing the name of the wrong value in invalid.
+ */
+int apply_conf(const conf_t *new, const char **invalid) {
+    *invalid = check_values(new);
+    if (!*invalid) {
+        *invalid = validate_requests(new);
+    }
+    if (*invalid) {
+        return -1;
+    }
+
+    int changes = apply_fields(&conf, new);
+    changes += apply_requests(&conf, new);
+    return changes;
+}
+
+static void add_watches(const char *conf_file) {
+    char folder[PATH_MAX + 1];
+    strncpy(folder, conf_file, PATH_MAX);
+    folder[PATH_MAX] = '\0';
+
+    char *name = strrchr(folder, '/');
+    if (!name) {
+        return;
+    }
+    *name++ = '\0';
+    add_watch(is_string_empty(folder) ? "/" : folder, name);
+
+    char modules_folder[PATH_MAX + 1];
+    snprintf(modules_folder, sizeof(modules_folder), "%s/modules.conf.d", folder);
+    add_watch(modules_folder, NULL);
+}
+
+static void add_watch(const char *folder, const char *name) {
+    if (num_watches == MAX_WATCHES) {
+        return;
+    }
+
+    const int wd = inotify_add_watch(inot_fd, folder, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE);
+    if (wd >= 0) {
+        watch_t *w = &watches[num_watches++];
+        w->wd = wd;
+        if (name) {
+            strncpy(w->name, name, NAME_MAX);
+        }
+        DEBUG("Watching '%s/%s' for config changes.\n", folder, name ? name : "*");
+    }
+}
+
+static bool is_watched(const struct inotify_event *ev) {
+    if (ev->mask & IN_Q_OVERFLOW) {
+        /* Events were lost; reload anyway */
+        return true;
+    }
+
+    for (int i = 0; i < num_watches; i++) {
+        const watch_t *w = &watches[i];
+        /* Same folder can be watched multiple times (eg: a config file and modules.conf.d/ for custom config file) */
+        if (w->wd == ev->wd &&
+            (is_string_empty(w->name) || (ev->len > 0 && !strcmp(w->name, ev->name)))) {
+
+            return true;
+        }
+    }
+    return false;
+}
+
+static void on_reload_timer(UNUSED void *userdata) {
+    DEBUG("Config files changed. Reloading.\n");
+    reload_config();
+}
+
+static int apply_fields(const conf_t *old, const conf_t *new) {
+    const int num_fields = sizeof(fields) / sizeof(*fields);
+    bool changed[num_fields];
+    bool any = false;
+
+    /* Check new values on a copy of conf, as they would be checked at startup */
+    conf_t checked;
+    memcpy(&checked, &conf, sizeof(conf_t));
+    for (int i = 0; i < num_fields; i++) {
+        const field_t *f = &fields[i];
+        changed[i] = memcmp(FIELD_PTR(old, f), FIELD_PTR(new, f), f->size) != 0;
+        if (changed[i]) {
+            memcpy(FIELD_PTR(&checked, f), FIELD_PTR(new, f), f->size);
+            any = true;
+        }
+    }
+    if (any) {
+        check_conf_values(&checked);
+    }
+
+    int changes = 0;
+    for (int i = 0; i < num_fields; i++) {
+        const field_t *f = &fields[i];
+        if (changed[i] && memcmp(FIELD_PTR(&conf, f), FIELD_PTR(&checked, f), f->size) != 0) {
+            memcpy(FIELD_PTR(&conf, f), FIELD_PTR(&checked, f), f->size);
+            DEBUG("'%s' applied.\n", f->name);
+            changes++;
+        }
+    }
+
+    changes += apply_string(&conf.sens_conf.dev_name, old->sens_conf.dev_name, new->sens_conf.dev_name, "sens_conf.dev_name");
+    changes += apply_string(&conf.sens_conf.dev_opts, old->sens_conf.dev_opts, new->sens_conf.dev_opts, "sens_conf.dev_opts");
+    return changes;
+}
+
+static inline bool str_equal(const char *a, const char *b) {
+    return (!a || !b) ? a == b : !strcmp(a, b);
+}
+
+static int apply_string(char **live, const char *old, const char *new, const char *name) {
+    if (!str_equal(old, new) && !str_equal(*live, new)) {
+        free(*live);
+        *live = new ? strdup(new) : NULL;
+        DEBUG("'%s' applied.\n", name);
+        return 1;
+    }
+    return 0;
+}
+
+static bool curve_changed(const curve_t *old, const curve_t *new, const curve_t *live) {
+    const size_t size = new->num_points * sizeof(double);
+    return (old->num_points != new->num_points || memcmp(old->points, new->points, size) != 0) &&
+           (live->num_points != new->num_points || memcmp(live->points, new->points, size) != 0);
+}
+
+/* Apply changed values that need modules to react, through their _REQ messages */
+static int apply_requests(const conf_t *old, const conf_t *new) {
+    int changes = 0;
+
+    for (int i = ON_AC; i < SIZE_AC; i++) {
+        for (int j = DAY; j < SIZE_STATES + 1; j++) {
+            if (CHANGED(bl_conf.timeout[i][j])) {
+                DECLARE_HEAP_MSG(req, BL_TO_REQ);
+                req->to.state = i;
+                req->to.daytime = j;
+                req->to.new = new->bl_conf.timeout[i][j];
+                M_PUB(req);
+                changes++;
+            }
+        }
+        if (CHANGED(kbd_conf.timeout[i])) {
+            DECLARE_HEAP_MSG(req, KBD_TO_REQ);
+            req->to.state = i;
+            req->to.daytime = -1;
+            req->to.new = new->kbd_conf.timeout[i];
+            M_PUB(req);
+            changes++;
+        }
+        if (CHANGED(dim_conf.timeout[i])) {
+            DECLARE_HEAP_MSG(req, DIMMER_TO_REQ);
+            req->to.state = i;
+            req->to.daytime = -1;
+            req->to.new = new->dim_conf.timeout[i];
+            M_PUB(req);
+            changes++;
+        }
+        if (CHANGED(dpms_conf.timeout[i])) {
+            DECLARE_HEAP_MSG(req, DPMS_TO_REQ);
+            req->to.state = i;
+            req->to.daytime = -1;
+            req->to.new = new->dpms_conf.timeout[i];
+            M_PUB(req);
+            changes++;
+        }
+        if (CHANGED(screen_conf.timeout[i])) {
+            DECLARE_HEAP_MSG(req, SCR_TO_REQ);
+            req->to.state = i;
+            req->to.daytime = -1;
+            req->to.new = new->screen_conf.timeout[i];
+            M_PUB(req);
+            changes++;
+        }
+        if (curve_changed(&old->sens_conf.default_curve[i], &new->sens_conf.default_curve[i], &conf.sens_conf.default_curve[i])) {
+            DECLARE_HEAP_MSG(req, CURVE_REQ);
+            memcpy(bl_points[i], new->sens_conf.default_curve[i].points, sizeof(bl_points[i]));
+            req->curve.state = i;
+            req->curve.num_points = new->sens_conf.default_curve[i].num_points;
+            req->curve.regression_points = bl_points[i];
+            M_PUB(req);
+            changes++;
+        }
+        if (curve_changed(&old->kbd_conf.curve[i], &new->kbd_conf.curve[i], &conf.kbd_conf.curve[i])) {
+            DECLARE_HEAP_MSG(req, KBD_CURVE_REQ);
+            memcpy(kbd_points[i], new->kbd_conf.curve[i].points, sizeof(kbd_points[i]));
+            req->curve.state = i;
+            req->curve.num_points = new->kbd_conf.curve[i].num_points;
+            req->curve.regression_points = kbd_points[i];
+            M_PUB(req);
+            changes++;
+        }
+    }
+
+    for (int i = DAY; i < SIZE_STATES; i++) {
+        if (CHANGED(gamma_conf.temp[i])) {
+            DECLARE_HEAP_MSG(req, TEMP_REQ);
+            req->temp.daytime = i;
+            req->temp.new = new->gamma_conf.temp[i];
+            req->temp.smooth = -1;
+            M_PUB(req);
+            changes++;
+        }
+    }
+
+    if (CHANGED(gamma_conf.ambient_gamma)) {
+        DECLARE_HEAP_MSG(req, AMB_GAMMA_REQ);
+        req->ambgamma.new = new->gamma_conf.ambient_gamma;
+        M_PUB(req);
+        changes++;
+    }
+
+    if (CHANGED(bl_conf.no_auto_calib)) {
+        DECLARE_HEAP_MSG(req, NO_AUTOCALIB_REQ);
+        req->nocalib.new = new->bl_conf.no_auto_calib;
+        M_PUB(req);
+        changes++;
+    }
+
+    if (CHANGED(screen_conf.contrib)) {
+        DECLARE_HEAP_MSG(req, CONTRIB_REQ);
+        req->contrib.new = new->screen_conf.contrib;
+        M_PUB(req);
+        changes++;
+    }
+
+    if ((CHANGED(day_conf.loc.lat) || CHANGED(day_conf.loc.lon)) &&
+        new->day_conf.loc.lat != LAT_UNDEFINED && new->day_conf.loc.lon != LON_UNDEFINED) {
+
+        // Keep conf updated, like bus api does
+        memcpy(&conf.day_conf.loc, &new->day_conf.loc, sizeof(loc_t));
+        DECLARE_HEAP_MSG(req, LOCATION_REQ);
+        memcpy(&req->loc.new, &new->day_conf.loc, sizeof(loc_t));
+        M_PUB(req);
+        changes++;
+    }
+
+    for (int i = SUNRISE; i < SIZE_EVENTS; i++) {
+        const bool event_changed = strcmp(old->day_conf.day_events[i], new->day_conf.day_events[i]) != 0 &&
+                                   strcmp(conf.day_conf.day_events[i], new->day_conf.day_events[i]) != 0;
+        const bool os_changed = CHANGED(day_conf.events_os[i]);
+        if (event_changed || os_changed) {
+            /* Offsets have no request: store them, then let DAYTIME recompute its events through a sunrise/sunset request */
+            if (os_changed) {
+                conf.day_conf.events_os[i] = new->day_conf.events_os[i];
+            }
+            const char *event = event_changed ? new->day_conf.day_events[i] : conf.day_conf.day_events[i];
+            if (i == SUNRISE) {
+                DECLARE_HEAP_MSG(req, SUNRISE_REQ);
+                strncpy(req->event.event, event, sizeof(req->event.event) - 1);
+                M_PUB(req);
+            } else {
+                DECLARE_HEAP_MSG(req, SUNSET_REQ);
+                strncpy(req->event.event, event, sizeof(req->event.event) - 1);
+                M_PUB(req);
+            }
+            changes++;
+        }
+    }
+    return changes;
+}
+
+static void check_restart_fields(const conf_t *old, const conf_t *new) {
+    const int num_fields = sizeof(restart_fields) / sizeof(*restart_fields);
+    for (int i = 0; i < num_fields; i++) {
+        const field_t *f = &restart_fields[i];
+        if (memcmp(FIELD_PTR(old, f), FIELD_PTR(new, f), f->size) != 0) {
+            WARN("'%s' changed: restart Clight to apply it.\n", f->name);
+        }
+    }
+
+    bool outputs_changed = old->gamma_conf.num_outputs != new->gamma_conf.num_outputs;
+    for (int i = 0; i < new->gamma_conf.num_outputs && !outputs_changed; i++) {
+        const gamma_output_t *o = &old->gamma_conf.outputs[i];
+        const gamma_output_t *n = &new->gamma_conf.outputs[i];
+        outputs_changed = !str_equal(o->display, n->display) || !str_equal(o->env, n->env) || o->offset != n->offset;
+    }
+    if (outputs_changed) {
+        WARN("'gamma_conf.outputs' changed: restart Clight to apply it.\n");
+    }
+
+    bool budgets_changed = old->budget_conf.num_modules != new->budget_conf.num_modules;
+    for (int i = 0; i < new->budget_conf.num_modules && !budgets_changed; i++) {
+        const module_budget_t *o = &old->budget_conf.modules[i];
+        const module_budget_t *n = &new->budget_conf.modules[i];
+        budgets_changed = !str_equal(o->name, n->name) || o->budget != n->budget;
+    }
+    if (budgets_changed) {
+        WARN("'budget_conf.modules' changed: restart Clight to apply it.\n");
+    }
+
+    if (!curves_equal(old->sens_conf.specific_curves, new->sens_conf.specific_curves)) {
+        WARN("'monitor_override' changed: restart Clight to apply it.\n");
+    }
+}
+
+/* Check changed values as they would be checked at startup; returns the first wrong one, if any */
+static const char *check_values(const conf_t *new) {
+    conf_t checked;
+    memcpy(&checked, new, sizeof(conf_t));
+    check_conf_values(&checked);
+
+    const field_t *tables[] = { fields, req_fields };
+    const int sizes[] = { sizeof(fields) / sizeof(*fields), sizeof(req_fields) / sizeof(*req_fields) };
+    for (int t = 0; t < 2; t++) {
+        for (int i = 0; i < sizes[t]; i++) {
+            const field_t *f = &tables[t][i];
+            if (memcmp(FIELD_PTR(new, f), FIELD_PTR(&conf, f), f->size) != 0 &&
+                memcmp(FIELD_PTR(new, f), FIELD_PTR(&checked, f), f->size) != 0) {
+
+                return f->name;
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Run changed values through the same validations their _REQ messages will go through */
+static const char *validate_requests(const conf_t *new) {
+    for (int i = ON_AC; i < SIZE_AC; i++) {
+        const curve_t *curves[] = { &new->sens_conf.default_curve[i], &new->kbd_conf.curve[i] };
+        const curve_t *live[] = { &conf.sens_conf.default_curve[i], &conf.kbd_conf.curve[i] };
+        for (int j = 0; j < 2; j++) {
+            if (curve_changed(live[j], curves[j], live[j])) {
+                curve_upd up = { .state = i, .num_points = curves[j]->num_points, .regression_points = (double *)curves[j]->points };
+                if (!VALIDATE_REQ(&up)) {
+                    return j == 0 ? "sens_conf.default_curve" : "kbd_conf.curve";
+                }
+            }
+        }
+    }
+
+    for (int i = DAY; i < SIZE_STATES; i++) {
+        if (new->gamma_conf.temp[i] != conf.gamma_conf.temp[i]) {
+            temp_upd up = { .new = new->gamma_conf.temp[i], .daytime = i, .smooth = -1 };
+            if (!VALIDATE_REQ(&up)) {
+                return "gamma_conf.temp";
+            }
+        }
+    }
+
+    if (new->screen_conf.contrib != conf.screen_conf.contrib) {
+        contrib_upd up = { .new = new->screen_conf.contrib };
+        if (!VALIDATE_REQ(&up)) {
+            return "screen_conf.contrib";
+        }
+    }
+
+    for (int i = SUNRISE; i < SIZE_EVENTS; i++) {
+        if (strcmp(new->day_conf.day_events[i], conf.day_conf.day_events[i]) != 0) {
+            evt_upd up = {0};
+            strncpy(up.event, new->day_conf.day_events[i], sizeof(up.event) - 1);
+            if (!VALIDATE_REQ(&up)) {
+                return "day_conf.day_events";
+            }
+        }
+    }
+
+    if (new->day_conf.loc.lat != conf.day_conf.loc.lat || new->day_conf.loc.lon != conf.day_conf.loc.lon) {
+        loc_upd up = { .new = new->day_conf.loc };
+        if (!VALIDATE_REQ(&up)) {
+            return "day_conf.loc";
+        }
+    }
+    return NULL;
+}
+
+static bool curves_equal(map_t *a, map_t *b) {
+    if (map_length(a) != map_length(b)) {
+        return false;
+    }
+    for (map_itr_t *itr = map_itr_new(a); itr; itr = map_itr_next(itr)) {
+        const curve_t *c = map_itr_get_data(itr);
+        const curve_t *other = map_get(b, map_itr_get_key(itr));
+        if (!other) {
+            free(itr);
+            return false;
+        }
+        for (int i = ON_AC; i < SIZE_AC; i++) {
+            if (c[i].num_points != other[i].num_points ||
+                memcmp(c[i].points, other[i].points, c[i].num_points * sizeof(double)) != 0) {
+
+                free(itr);
+                return false;
+            }
+        }
+    }
+    return true;
+}
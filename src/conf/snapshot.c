@@ -0,0 +1,363 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glob.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include "config.h"
+#include "my_math.h"
+#include "utils.h"
+
+/**
+ * Binary snapshot of conf as resolved from config files, ie: before cmdline options and --conf-file,
+ * with all curves best-fit parameters already computed.
+ *
+ * It is valid as long as its sources (clight.conf files, their modules.conf.d/ folders and each file in them)
+ * keep same paths (eg: XDG_CONFIG_HOME did not change), mtime and size;
+ * otherwise config files are parsed again and a new snapshot is stored.
+ * Files @include'd from elsewhere are not tracked.
+ *
+ * Layout: snapshot_hdr_t, then body:
+ * - sources: u32 count, then for each: str path, i64 mtime sec, i64 mtime nsec, i64 size (-1 if missing)
+ * - raw conf_t; its pointers are meaningless and restored from strings below
+ * - strings: sensor dev_name and dev_opts, each gamma output display and env, each module budget name
+ * - specific curves: u32 count, then for each: str monitor id, curve_t[SIZE_AC]
+ * where str is u32 length (SNAPSHOT_NULL for NULL) followed by its chars.
+ */
+
+#define SNAPSHOT_MAGIC      0x53434c43      // "CLCS"
+#define SNAPSHOT_NULL       UINT32_MAX
+
+typedef struct {
+    uint32_t magic;
+    uint32_t conf_size;                     // sizeof(conf_t): any layout change invalidates the snapshot
+    char version[32];                       // Clight version that stored the snapshot
+    uint64_t body_size;
+    uint64_t hash;                          // hash_data() of body
+} snapshot_hdr_t;
+
+typedef struct {
+    const uint8_t *ptr;
+    const uint8_t *end;
+} reader_t;
+
+static void get_snapshot_path(char *path, size_t size);
+static void get_modules_folder(const char *config_file, char *folder, size_t size);
+static void get_source_roots(char roots[2 * CUSTOM][PATH_MAX + 1]);
+static void write_source(FILE *f, const char *path);
+static void write_sources(FILE *f);
+static void write_str(FILE *f, const char *str);
+static const void *read_bytes(reader_t *r, size_t len);
+static bool read_u32(reader_t *r, uint32_t *val);
+static bool read_str(reader_t *r, char **str);
+static bool check_sources(reader_t *r);
+static void fit_curve_pair(curve_t *c, const char *name);
+static void fit_curves(void);
+
+/*
+ * Load conf from snapshot.
+ * Returns 0 on success, -1 if snapshot is missing, corrupted or stale.
+ */
+int load_conf_snapshot(void) {
+    PROFILE_FUNC();
+    char path[PATH_MAX + 1];
+    get_snapshot_path(path, sizeof(path));
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    int ret = -1;
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(snapshot_hdr_t)) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    const snapshot_hdr_t *hdr = map;
+    reader_t r = { (const uint8_t *)map + sizeof(snapshot_hdr_t), (const uint8_t *)map + st.st_size };
+    if (hdr->magic != SNAPSHOT_MAGIC || hdr->conf_size != sizeof(conf_t)
+        || strncmp(hdr->version, VERSION, sizeof(hdr->version))
+        || hdr->body_size != (uint64_t)(r.end - r.ptr)
+        || hdr->hash != hash_data(r.ptr, hdr->body_size, HASH_INIT)) {
+
+        DEBUG("Conf snapshot is invalid.\n");
+        goto end;
+    }
+
+    if (!check_sources(&r)) {
+        DEBUG("Conf snapshot is stale.\n");
+        goto end;
+    }
+
+    /* Body hash matched: from now on, reads cannot fail */
+    map_t *specific_curves = conf.sens_conf.specific_curves;
+    memcpy(&conf, read_bytes(&r, sizeof(conf_t)), sizeof(conf_t));
+    conf.sens_conf.specific_curves = specific_curves;
+
+    read_str(&r, &conf.sens_conf.dev_name);
+    read_str(&r, &conf.sens_conf.dev_opts);
+    for (int i = 0; i < conf.gamma_conf.num_outputs; i++) {
+        read_str(&r, &conf.gamma_conf.outputs[i].display);
+        read_str(&r, &conf.gamma_conf.outputs[i].env);
+    }
+    for (int i = 0; i < conf.budget_conf.num_modules; i++) {
+        read_str(&r, &conf.budget_conf.modules[i].name);
+    }
+
+    uint32_t num_curves = 0;
+    read_u32(&r, &num_curves);
+    for (uint32_t i = 0; i < num_curves; i++) {
+        char *mon_id = NULL;
+        read_str(&r, &mon_id);
+        curve_t *curve = malloc(sizeof(curve_t) * SIZE_AC);
+        memcpy(curve, read_bytes(&r, sizeof(curve_t) * SIZE_AC), sizeof(curve_t) * SIZE_AC);
+        map_put(conf.sens_conf.specific_curves, mon_id, curve);
+        free(mon_id);
+    }
+
+    DEBUG("Conf loaded from snapshot %s.\n", path);
+    ret = 0;
+
+end:
+    munmap(map, st.st_size);
+    return ret;
+}
+
+/*
+ * Store conf as resolved from config files, fitting its curves first;
+ * it must be called before cmdline options are parsed.
+ */
+void store_conf_snapshot(void) {
+    PROFILE_FUNC();
+    fit_curves();
+
+    char *body = NULL;
+    size_t body_size = 0;
+    FILE *f = open_memstream(&body, &body_size);
+    if (!f) {
+        return;
+    }
+
+    write_sources(f);
+    fwrite(&conf, sizeof(conf_t), 1, f);
+    write_str(f, conf.sens_conf.dev_name);
+    write_str(f, conf.sens_conf.dev_opts);
+    for (int i = 0; i < conf.gamma_conf.num_outputs; i++) {
+        write_str(f, conf.gamma_conf.outputs[i].display);
+        write_str(f, conf.gamma_conf.outputs[i].env);
+    }
+    for (int i = 0; i < conf.budget_conf.num_modules; i++) {
+        write_str(f, conf.budget_conf.modules[i].name);
+    }
+
+    const uint32_t num_curves = map_length(conf.sens_conf.specific_curves);
+    fwrite(&num_curves, sizeof(num_curves), 1, f);
+    for (map_itr_t *itr = map_itr_new(conf.sens_conf.specific_curves); itr; itr = map_itr_next(itr)) {
+        write_str(f, map_itr_get_key(itr));
+        fwrite(map_itr_get_data(itr), sizeof(curve_t), SIZE_AC, f);
+    }
+    fclose(f);
+
+    snapshot_hdr_t hdr = { SNAPSHOT_MAGIC, sizeof(conf_t) };
+    strncpy(hdr.version, VERSION, sizeof(hdr.version) - 1);
+    hdr.body_size = body_size;
+    hdr.hash = hash_data(body, body_size, HASH_INIT);
+
+    /* Write to a temp file then rename it, so that a concurrent reader never sees a partial snapshot */
+    char path[PATH_MAX + 1], tmp_path[PATH_MAX + 8];
+    get_snapshot_path(path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    f = fopen(tmp_path, "w");
+    if (f) {
+        const bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 && fwrite(body, 1, body_size, f) == body_size;
+        if (fclose(f) == 0 && ok && rename(tmp_path, path) == 0) {
+            DEBUG("Conf snapshot stored in %s.\n", path);
+        } else {
+            unlink(tmp_path);
+        }
+    }
+    free(body);
+}
+
+static void get_snapshot_path(char *path, size_t size) {
+    if (getenv("XDG_CACHE_HOME")) {
+        snprintf(path, size, "%s/clight_conf", getenv("XDG_CACHE_HOME"));
+    } else {
+        snprintf(path, size, "%s/.cache/clight_conf", getpwuid(getuid())->pw_dir);
+    }
+}
+
+static void get_modules_folder(const char *config_file, char *folder, size_t size) {
+    char *dup = strdup(config_file);
+    snprintf(folder, size, "%s/modules.conf.d", dirname(dup));
+    free(dup);
+}
+
+/* Each config file currently resolved by init_config_file(), followed by its modules.conf.d folder */
+static void get_source_roots(char roots[2 * CUSTOM][PATH_MAX + 1]) {
+    for (int i = OLD_GLOBAL; i < CUSTOM; i++) {
+        init_config_file(i, roots[2 * i]);
+        get_modules_folder(roots[2 * i], roots[2 * i + 1], PATH_MAX + 1);
+    }
+}
+
+static void write_source(FILE *f, const char *path) {
+    struct stat st;
+    int64_t vals[3] = { 0, 0, -1 };
+    if (stat(path, &st) == 0) {
+        vals[0] = st.st_mtim.tv_sec;
+        vals[1] = st.st_mtim.tv_nsec;
+        vals[2] = st.st_size;
+    }
+    write_str(f, path);
+    fwrite(vals, sizeof(int64_t), 3, f);
+}
+
+static void write_sources(FILE *f) {
+    char roots[2 * CUSTOM][PATH_MAX + 1] = {{0}};
+    glob_t gl[CUSTOM] = {{0}};
+    uint32_t num = 0;
+
+    /* Count sources first */
+    get_source_roots(roots);
+    for (int i = OLD_GLOBAL; i < CUSTOM; i++) {
+        char pattern[PATH_MAX + 3];
+        snprintf(pattern, sizeof(pattern), "%s/*", roots[2 * i + 1]);
+        glob(pattern, 0, NULL, &gl[i]);
+        num += 2 + gl[i].gl_pathc;
+    }
+
+    fwrite(&num, sizeof(num), 1, f);
+    for (int i = OLD_GLOBAL; i < CUSTOM; i++) {
+        write_source(f, roots[2 * i]);
+        /* Folder mtime changes when a file is added or removed */
+        write_source(f, roots[2 * i + 1]);
+
+        for (size_t j = 0; j < gl[i].gl_pathc; j++) {
+            write_source(f, gl[i].gl_pathv[j]);
+        }
+        globfree(&gl[i]);
+    }
+}
+
+static void write_str(FILE *f, const char *str) {
+    const uint32_t len = str ? strlen(str) : SNAPSHOT_NULL;
+    fwrite(&len, sizeof(len), 1, f);
+    if (str) {
+        fwrite(str, 1, len, f);
+    }
+}
+
+static const void *read_bytes(reader_t *r, size_t len) {
+    if ((size_t)(r->end - r->ptr) < len) {
+        return NULL;
+    }
+    const void *p = r->ptr;
+    r->ptr += len;
+    return p;
+}
+
+/* Snapshot is packed: multi-byte values may be unaligned */
+static bool read_u32(reader_t *r, uint32_t *val) {
+    const void *p = read_bytes(r, sizeof(uint32_t));
+    if (p) {
+        memcpy(val, p, sizeof(uint32_t));
+    }
+    return p != NULL;
+}
+
+/* Store a malloc'd copy of next string in str */
+static bool read_str(reader_t *r, char **str) {
+    uint32_t len;
+    if (!read_u32(r, &len)) {
+        return false;
+    }
+    *str = NULL;
+    if (len != SNAPSHOT_NULL) {
+        const char *s = read_bytes(r, len);
+        if (!s) {
+            return false;
+        }
+        *str = strndup(s, len);
+    }
+    return true;
+}
+
+/*
+ * Sources must be the ones currently resolved (roots, each folder followed by its files),
+ * and unchanged since snapshot was stored.
+ */
+static bool check_sources(reader_t *r) {
+    uint32_t num;
+    if (!read_u32(r, &num)) {
+        return false;
+    }
+
+    char roots[2 * CUSTOM][PATH_MAX + 1] = {{0}};
+    get_source_roots(roots);
+    int next_root = 0;
+    
+    bool valid = true;
+    for (uint32_t i = 0; i < num && valid; i++) {
+        char *path = NULL;
+        const void *p = NULL;
+        if (!read_str(r, &path) || !path || !(p = read_bytes(r, 3 * sizeof(int64_t)))) {
+            free(path);
+            return false;
+        }
+        int64_t vals[3];
+        memcpy(vals, p, sizeof(vals));
+
+        const size_t folder_len = next_root > 0 ? strlen(roots[next_root - 1]) : 0;
+        if (next_root < 2 * CUSTOM && !strcmp(path, roots[next_root])) {
+            next_root++;
+        } else if (next_root % 2 != 0 || next_root == 0 
+                   || strncmp(path, roots[next_root - 1], folder_len) || path[folder_len] != '/') {
+            /* Neither expected config file nor folder, nor a file in last folder */
+            DEBUG("Conf snapshot source %s is not a current source.\n", path);
+            free(path);
+            return false;
+        }
+
+        struct stat st;
+        if (stat(path, &st) == 0) {
+            valid = vals[0] == st.st_mtim.tv_sec && vals[1] == st.st_mtim.tv_nsec && vals[2] == st.st_size;
+        } else {
+            valid = vals[2] == -1;
+        }
+        if (!valid) {
+            DEBUG("Conf snapshot source %s changed.\n", path);
+        }
+        free(path);
+    }
+    return valid && next_root == 2 * CUSTOM;
+}
+
+/* Curves with too few points are left to be fixed by conf checks */
+static void fit_curve_pair(curve_t *c, const char *name) {
+    char tag[128] = {0};
+    for (int i = ON_AC; i < SIZE_AC; i++) {
+        if (c[i].num_points >= DEGREE) {
+            snprintf(tag, sizeof(tag), "%s %s backlight", i == ON_AC ? "AC" : "BATT", name);
+            polynomialfit(NULL, &c[i], tag);
+        }
+    }
+}
+
+/* Fit all curves, so that modules do not need to */
+static void fit_curves(void) {
+    fit_curve_pair(conf.sens_conf.default_curve, "screen");
+    fit_curve_pair(conf.kbd_conf.curve, "keyboard");
+
+    char name[128] = {0};
+    for (map_itr_t *itr = map_itr_new(conf.sens_conf.specific_curves); itr; itr = map_itr_next(itr)) {
+        snprintf(name, sizeof(name), "'%s'", (const char *)map_itr_get_key(itr));
+        fit_curve_pair(map_itr_get_data(itr), name);
+    }
+}
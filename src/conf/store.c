@@ -0,0 +1,250 @@
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include "config.h"
+
+/**
+ * STORE service writes config files for store_config() without blocking the loop.
+ *
+ * Conf is serialized on the loop, as modules change it from there;
+ * a worker thread then writes it to a temp file, fsyncs it and renames it into place,
+ * so that a config file is never left half written, and signals an eventfd once done.
+ * Requests arriving while a write is in flight are collapsed into a single following write.
+ * Config file mode is kept across writes.
+ */
+
+typedef struct store_req {
+    enum CONFIG file;
+    store_cb cb;
+    void *userdata;
+    struct store_req *next;
+} store_req_t;
+
+typedef struct {
+    char path[PATH_MAX + 1];
+    mode_t mode;                            // mode of the existing config file; 0644 for new ones
+    char *buf;
+    size_t size;
+    int error;                              // errno of failed write; 0 on success
+} store_job_t;
+
+static void start_write(void);
+static void *write_worker(void *arg);
+static void write_job(store_job_t *j);
+static void finish_write(void);
+static void complete_reqs(store_req_t **reqs, int error);
+
+static store_req_t *pending, *in_flight;
+static store_job_t job;
+static pthread_t worker;
+static bool writing, threaded;
+static int efd = -1;
+
+MODULE("STORE");
+
+static void init(void) {
+    PROFILE_FUNC();
+    efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (efd == -1) {
+        WARN("Failed to create eventfd: %s. Config will be stored synchronously.\n", strerror(errno));
+        return;
+    }
+    m_register_fd(efd, true, NULL);
+}
+
+static bool check(void) {
+    return true;
+}
+
+static bool evaluate(void) {
+    return true;
+}
+
+static void destroy(void) {
+    /* Never leave a config file write behind */
+    if (threaded) {
+        pthread_join(worker, NULL);
+    }
+    free(job.buf);
+    /* Callers may hold resources (eg: a bus message to be replied) until completed */
+    complete_reqs(&in_flight, job.error);
+    complete_reqs(&pending, ECANCELED);
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    switch (MSG_TYPE()) {
+    case FD_UPD: {
+        uint64_t val;
+        if (read(msg->fd_msg->fd, &val, sizeof(val)) == sizeof(val)) {
+            finish_write();
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/*
+ * Store current conf into file; cb is called once it is written.
+ * Returns -1 if request could not be queued.
+ */
+int store_config(enum CONFIG file, store_cb cb, void *userdata) {
+    store_req_t *req = calloc(1, sizeof(store_req_t));
+    if (!req) {
+        return -1;
+    }
+    req->file = file;
+    req->cb = cb;
+    req->userdata = userdata;
+
+    store_req_t **tail = &pending;
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = req;
+
+    if (!writing) {
+        start_write();
+    } else {
+        DEBUG("Config file write in progress. Queueing store request.\n");
+    }
+    return 0;
+}
+
+static void start_write(void) {
+    /* Take every pending request for same file: a single write serves them all */
+    const enum CONFIG file = pending->file;
+    store_req_t **tail = &in_flight;
+    for (store_req_t **req = &pending; *req;) {
+        if ((*req)->file == file) {
+            *tail = *req;
+            *req = (*req)->next;
+            tail = &(*tail)->next;
+            *tail = NULL;
+        } else {
+            req = &(*req)->next;
+        }
+    }
+
+    char config_file[PATH_MAX + 1] = {0};
+    init_config_file(file, config_file);
+    if (access(config_file, F_OK) != -1) {
+        WARN("Config file %s already present. Overwriting.\n", config_file);
+    }
+    /* Write through symlinks (eg: a config file kept in a dotfiles repo) instead of replacing them */
+    if (!realpath(config_file, job.path)) {
+        strncpy(job.path, config_file, PATH_MAX);
+    }
+    struct stat st;
+    job.mode = stat(job.path, &st) == 0 ? st.st_mode & 07777 : 0644;
+    job.buf = serialize_config(&job.size);
+    job.error = job.buf ? 0 : ENOMEM;
+
+    writing = true;
+    if (job.buf && efd != -1 && pthread_create(&worker, NULL, write_worker, &job) == 0) {
+        threaded = true;
+        return;
+    }
+
+    /* No worker available: write from the loop */
+    if (job.buf) {
+        write_job(&job);
+    }
+    finish_write();
+}
+
+static void *write_worker(void *arg) {
+    write_job(arg);
+    const uint64_t val = 1;
+    if (write(efd, &val, sizeof(val)) != sizeof(val)) {
+        /* Nothing we can do from here: loop would never be notified */
+    }
+    return NULL;
+}
+
+/* Only touches j: it runs on worker thread */
+static void write_job(store_job_t *j) {
+    char tmp_path[PATH_MAX + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", j->path);
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, j->mode);
+    if (fd == -1) {
+        j->error = errno;
+        return;
+    }
+    /* Rename replaces the config file: give it back its mode, regardless of umask */
+    if (fchmod(fd, j->mode) == -1) {
+        j->error = errno;
+    }
+
+    for (size_t off = 0; off < j->size && !j->error;) {
+        const ssize_t r = write(fd, j->buf + off, j->size - off);
+        if (r >= 0) {
+            off += r;
+        } else if (errno != EINTR) {
+            j->error = errno;
+        }
+    }
+    if (!j->error && fsync(fd) == -1) {
+        j->error = errno;
+    }
+    if (close(fd) == -1 && !j->error) {
+        j->error = errno;
+    }
+    if (!j->error && rename(tmp_path, j->path) == -1) {
+        j->error = errno;
+    }
+    if (j->error) {
+        unlink(tmp_path);
+        return;
+    }
+
+    /* Make the rename itself durable */
+    char *sep = strrchr(j->path, '/');
+    if (sep && sep != j->path) {
+        *sep = '\0';
+        fd = open(j->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        *sep = '/';
+        if (fd != -1) {
+            fsync(fd);
+            close(fd);
+        }
+    }
+}
+
+static void finish_write(void) {
+    if (threaded) {
+        pthread_join(worker, NULL);
+        threaded = false;
+    }
+    writing = false;
+
+    if (job.error) {
+        WARN("Failed to write new config to %s: %s\n", job.path, strerror(job.error));
+    } else {
+        INFO("New configuration successfully written to: %s\n", job.path);
+    }
+    free(job.buf);
+    job.buf = NULL;
+
+    complete_reqs(&in_flight, job.error);
+
+    /* Requests arrived meanwhile: a single write for all of them */
+    if (pending) {
+        start_write();
+    }
+}
+
+static void complete_reqs(store_req_t **reqs, int error) {
+    while (*reqs) {
+        store_req_t *req = *reqs;
+        *reqs = req->next;
+        if (req->cb) {
+            req->cb(error, req->userdata);
+        }
+        free(req);
+    }
+}
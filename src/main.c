@@ -24,10 +24,14 @@
 #include <glob.h>
 #include "opts.h"
 #include "utils.h"
+#include "clock.h"
+#include "budget.h"
+#include "lazy.h"
 
 static void init(int argc, char *argv[]);
 static void init_state(void);
 static void sigsegv_handler(int signum);
+static void prefetch_probes(void);
 static void check_clightd_version(void);
 static void init_user_mod_path(enum CONFIG file, char *filename);
 static void load_user_modules(enum CONFIG file);
@@ -36,6 +40,7 @@ state_t state = {0};
 conf_t conf = {0};
 
 int main(int argc, char *argv[]) {
+    profile_start(argc, argv);
     int ret = setjmp(state.quit_buf);
     if (ret == 0) {
         init(argc, argv);
@@ -47,6 +52,8 @@ int main(int argc, char *argv[]) {
             state.looping = false;
         }
     }
+    profile_done("Clight exit");
+    destroy_module_stats();
     close_log();
     free((void *)state.clightd_version);
     return ret;
@@ -84,11 +91,13 @@ static void init(int argc, char *argv[]) {
     if (!no_log) {
         open_log();
     }
+    init_clock();
     init_opts(argc, argv);
     log_conf();
     
     if (!conf.wizard) {
         /* We want any error while checking Clightd required version to be logged AFTER conf logging */
+        prefetch_probes();
         check_clightd_version();
         init_state();
         /* 
@@ -130,6 +139,61 @@ static void sigsegv_handler(int signum) {
     raise(signum);
 }
 
+/*
+ * Concurrently issue all independent bus requests that modules make when starting,
+ * instead of paying for each synchronous round trip one after the other.
+ * Replies are consumed by the matching synchronous calls; they must be kept in sync
+ * with the calls made by modules. A missing or unused entry just costs its own round trip.
+ * Only prefetch calls without side effects (eg: no Idle.GetClient, that creates a Clightd client):
+ * an unused reply is just dropped.
+ */
+static void prefetch_probes(void) {
+    PROFILE_FUNC();
+    
+    SYSBUS_ARG(vers_args, CLIGHTD_SERVICE, "/org/clightd/clightd", "org.clightd.clightd", "Version");
+    prefetch_property(&vers_args);
+    
+    SYSBUS_ARG(upower_args, "org.freedesktop.UPower", "/org/freedesktop/UPower", "org.freedesktop.DBus.Peer", "Ping");
+    prefetch_call(&upower_args, NULL, NULL);
+    SYSBUS_ARG(batt_args, "org.freedesktop.UPower",  "/org/freedesktop/UPower", "org.freedesktop.UPower", "OnBattery");
+    prefetch_property(&batt_args);
+    SYSBUS_ARG(lid_args, "org.freedesktop.UPower",  "/org/freedesktop/UPower", "org.freedesktop.UPower", "LidIsClosed");
+    prefetch_property(&lid_args);
+    
+    if ((conf.day_conf.loc.lat == LAT_UNDEFINED || conf.day_conf.loc.lon == LON_UNDEFINED) && 
+        (is_string_empty(conf.day_conf.day_events[SUNRISE]) || is_string_empty(conf.day_conf.day_events[SUNSET]))) {
+        
+        SYSBUS_ARG(geoclue_args, "org.freedesktop.GeoClue2", "/org/freedesktop/GeoClue2", "org.freedesktop.DBus.Peer", "Ping");
+        prefetch_call(&geoclue_args, NULL, NULL);
+    }
+    
+    if (!conf.kbd_conf.disabled) {
+        SYSBUS_ARG(kbd_args, CLIGHTD_SERVICE, "/org/clightd/clightd/KbdBacklight", "org.freedesktop.DBus.Introspectable", "Introspect");
+        prefetch_call(&kbd_args, NULL, NULL);
+    }
+    
+    if (!conf.gamma_conf.disabled) {
+        SYSBUS_ARG(gamma_args, CLIGHTD_SERVICE, "/org/clightd/clightd/Gamma", "org.clightd.clightd.Gamma", "Get");
+        prefetch_call(&gamma_args, fetch_display(), fetch_env());
+        for (int i = 0; i < conf.gamma_conf.num_outputs; i++) {
+            const gamma_output_t *o = &conf.gamma_conf.outputs[i];
+            prefetch_call(&gamma_args, o->display, o->env ? o->env : fetch_env());
+        }
+    }
+    
+    if (!conf.bl_conf.disabled) {
+        SYSBUS_ARG(bl_args, CLIGHTD_SERVICE, "/org/clightd/clightd/Backlight2", "org.clightd.clightd.Backlight2", "Get");
+        prefetch_call(&bl_args, NULL, NULL);
+    }
+    
+    if (!conf.screen_conf.disabled) {
+        SYSBUS_ARG(screen_args, CLIGHTD_SERVICE, "/org/clightd/clightd/Screen", "org.clightd.clightd.Screen", "GetEmittedBrightness");
+        prefetch_call(&screen_args, fetch_display(), fetch_env());
+    }
+    
+    prefetch_wait();
+}
+
 static void check_clightd_version(void) {
     SYSBUS_ARG(vers_args, CLIGHTD_SERVICE, "/org/clightd/clightd", "org.clightd.clightd", "Version");
     
@@ -165,12 +229,17 @@ static void init_user_mod_path(enum CONFIG file, char *filename) {
 }
 
 static void load_user_modules(enum CONFIG file) {
+    PROFILE_FUNC();
     char modules_path[PATH_MAX + 1];
     init_user_mod_path(file, modules_path);
     
     glob_t gl = {0};
     if (glob(modules_path, GLOB_NOSORT | GLOB_ERR, NULL, &gl) == 0) {
         for (int i = 0; i < gl.gl_pathc; i++) {
+            /* Modules with a manifest are loaded by LAZY on first use */
+            if (is_module_manifest(gl.gl_pathv[i]) || lazy_load_module(gl.gl_pathv[i])) {
+                continue;
+            }
             if (m_load(gl.gl_pathv[i]) == MOD_OK) {
                 INFO("'%s' loaded.\n", gl.gl_pathv[i]);
             } else {
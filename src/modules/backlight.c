@@ -1,6 +1,7 @@
 #include "interface.h"
 #include "my_math.h"
 #include "utils.h"
+#include "metrics.h"
 
 static void receive_waiting_init(const msg_t *const msg, UNUSED const void* userdata);
 static void receive_paused(const msg_t *const msg, const void* userdata);
@@ -26,7 +27,8 @@ static int on_sensor_change(sd_bus_message *m, void *userdata, sd_bus_error *ret
 static int on_bl_changed(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error);
 static int on_interface_added(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error);
 static int on_interface_removed(sd_bus_message *m, UNUSED void *userdata, UNUSED sd_bus_error *ret_error);
-static void on_delayed_interface(void);
+static void on_delayed_interface(UNUSED void *userdata);
+static void on_bl_timer(UNUSED void *userdata);
 static int get_current_timeout(void);
 static void on_lid_update(void);
 static void pause_mod(enum mod_pause type);
@@ -37,7 +39,7 @@ static int method_list_mon_override(sd_bus_message *m, void *userdata, sd_bus_er
 static int method_set_mon_override(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
 
 static map_t *bls;
-static int bl_fd = -1, delayed_fd;
+static int bl_timer = -1, delayed_timer;
 static sd_bus_slot *sens_slot, *bl_slot, *if_a_slot, *if_r_slot;
 static char *backlight_interface; // main backlight interface used to only publish BL_UPD msgs for a single backlight sn
 static const sd_bus_vtable conf_bl_vtable[] = {
@@ -91,11 +93,12 @@ API(MonitorOverride, conf_mon_override_vtable, conf.sens_conf.specific_curves);
 MODULE_WITH_PAUSE("BACKLIGHT");
 
 static void init(void) {
+    PROFILE_FUNC();
     bls = map_new(true, free);
     capture_req.capture.reset_timer = true;
     bl_req.bl.smooth = -1; // Use conf values
     
-    delayed_fd = start_timer(CLOCK_BOOTTIME, 0, 0);
+    delayed_timer = start_timer(0, 0);
     
     // Disabled while in wizard mode as it is useless and spams to stdout
     if (!conf.wizard) {
@@ -145,10 +148,10 @@ static void destroy(void) {
     deinit_Backlight_api();
     deinit_Sensor_api();
     deinit_MonitorOverride_api();
-    if (bl_fd >= 0) {
-        close(bl_fd);
+    if (bl_timer >= 0) {
+        stop_timer(bl_timer);
     }
-    close(delayed_fd);
+    stop_timer(delayed_timer);
     free(backlight_interface);
     free(conf.sens_conf.dev_name);
     free(conf.sens_conf.dev_opts);
@@ -219,9 +222,10 @@ static void receive_waiting_init(const msg_t *const msg, UNUSED const void* user
         SYSBUS_ARG(if_removed_args, CLIGHTD_SERVICE, "/org/clightd/clightd/Backlight2", "org.freedesktop.DBus.ObjectManager", "InterfacesRemoved");
         add_match(&if_removed_args, &if_r_slot, on_interface_removed);
         
-        /* Create the timerfd and eventually pause (if current timeout is <0) */
-        bl_fd = start_timer(CLOCK_BOOTTIME, 0, get_current_timeout() > 0);
-        m_register_fd(bl_fd, false, NULL);
+        /* Create the timer and eventually pause (if current timeout is <0) */
+        bl_timer = start_timer(0, get_current_timeout() > 0);
+        set_timer_slack(bl_timer, conf.bl_conf.timer_slack);
+        register_timer(bl_timer, on_bl_timer, NULL);
         reset_or_pause(-1, false);
         
         /* Eventually pause backlight if sensor is not available */
@@ -255,16 +259,6 @@ static void receive_waiting_init(const msg_t *const msg, UNUSED const void* user
 
 static void receive(const msg_t *const msg, UNUSED const void* userdata) {
     switch (MSG_TYPE()) {
-    case FD_UPD:
-        read_timer(msg->fd_msg->fd);
-        if (msg->fd_msg->fd == delayed_fd) {
-            on_delayed_interface();
-        } else {
-            // When SCREEN module is running, capture only!
-            capture_req.capture.capture_only = state.screen_br != 0.0f;
-            M_PUB(&capture_req);
-        }
-        break;
     case SCREEN_BR_UPD:
         set_new_backlight();
         break;
@@ -336,11 +330,6 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
 
 static void receive_paused(const msg_t *const msg, UNUSED const void* userdata) {
     switch (MSG_TYPE()) {
-    case FD_UPD:
-        // While paused, we can only receive events from delayed_fd!
-        read_timer(msg->fd_msg->fd);
-        on_delayed_interface();
-        break;
     case SCREEN_BR_UPD:
         if (!state.display_state) {
             set_new_backlight();
@@ -496,7 +485,7 @@ static void do_capture(bool reset_timer, bool capture_only) {
     }
 
     if (reset_timer) {
-        set_timeout(get_current_timeout(), 0, bl_fd, 0);
+        set_timeout(get_current_timeout(), 0, bl_timer, 0);
     }
 }
 
@@ -568,6 +557,9 @@ static void set_each_brightness(double pct, const double step, const int timeout
         }
         if (r < 0) {
             WARN("Failed to set backlight on %s.\n", mon_id);
+        } else {
+            metrics_bl_set(mon_id);
+            profile_done("first backlight set");
         }
     }
 }
@@ -585,6 +577,10 @@ static void set_backlight_level(const double pct, const bool is_smooth, double s
         
         /* Set backlight on both internal monitor (in case of laptop) and external ones */
         r = call(&args, "d(du)", pct, step, timeout);
+        if (r >= 0) {
+            metrics_bl_set(NULL);
+            profile_done("first backlight set");
+        }
     }
     
     if (r >= 0 && is_smooth) {
@@ -594,15 +590,20 @@ static void set_backlight_level(const double pct, const bool is_smooth, double s
 }
 
 static int capture_frames_brightness(void) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
     SYSBUS_ARG_REPLY(args, parse_bus_reply, NULL, CLIGHTD_SERVICE, "/org/clightd/clightd/Sensor", "org.clightd.clightd.Sensor", "Capture");
-    return call(&args, "sis", conf.sens_conf.dev_name, 
-                conf.sens_conf.num_captures[state.ac_state], 
-                conf.sens_conf.dev_opts);
+    const int r = call(&args, "sis", conf.sens_conf.dev_name, 
+                       conf.sens_conf.num_captures[state.ac_state], 
+                       conf.sens_conf.dev_opts);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    metrics_capture(r == 0, (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0);
+    return r;
 }
 
 /* Callback on upower ac state changed signal */
 static void upower_callback(void) {
-    set_timeout(0, get_current_timeout() > 0, bl_fd, 0);
+    set_timeout(0, get_current_timeout() > 0, bl_timer, 0);
 }
 
 /* Callback on "NoAutoCalib" bus exposed writable property */
@@ -642,7 +643,7 @@ static void reset_or_pause(int old_timeout, bool reset) {
     } else {
         resume_mod(TIMEOUT);
         if (reset) {
-            reset_timer(bl_fd, old_timeout, new_timeout);
+            reset_timer(bl_timer, old_timeout, new_timeout);
         }
     }
 }
@@ -756,10 +757,10 @@ static int on_interface_added(sd_bus_message *m, UNUSED void *userdata, UNUSED s
         map_put(bls, obj_path, val);
         
         if (conf.bl_conf.sync_monitors_delay > 0) {
-            set_timeout(conf.bl_conf.sync_monitors_delay, 0, delayed_fd, 0);
-            m_register_fd(delayed_fd, false, NULL);
+            set_timeout(conf.bl_conf.sync_monitors_delay, 0, delayed_timer, 0);
+            register_timer(delayed_timer, on_delayed_interface, NULL);
         } else {
-            on_delayed_interface();
+            on_delayed_interface(NULL);
         }
     }
     return 0;
@@ -778,16 +779,16 @@ static int on_interface_removed(sd_bus_message *m, UNUSED void *userdata, UNUSED
         map_remove(bls, obj_path);
         
         if (conf.bl_conf.sync_monitors_delay > 0) {
-            set_timeout(conf.bl_conf.sync_monitors_delay, 0, delayed_fd, 0);
-            m_register_fd(delayed_fd, false, NULL);
+            set_timeout(conf.bl_conf.sync_monitors_delay, 0, delayed_timer, 0);
+            register_timer(delayed_timer, on_delayed_interface, NULL);
         } else {
-            on_delayed_interface();
+            on_delayed_interface(NULL);
         }
     }
     return 0;
 }
 
-static void on_delayed_interface(void) {
+static void on_delayed_interface(UNUSED void *userdata) {
     /* Force-set gamma temp on all monitors */
     DECLARE_HEAP_MSG(temp_req, TEMP_REQ);
     temp_req->temp.new = state.current_temp;
@@ -801,7 +802,13 @@ static void on_delayed_interface(void) {
     bl_req->bl.smooth = -1;
     M_PUB(bl_req);
     
-    m_deregister_fd(delayed_fd);
+    deregister_timer(delayed_timer);
+}
+
+static void on_bl_timer(UNUSED void *userdata) {
+    // When SCREEN module is running, capture only!
+    capture_req.capture.capture_only = state.screen_br != 0.0f;
+    M_PUB(&capture_req);
 }
 
 static inline int get_current_timeout(void) {
@@ -819,7 +826,7 @@ static void on_lid_update(void) {
     } else {
         if (conf.bl_conf.capture_on_lid_opened) {
             /* Fire immediately */
-            set_timeout(0, 1, bl_fd, 0);
+            set_timeout(0, 1, bl_timer, 0);
         }
         resume_mod(LID);
     }
@@ -828,16 +835,16 @@ static void on_lid_update(void) {
 static void pause_mod(enum mod_pause type) {
     if (CHECK_PAUSE(true, type)) {
         m_become(paused);
-        /* Properly deregister our fd while paused */
-        m_deregister_fd(bl_fd);
+        /* Properly deregister our timer while paused */
+        deregister_timer(bl_timer);
     }
 }
 
 static void resume_mod(enum mod_pause type) {
     if (CHECK_PAUSE(false, type)) {
         m_unbecome();
-        /* Register back our fd on resume */
-        m_register_fd(bl_fd, false, NULL);
+        /* Register back our timer on resume */
+        register_timer(bl_timer, on_bl_timer, NULL);
     }
 }
 
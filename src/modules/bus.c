@@ -1,13 +1,45 @@
+#include <poll.h>
 #include "bus.h"
 #include "utils.h"
+#include "lagmon.h"
 
 #define GET_BUS(a)  sd_bus *tmp = a->bus; if (!tmp) { tmp = a->type == USER_BUS ? userbus : sysbus; } if (!tmp) { return -1; }
 
+#define MAX_PREFETCHES          16
+#define PREFETCH_TIMEOUT_MS     2000    // max time spent gathering prefetched replies
+#define PREFETCH_TTL            10      // seconds a prefetched reply stays valid
+
+/*
+ * Replies to startup probes, requested concurrently before modules start.
+ * Each one is consumed by the first matching synchronous call()/get_property(),
+ * that avoids its own round trip.
+ */
+typedef struct {
+    sd_bus *bus;
+    const char *service;
+    const char *path;
+    const char *interface;
+    const char *member;
+    const char *arg0;                   // string args of method call; NULL if unneeded
+    const char *arg1;
+    bool property;
+    bool pending;
+    struct timespec received;
+    sd_bus_message *reply;
+} prefetch_t;
+
 static void free_bus_structs(sd_bus_error *err, sd_bus_message *m, sd_bus_message *reply);
+static void account_sync_call(const bus_args *a, const struct timespec *start);
 static int check_err(int *r, sd_bus_error *err, const char *caller);
 static int proxy_async_request(struct sd_bus_message *m, void *userdata, sd_bus_error *err);
+static int add_prefetch(sd_bus *b, const bus_args *a, const char *arg0, const char *arg1, bool property);
+static int on_prefetch_reply(sd_bus_message *m, void *userdata, sd_bus_error *err);
+static sd_bus_message *take_prefetch(sd_bus *b, const bus_args *a, const char *arg0, const char *arg1, bool property);
+static int prefetch_errno(sd_bus_message *reply);
 
 static sd_bus *sysbus, *userbus;
+static prefetch_t prefetches[MAX_PREFETCHES];
+static int num_prefetches, num_pending;
 
 MODULE("BUS");
 
@@ -17,6 +49,7 @@ static void module_pre_start(void) {
 }
 
 static void init(void) {
+    PROFILE_FUNC();
     if (!sysbus) {
         ERROR("BUS: Failed to connect to system bus.\n");
     }
@@ -44,6 +77,12 @@ static bool evaluate(void) {
 }
 
 static void destroy(void) {
+    for (int i = 0; i < num_prefetches; i++) {
+        if (prefetches[i].reply) {
+            sd_bus_message_unref(prefetches[i].reply);
+        }
+    }
+    num_prefetches = 0;
     if (sysbus) {
         sysbus = sd_bus_flush_close_unref(sysbus);
     }
@@ -71,10 +110,34 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
  * Call a method on bus and store its result of type userptr_type in userptr.
  */
 int call(const bus_args *a, const char *signature, ...) {
+    PROFILE_SPAN("%s(): %s", a->caller, a->member);
     sd_bus_error error = SD_BUS_ERROR_NULL;
     sd_bus_message *m = NULL, *reply = NULL;
     GET_BUS(a);
     
+    /* Prefetched startup probes are only calls without args or with 2 string args */
+    if (num_prefetches > 0 && a->reply_cb && !a->async) {
+        const char *arg0 = NULL, *arg1 = NULL;
+        bool prefetchable = is_string_empty(signature);
+        if (!prefetchable && !strcmp(signature, "ss")) {
+            va_list args;
+            va_start(args, signature);
+            arg0 = va_arg(args, const char *);
+            arg1 = va_arg(args, const char *);
+            va_end(args);
+            prefetchable = true;
+        }
+        if (prefetchable && (reply = take_prefetch(tmp, a, arg0, arg1, false))) {
+            int r = prefetch_errno(reply);
+            if (r == 0) {
+                r = a->reply_cb(reply, a->member, a->reply_userdata);
+            }
+            check_err(&r, NULL, a->caller);
+            free_bus_structs(NULL, NULL, reply);
+            return r;
+        }
+    }
+    
     int r = sd_bus_message_new_method_call(tmp, &m, a->service, a->path, a->interface, a->member);
     if (check_err(&r, &error, a->caller)) {
         goto finish;
@@ -95,7 +158,10 @@ int call(const bus_args *a, const char *signature, ...) {
     /* Check if we need to wait for a response message */
     if (a->reply_cb != NULL) {
         if (!a->async) {
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
             r = sd_bus_call(tmp, m, 0, &error, &reply);
+            account_sync_call(a, &start);
         } else {
             r = sd_bus_call_async(tmp, NULL, m, proxy_async_request, (void *)a, 0);
         }
@@ -145,12 +211,31 @@ int set_property(const bus_args *a, const char *type, const uintptr_t value) {
 }
 
 int get_property(const bus_args *a, const char *type, void *userptr) {
+    PROFILE_SPAN("%s(): %s", a->caller, a->member);
     sd_bus_error error = SD_BUS_ERROR_NULL;
     sd_bus_message *m = NULL;
     GET_BUS(a);
     
     int r = -EINVAL;
-    if (type) {
+    if (type && (m = take_prefetch(tmp, a, NULL, NULL, true))) {
+        r = prefetch_errno(m);
+        if (r == 0) {
+            r = sd_bus_message_enter_container(m, SD_BUS_TYPE_VARIANT, type);
+        }
+        if (r >= 0) {
+            if (*type == SD_BUS_TYPE_STRING || *type == SD_BUS_TYPE_OBJECT_PATH) {
+                const char *obj = NULL;
+                r = sd_bus_message_read_basic(m, *type, &obj);
+                if (r >= 0) {
+                    *((char **)userptr) = strdup(obj); // must be freed by caller
+                }
+            } else {
+                r = sd_bus_message_read_basic(m, *type, userptr);
+            }
+        }
+    } else if (type) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
         switch (*type) {
         case SD_BUS_TYPE_STRING:
         case SD_BUS_TYPE_OBJECT_PATH: {
@@ -166,12 +251,20 @@ int get_property(const bus_args *a, const char *type, void *userptr) {
             r = sd_bus_get_property_trivial(tmp, a->service, a->path, a->interface, a->member, &error, *type, userptr);
             break;
         }
+        account_sync_call(a, &start);
     }    
     check_err(&r, NULL, a->caller);    
     free_bus_structs(&error, m, NULL);    
     return r;
 }
 
+/* Synchronous calls block the loop: report them to LAGMON */
+static void account_sync_call(const bus_args *a, const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    lag_account(a->caller, a->member, (end.tv_sec - start->tv_sec) * 1000.0 + (end.tv_nsec - start->tv_nsec) / 1000000.0);
+}
+
 static void free_bus_structs(sd_bus_error *err, sd_bus_message *m, sd_bus_message *reply) {
     if (err) {
         sd_bus_error_free(err);
@@ -194,15 +287,157 @@ static int check_err(int *r, sd_bus_error *err, const char *caller) {
     return *r;
 }
 
+/*
+ * Error replies are only forwarded to callers that asked for them (async_errors),
+ * eg: to know when an async request completed; reading from an error reply just fails.
+ */
 static int proxy_async_request(struct sd_bus_message *m, void *userdata, sd_bus_error *err) {
+    bus_args *a = (bus_args *)userdata;
     if (sd_bus_message_is_method_error(m, NULL)) {
         WARN("Error in async req: %s\n", err->message ? err->message : "unknown");
-        return 0;
+        if (!a->async_errors) {
+            return 0;
+        }
     }
-    bus_args *a = (bus_args *)userdata;
     return a->reply_cb(m, a->member, a->reply_userdata);
 }
 
 sd_bus *get_user_bus(void) {
     return userbus;
 }
+
+/*
+ * Asynchronously call a method, with up to 2 string args,
+ * whose reply will be used by the first same call() made by a module.
+ * Method must have no side effects, as its reply may never be used.
+ */
+int prefetch_call(const bus_args *a, const char *arg0, const char *arg1) {
+    GET_BUS(a);
+    return add_prefetch(tmp, a, arg0, arg1, false);
+}
+
+/*
+ * Asynchronously get a property,
+ * whose value will be used by the first same get_property() made by a module.
+ */
+int prefetch_property(const bus_args *a) {
+    GET_BUS(a);
+    return add_prefetch(tmp, a, NULL, NULL, true);
+}
+
+/*
+ * Wait for all prefetched replies, up to PREFETCH_TIMEOUT_MS;
+ * calls whose reply did not come in time will just do their own round trip.
+ */
+void prefetch_wait(void) {
+    PROFILE_FUNC();
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sd_bus *buses[] = { sysbus, userbus };
+    
+    int elapsed = 0;
+    while (num_pending > 0 && elapsed < PREFETCH_TIMEOUT_MS) {
+        struct pollfd fds[2];
+        int nfds = 0;
+        for (int i = 0; i < 2; i++) {
+            if (buses[i]) {
+                while (sd_bus_process(buses[i], NULL) > 0);
+                fds[nfds].fd = sd_bus_get_fd(buses[i]);
+                fds[nfds].events = sd_bus_get_events(buses[i]);
+                nfds++;
+            }
+        }
+        if (num_pending > 0 && poll(fds, nfds, PREFETCH_TIMEOUT_MS - elapsed) <= 0) {
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+    }
+    
+    /* Last replies can be ready after poll() timed out */
+    for (int i = 0; i < 2; i++) {
+        if (buses[i]) {
+            while (sd_bus_process(buses[i], NULL) > 0);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+    DEBUG("%d/%d startup probes replied in %dms.\n", num_prefetches - num_pending, num_prefetches, elapsed);
+}
+
+static int add_prefetch(sd_bus *b, const bus_args *a, const char *arg0, const char *arg1, bool property) {
+    if (num_prefetches == MAX_PREFETCHES) {
+        return -1;
+    }
+    
+    prefetch_t *p = &prefetches[num_prefetches];
+    int r;
+    if (property) {
+        r = sd_bus_call_method_async(b, NULL, a->service, a->path, "org.freedesktop.DBus.Properties", "Get", 
+                                     on_prefetch_reply, p, "ss", a->interface, a->member);
+    } else if (arg0) {
+        r = sd_bus_call_method_async(b, NULL, a->service, a->path, a->interface, a->member, 
+                                     on_prefetch_reply, p, "ss", arg0, arg1);
+    } else {
+        r = sd_bus_call_method_async(b, NULL, a->service, a->path, a->interface, a->member, 
+                                     on_prefetch_reply, p, NULL);
+    }
+    if (check_err(&r, NULL, a->caller) == 0) {
+        p->bus = b;
+        p->service = a->service;
+        p->path = a->path;
+        p->interface = a->interface;
+        p->member = a->member;
+        p->arg0 = arg0;
+        p->arg1 = arg1;
+        p->property = property;
+        p->pending = true;
+        num_prefetches++;
+        num_pending++;
+    }
+    return r;
+}
+
+static int on_prefetch_reply(sd_bus_message *m, void *userdata, UNUSED sd_bus_error *err) {
+    prefetch_t *p = (prefetch_t *)userdata;
+    p->reply = sd_bus_message_ref(m);
+    p->pending = false;
+    clock_gettime(CLOCK_MONOTONIC, &p->received);
+    num_pending--;
+    return 0;
+}
+
+static sd_bus_message *take_prefetch(sd_bus *b, const bus_args *a, const char *arg0, const char *arg1, bool property) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    
+    for (int i = 0; i < num_prefetches; i++) {
+        prefetch_t *p = &prefetches[i];
+        if (p->reply && p->bus == b && p->property == property && 
+            !strcmp(p->service, a->service) && !strcmp(p->path, a->path) &&
+            !strcmp(p->interface, a->interface) && !strcmp(p->member, a->member) &&
+            !strcmp(p->arg0 ? p->arg0 : "", arg0 ? arg0 : "") && !strcmp(p->arg1 ? p->arg1 : "", arg1 ? arg1 : "")) {
+            
+            /* Each reply is used once */
+            sd_bus_message *reply = p->reply;
+            p->reply = NULL;
+            if (now.tv_sec - p->received.tv_sec > PREFETCH_TTL) {
+                sd_bus_message_unref(reply);
+                continue;
+            }
+            DEBUG("%s(): using prefetched %s reply.\n", a->caller, a->member);
+            return reply;
+        }
+    }
+    return NULL;
+}
+
+static int prefetch_errno(sd_bus_message *reply) {
+    if (sd_bus_message_is_method_error(reply, NULL)) {
+        const sd_bus_error *error = sd_bus_message_get_error(reply);
+        DEBUG("Prefetched reply: %s\n", error && error->message ? error->message : "unknown error");
+        const int r = sd_bus_message_get_errno(reply);
+        return r > 0 ? -r : -EIO;
+    }
+    return 0;
+}
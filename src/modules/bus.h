@@ -25,6 +25,7 @@ typedef struct {
     const char *caller;
     sd_bus *bus;
     bool async; // ASYNC requests NEED a static/heap memory bus_args!!
+    bool async_errors; // ASYNC requests only: forward error replies to reply_cb too
 } bus_args;
 
 #define BUS_ARG(name, ...)      bus_args name = { __VA_ARGS__, __func__ };
@@ -43,3 +44,6 @@ int add_match(const bus_args *a, sd_bus_slot **slot, sd_bus_message_handler_t cb
 int set_property(const bus_args *a, const char *type, const uintptr_t value);
 int get_property(const bus_args *a, const char *type, void *userptr);
 sd_bus *get_user_bus(void);
+int prefetch_call(const bus_args *a, const char *arg0, const char *arg1);
+int prefetch_property(const bus_args *a);
+void prefetch_wait(void);
@@ -2,13 +2,16 @@
 #include "timer.h"
 #include "interface.h"
 
+#define DAYTIME_CLOCK_JUMP_SEC  60          // alarm delay (besides timer slack) considered a wall clock jump
+
 static void receive_waiting_loc(const msg_t *const msg, UNUSED const void* userdata);
 static void start_daytime(void);
-static void check_daytime(void);
+static void check_daytime(UNUSED void *userdata);
 static void get_next_events(const time_t *now, const float lat, const float lon, int dayshift);
 static void check_next_event(const time_t *now);
 static void check_state(const time_t *now);
 static void reset_daytime(void);
+static bool should_sync_temp(const time_t *now);
 static int get_event(sd_bus *bus, const char *path, const char *interface, const char *property,
                      sd_bus_message *value, void *userdata, sd_bus_error *error);
 static int set_event(sd_bus *bus, const char *path, const char *interface, const char *property,
@@ -16,7 +19,8 @@ static int set_event(sd_bus *bus, const char *path, const char *interface, const
 static int set_os(sd_bus *bus, const char *path, const char *interface, const char *property,
               sd_bus_message *value, void *userdata, sd_bus_error *error);
 
-static int day_fd;
+static int day_timer = -1;
+static time_t next_alarm;                   // wall clock time day_timer is expected to fire; 0 to force a sync
 static const sd_bus_vtable conf_daytime_vtable[] = {
     SD_BUS_VTABLE_START(0),
     SD_BUS_WRITABLE_PROPERTY("Sunrise", "s", get_event, set_event, offsetof(daytime_conf_t, day_events[SUNRISE]), 0),
@@ -41,12 +45,14 @@ API(Daytime, conf_daytime_vtable, conf.day_conf);
 MODULE("DAYTIME");
 
 static void init(void) {
+    PROFILE_FUNC();
     temp_req.temp.daytime = -1;
     temp_req.temp.smooth = -1;
     
     M_SUB(LOC_UPD);
     M_SUB(SUNRISE_REQ);
     M_SUB(SUNSET_REQ);
+    M_SUB(SUSPEND_UPD);
     m_become(waiting_loc);
     
     init_Daytime_api();
@@ -61,6 +67,9 @@ static bool evaluate(void) {
 }
 
 static void destroy(void) {
+    if (day_timer >= 0) {
+        stop_timer(day_timer);
+    }
     deinit_Daytime_api();
 }
 
@@ -106,10 +115,6 @@ static void receive_waiting_loc(const msg_t *const msg, UNUSED const void* userd
 
 static void receive(const msg_t *const msg, UNUSED const void* userdata) {
     switch (MSG_TYPE()) {
-        case FD_UPD:
-            read_timer(msg->fd_msg->fd);
-            check_daytime();
-            break;
         case LOC_UPD:
             reset_daytime();
             DEBUG("New position received. Updating sunrise and sunset times.\n");
@@ -127,22 +132,31 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
             }
             break;
         }
+        case SUSPEND_UPD:
+            if (!state.suspended) {
+                /* Recheck now, forcing a gamma sync after resume */
+                next_alarm = 0;
+                set_timeout(0, 1, day_timer, 0);
+            }
+            break;
         default:
             break;
     }
 }
 
 static void start_daytime(void) {
-    day_fd = start_timer(CLOCK_BOOTTIME, 0, 1);
-    m_register_fd(day_fd, true, NULL);
+    day_timer = start_timer(0, 1);
+    set_timer_slack(day_timer, conf.day_conf.timer_slack);
+    register_timer(day_timer, check_daytime, NULL);
     m_unbecome();
 }
 
-static void check_daytime(void) {
-    const time_t t = time(NULL);
+static void check_daytime(UNUSED void *userdata) {
+    const time_t t = clock_now();
     const enum day_states old_daytime = state.day_time;
     const int old_in_event = state.in_event;
     const enum day_events old_next_event = state.next_event; 
+    const bool sync_temp = should_sync_temp(&t);
     
     /*
      * get_gamma_events will always poll today events. It should not be necessary,
@@ -184,18 +198,43 @@ static void check_daytime(void) {
     /**                                 **/
     
     /*
-     * Forcefully set correct gamma every time
-     * to avoid any possible sync issue
-     * between time of day and gamma (eg after long suspend).
+     * Only request gamma temp when something changed,
+     * or when current temp is not the expected one;
+     * forcefully set it after resume or a wall clock jump
+     * to avoid any possible sync issue between time of day and gamma.
      */
     if (!conf.gamma_conf.disabled) {
         temp_req.temp.new = conf.gamma_conf.temp[state.day_time];
-        M_PUB(&temp_req);
+        if (sync_temp || old_daytime != state.day_time || old_in_event != state.in_event || 
+            old_next_event != state.next_event || state.current_temp != temp_req.temp.new) {
+            
+            M_PUB(&temp_req);
+        } else {
+            DEBUG("Gamma temp already in sync.\n");
+        }
     }
 
     const time_t next = state.day_events[state.next_event] + conf.day_conf.events_os[state.next_event] + state.event_time_range;
     INFO("Next alarm due to: %s", ctime(&next));
-    set_timeout(next - t, 0, day_fd, 0);
+    next_alarm = next;
+    set_timeout(next - t, 0, day_timer, 0);
+}
+
+/*
+ * Whether gamma temp must be requested even if nothing changed:
+ * first check, after resume, or when the alarm fired way off its expected time,
+ * ie: wall clock jumped.
+ */
+static bool should_sync_temp(const time_t *now) {
+    if (next_alarm == 0) {
+        return true;
+    }
+    const time_t max_delay = conf.day_conf.timer_slack[state.ac_state] + DAYTIME_CLOCK_JUMP_SEC;
+    if (labs(*now - next_alarm) > max_delay) {
+        DEBUG("Wall clock jump detected.\n");
+        return true;
+    }
+    return false;
 }
 
 /*
@@ -308,7 +347,8 @@ static void check_state(const time_t *now) {
 static void reset_daytime(void) {
     /* Updated sunrise/sunset times for new location */
     state.day_events[SUNSET] = 0; // to force get_next_events to recheck sunrise and sunset for today
-    set_timeout(0, 1, day_fd, 0);
+    next_alarm = 0;
+    set_timeout(0, 1, day_timer, 0);
 }
 
 static int get_event(sd_bus *bus, const char *path, const char *interface, const char *property,
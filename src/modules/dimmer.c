@@ -32,6 +32,7 @@ API(Dimmer, conf_dimmer_vtable, conf.dim_conf);
 MODULE_WITH_PAUSE("DIMMER");
 
 static void init(void) {
+    PROFILE_FUNC();
     M_SUB(UPOWER_UPD);
     M_SUB(INHIBIT_UPD);
     M_SUB(SUSPEND_UPD);
@@ -15,6 +15,7 @@ extern void dimmer_publish_bl_req(const double pct, enum dim_trans trans);
 extern void set_dpms(bool enable);
 
 static void init(void) {
+    PROFILE_FUNC();
     display_req.display.no_backlight = true;
     M_SUB(DISPLAY_REQ);
     
@@ -22,6 +22,7 @@ API(Dpms, conf_dpms_vtable, conf.dpms_conf);
 MODULE_WITH_PAUSE("DPMS");
 
 static void init(void) {
+    PROFILE_FUNC();
     M_SUB(UPOWER_UPD);
     M_SUB(INHIBIT_UPD);
     M_SUB(SUSPEND_UPD);
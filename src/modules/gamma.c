@@ -1,33 +1,87 @@
 #include "interface.h"
+#include "my_math.h"
 #include "utils.h"
 
 #define GAMMA_LONG_TRANS_TIMEOUT 10         // 10s between each step with slow transitioning
+#define SOLAR_ELEV_NIGHT        -6.0        // sun elevation (degrees) below which night temp is used (civil twilight)
+#define SOLAR_ELEV_DAY          6.0         // sun elevation (degrees) above which day temp is used
+#define SOLAR_SLOT_SEC          (5 * 60)    // solar elevation table resolution
+#define SOLAR_SPAN_SEC          (2 * 86400) // solar elevation table covers today and tomorrow
+#define SOLAR_SLOTS             (SOLAR_SPAN_SEC / SOLAR_SLOT_SEC + 1)
+#define SOLAR_SCAN_SEC          60          // resolution used to look for next solar temperature change
+
+/*
+ * A Gamma.Set request. Each target (see gamma_target_t) queues its own requests:
+ * at most one is in flight per target, and only the latest one waits for it, replacing older ones.
+ */
+typedef struct {
+    int temp;
+    int smooth;
+    int step;
+    int timeout;
+    bool long_trans;
+} gamma_set_t;
+
+/* A Gamma.Set destination: main display first, then conf outputs */
+typedef struct {
+    const char *display;
+    const char *env;
+    int offset;                     // temperature offset from requested temp
+    int initial_temp;               // temperature to be restored on exit
+    bool in_flight, queued;
+    gamma_set_t inflight_set, queued_set;
+    bus_args set_args;              // async Gamma.Set args: they need a static lifetime
+} gamma_target_t;
 
 static void receive_waiting_daytime(const msg_t *const msg, UNUSED const void* userdata);
 static void receive_paused(const msg_t *const msg, UNUSED const void* userdata);
 static void publish_temp_upd(int temp, int smooth, int step, int timeout);
 static int parse_bus_reply(sd_bus_message *reply, const char *member, void *userdata);
 static void set_temp(int temp, const time_t *now, int smooth, int step, int timeout);
-static void ambient_callback(bool smooth, double new);
+static int add_target(const char *display, const char *env, int offset);
+static int parse_set_reply(sd_bus_message *reply, const char *member, void *userdata);
+static void queue_gamma_set(gamma_target_t *t, const gamma_set_t *req);
+static int send_gamma_set(gamma_target_t *t, const gamma_set_t *req, bool async);
+static void on_gamma_set(const gamma_target_t *t, const gamma_set_t *req, int r, int ok);
+static void ambient_callback(bool smooth, double new, bool force);
+static void apply_ambient_temp(int temp);
+static void on_ambient_timer(UNUSED void *userdata);
 static void on_new_next_dayevt(void);
 static void on_daytime_req(void);
 static void on_ambgamma_req(ambgamma_upd *up);
 static void interface_callback(temp_upd *req);
 static int on_temp_changed(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
 static void pause_mod(bool pause, enum mod_pause reason);
+static bool solar_mode(void);
+static void build_solar_table(time_t now);
+static int get_solar_temp(time_t t);
+static void on_solar_timer(UNUSED void *userdata);
+static void schedule_solar_now(void);
 static int set_gamma(sd_bus *bus, const char *path, const char *interface, const char *property,
                      sd_bus_message *value, void *userdata, sd_bus_error *error);
 static int set_ambgamma(sd_bus *bus, const char *path, const char *interface, const char *property,
                  sd_bus_message *value, void *userdata, sd_bus_error *error);
+static int set_solar_step(sd_bus *bus, const char *path, const char *interface, const char *property,
+                 sd_bus_message *value, void *userdata, sd_bus_error *error);
 static int method_toggle_gamma(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
 
-static int initial_temp;
+static gamma_target_t targets[MAX_GAMMA_OUTPUTS + 1];
+static int num_targets;
 static sd_bus_slot *slot;
 static bool long_transitioning, should_sync_temp;
 static const self_t *daytime_ref;
+static int solar_timer = -1;
+static int ambient_timer = -1;
+static int ambient_temp = -1;               // last ambient temp sent; -1 to force next one
+static int pending_ambient_temp;            // latest ambient temp delayed by ambient_interval
+static time_t last_ambient_set;
+static time_t solar_start;                  // local midnight solar_elev table starts from; 0 if invalid
+static double solar_elev[SOLAR_SLOTS];      // sun elevation every SOLAR_SLOT_SEC
 static const sd_bus_vtable conf_gamma_vtable[] = {
     SD_BUS_VTABLE_START(0),
     SD_BUS_WRITABLE_PROPERTY("AmbientGamma", "b", NULL, set_ambgamma, offsetof(gamma_conf_t, ambient_gamma), 0),
+    SD_BUS_WRITABLE_PROPERTY("AmbientDeadband", "i", NULL, NULL, offsetof(gamma_conf_t, ambient_deadband), 0),
+    SD_BUS_WRITABLE_PROPERTY("AmbientInterval", "i", NULL, NULL, offsetof(gamma_conf_t, ambient_interval), 0),
     SD_BUS_WRITABLE_PROPERTY("NoSmooth", "b", NULL, NULL, offsetof(gamma_conf_t, no_smooth), 0),
     SD_BUS_WRITABLE_PROPERTY("TransStep", "i", NULL, NULL, offsetof(gamma_conf_t, trans_step), 0),
     SD_BUS_WRITABLE_PROPERTY("TransDuration", "i", NULL, NULL, offsetof(gamma_conf_t, trans_timeout), 0),
@@ -35,6 +89,8 @@ static const sd_bus_vtable conf_gamma_vtable[] = {
     SD_BUS_WRITABLE_PROPERTY("NightTemp", "i", NULL, set_gamma, offsetof(gamma_conf_t, temp[NIGHT]), 0),
     SD_BUS_WRITABLE_PROPERTY("LongTransition", "b", NULL, NULL, offsetof(gamma_conf_t, long_transition), 0),
     SD_BUS_WRITABLE_PROPERTY("RestoreOnExit", "b", NULL, NULL, offsetof(gamma_conf_t, restore), 0),
+    SD_BUS_PROPERTY("SolarTransition", "b", NULL, offsetof(gamma_conf_t, solar_transition), SD_BUS_VTABLE_PROPERTY_CONST),
+    SD_BUS_WRITABLE_PROPERTY("SolarStep", "i", NULL, set_solar_step, offsetof(gamma_conf_t, solar_step), 0),
     SD_BUS_METHOD("Toggle", NULL, NULL, method_toggle_gamma, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_VTABLE_END
 };
@@ -46,6 +102,7 @@ API(Gamma, conf_gamma_vtable, conf.gamma_conf);
 MODULE_WITH_PAUSE("GAMMA");
 
 static void init(void) {
+    PROFILE_FUNC();
     m_ref("DAYTIME", &daytime_ref);
     M_SUB(BL_UPD);
     M_SUB(TEMP_REQ);
@@ -53,15 +110,20 @@ static void init(void) {
     M_SUB(DAYTIME_UPD);
     M_SUB(NEXT_DAYEVT_UPD);
     M_SUB(SUSPEND_UPD);
+    M_SUB(LOC_UPD);
     m_become(waiting_daytime);
     
-    // Store current temperature to later restore it if requested
-    SYSBUS_ARG_REPLY(args, parse_bus_reply, &initial_temp, CLIGHTD_SERVICE, "/org/clightd/clightd/Gamma", "org.clightd.clightd.Gamma", "Get");
-    if (call(&args, "ss", fetch_display(), fetch_env()) < 0) {
+    if (add_target(fetch_display(), fetch_env(), 0) < 0) {
         // We are on an unsupported wayland compositor; kill ourself immediately without further message processing
         WARN("Failed to init. Killing module.\n");
         module_deregister((self_t **)&self());
     } else {
+        for (int i = 0; i < conf.gamma_conf.num_outputs; i++) {
+            const gamma_output_t *o = &conf.gamma_conf.outputs[i];
+            if (add_target(o->display, o->env ? o->env : fetch_env(), o->offset) < 0) {
+                WARN("Failed to init '%s' gamma output. Ignoring it.\n", o->display);
+            }
+        }
         init_Gamma_api();
     }
 }
@@ -78,6 +140,16 @@ static void destroy(void) {
     if (slot) {
         slot = sd_bus_slot_unref(slot);
     }
+    if (solar_timer >= 0) {
+        stop_timer(solar_timer);
+    }
+    if (ambient_timer >= 0) {
+        stop_timer(ambient_timer);
+    }
+    for (int i = 0; i < conf.gamma_conf.num_outputs; i++) {
+        free(conf.gamma_conf.outputs[i].display);
+        free(conf.gamma_conf.outputs[i].env);
+    }
     deinit_Gamma_api();
 }
 
@@ -97,6 +169,15 @@ static void receive_waiting_daytime(const msg_t *const msg, UNUSED const void* u
             
             SYSBUS_ARG(args, CLIGHTD_SERVICE, "/org/clightd/clightd/Gamma", "org.clightd.clightd.Gamma", "Changed");
             add_match(&args, &slot, on_temp_changed);
+            
+            ambient_timer = start_timer(0, 0);
+            register_timer(ambient_timer, on_ambient_timer, NULL);
+            
+            if (conf.gamma_conf.solar_transition) {
+                solar_timer = start_timer(0, 0);
+                register_timer(solar_timer, on_solar_timer, NULL);
+                schedule_solar_now();
+            }
         }
         break;
     }
@@ -109,7 +190,7 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
     switch (MSG_TYPE()) {
     case BL_UPD: {
         bl_upd *up = (bl_upd *)MSG_DATA();
-        ambient_callback(up->smooth, up->new);
+        ambient_callback(up->smooth, up->new, false);
         break;
     }
     case TEMP_REQ: {
@@ -133,12 +214,23 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
     case NEXT_DAYEVT_UPD:
         on_new_next_dayevt();
         break;
+    case LOC_UPD:
+        /* Invalidate solar elevation table */
+        solar_start = 0;
+        schedule_solar_now();
+        break;
     case SUSPEND_UPD:
         pause_mod(state.suspended, SUSPEND);
         break;
     case SYSTEM_UPD:
-        if (msg->ps_msg->type == LOOP_STOPPED && initial_temp && conf.gamma_conf.restore) {
-            set_temp(initial_temp, NULL, false, 0, 0);
+        if (msg->ps_msg->type == LOOP_STOPPED && conf.gamma_conf.restore) {
+            /* Loop is stopped: no async reply would ever be dispatched */
+            for (int i = 0; i < num_targets; i++) {
+                if (targets[i].initial_temp) {
+                    const gamma_set_t req = { targets[i].initial_temp };
+                    send_gamma_set(&targets[i], &req, false);
+                }
+            }
         }
         break;
     default:
@@ -164,6 +256,9 @@ static void receive_paused(const msg_t *const msg, UNUSED const void* userdata)
     case NEXT_DAYEVT_UPD:
         on_new_next_dayevt();
         break;
+    case LOC_UPD:
+        solar_start = 0;
+        break;
     case SUSPEND_UPD:
         pause_mod(state.suspended, SUSPEND);
         break;
@@ -190,9 +285,38 @@ static int parse_bus_reply(sd_bus_message *reply, const char *member, void *user
     return sd_bus_message_read(reply, "b", userdata); 
 }
 
+/* Store current temperature of display to later restore it if requested */
+static int add_target(const char *display, const char *env, int offset) {
+    gamma_target_t *t = &targets[num_targets];
+    SYSBUS_ARG_REPLY(args, parse_bus_reply, &t->initial_temp, CLIGHTD_SERVICE, "/org/clightd/clightd/Gamma", "org.clightd.clightd.Gamma", "Get");
+    int r = call(&args, "ss", display, env);
+    if (r == 0) {
+        t->display = display;
+        t->env = env;
+        t->offset = offset;
+        num_targets++;
+    }
+    return r;
+}
+
+/* Async Gamma.Set reply (or error): send latest queued request, if any */
+static int parse_set_reply(sd_bus_message *reply, UNUSED const char *member, void *userdata) {
+    gamma_target_t *t = (gamma_target_t *)userdata;
+    int ok = 0;
+    int r = sd_bus_message_is_method_error(reply, NULL) ? -1 : sd_bus_message_read(reply, "b", &ok);
+    t->in_flight = false;
+    if (self() != NULL) {
+        on_gamma_set(t, &t->inflight_set, -(r < 0), ok);
+        if (t->queued) {
+            t->queued = false;
+            send_gamma_set(t, &t->queued_set, true);
+        }
+    }
+    return 0;
+}
+
 static void set_temp(int temp, const time_t *now, int smooth, int step, int timeout) {
-    int ok;
-    SYSBUS_ARG_REPLY(args, parse_bus_reply, &ok, CLIGHTD_SERVICE, "/org/clightd/clightd/Gamma", "org.clightd.clightd.Gamma", "Set");
+    bool long_trans = false;
     
     /* Compute long transition steps and timeouts (if outside of event, fallback to normal transition) */
     if (conf.gamma_conf.long_transition && now && state.in_event) {
@@ -209,30 +333,85 @@ static void set_temp(int temp, const time_t *now, int smooth, int step, int time
         step = abs(conf.gamma_conf.temp[DAY] - conf.gamma_conf.temp[NIGHT]);
         /* Compute each step size with a gamma_trans_timeout of 10s */
         step /= (((double)timeout) / GAMMA_LONG_TRANS_TIMEOUT);
-        /* force gamma_trans_timeout to 10s (in ms) */
-        timeout = GAMMA_LONG_TRANS_TIMEOUT * 1000;
+        /* force gamma_trans_timeout to 10s (in ms), as seen by our clock */
+        timeout = clock_real_ms(GAMMA_LONG_TRANS_TIMEOUT * 1000);
         
-        long_transitioning = true;
+        long_trans = true;
+    }
+    long_transitioning = long_trans;
+    
+    /* Fan out to every output: Sets go out concurrently */
+    const gamma_set_t req = { temp, smooth, step, timeout, long_trans };
+    for (int i = 0; i < num_targets; i++) {
+        queue_gamma_set(&targets[i], &req);
+    }
+}
+
+static void queue_gamma_set(gamma_target_t *t, const gamma_set_t *req) {
+    gamma_set_t out = *req;
+    out.temp = clamp(req->temp + t->offset, 10000, 1000);
+    if (t->in_flight) {
+        /* Latest request wins: it supersedes any other queued one */
+        t->queued_set = out;
+        t->queued = true;
+        DEBUG("Gamma set in flight on '%s'; queued %d gamma temp.\n", t->display, out.temp);
     } else {
-        long_transitioning = false;
+        send_gamma_set(t, &out, true);
     }
-        
-    int r = call(&args, "ssi(buu)", fetch_display(), fetch_env(), temp, smooth, step, timeout);    
+}
+
+static int send_gamma_set(gamma_target_t *t, const gamma_set_t *req, bool async) {
+    int ok = 0;
+    if (!async) {
+        SYSBUS_ARG_REPLY(args, parse_bus_reply, &ok, CLIGHTD_SERVICE, "/org/clightd/clightd/Gamma", "org.clightd.clightd.Gamma", "Set");
+        int r = call(&args, "ssi(buu)", t->display, t->env, req->temp, req->smooth, req->step, req->timeout);
+        on_gamma_set(t, req, r, ok);
+        return r;
+    }
+    
+    if (!t->set_args.member) {
+        SYSBUS_ARG_REPLY(args, parse_set_reply, t, CLIGHTD_SERVICE, "/org/clightd/clightd/Gamma", "org.clightd.clightd.Gamma", "Set");
+        args.async = true;
+        /* Error replies complete the in flight set too */
+        args.async_errors = true;
+        t->set_args = args;
+    }
+    t->inflight_set = *req;
+    int r = call(&t->set_args, "ssi(buu)", t->display, t->env, req->temp, req->smooth, req->step, req->timeout);
+    if (r == 0) {
+        t->in_flight = true;
+    } else {
+        on_gamma_set(t, req, r, false);
+    }
+    return r;
+}
+
+static void on_gamma_set(const gamma_target_t *t, const gamma_set_t *req, int r, int ok) {
+    if (t != &targets[0]) {
+        /* Additional outputs: TEMP_UPD only tracks main display */
+        if (!r && ok) {
+            DEBUG("%d gamma temp set on '%s'.\n", req->temp, t->display);
+        } else {
+            WARN("Failed to set gamma temperature on '%s'.\n", t->display);
+        }
+        return;
+    }
+    
     if (!r && ok) {
-        if (!long_transitioning && conf.gamma_conf.no_smooth) {
-            INFO("%d gamma temp set.\n", temp);
+        if (!req->long_trans && conf.gamma_conf.no_smooth) {
+            INFO("%d gamma temp set.\n", req->temp);
             // we do not publish TEMP_UPD here as it will be published by on_temp_changed()
         } else {
             // publish target value and params for smooth temp change
-            publish_temp_upd(temp, smooth, step, timeout);
-            INFO("%s transition to %d gamma temp.\n", long_transitioning ? "Long" : "Normal", temp);
+            publish_temp_upd(req->temp, req->smooth, req->step, req->timeout);
+            INFO("%s transition to %d gamma temp.\n", req->long_trans ? "Long" : "Normal", req->temp);
         }
     } else {
         WARN("Failed to set gamma temperature.\n");
     }
 }
 
-static void ambient_callback(bool smooth, double new) {
+static void ambient_callback(bool smooth, double new, bool force) {
     if (conf.gamma_conf.ambient_gamma && !state.display_state) {
         /* Only account for target backlight changes, ie: not step ones */
         if (smooth || conf.bl_conf.smooth.no_smooth) {
@@ -244,13 +423,44 @@ static void ambient_callback(bool smooth, double new) {
             const int min_temp = conf.gamma_conf.temp[NIGHT] < conf.gamma_conf.temp[DAY] ? 
                                 conf.gamma_conf.temp[NIGHT] : conf.gamma_conf.temp[DAY]; 
             
-            const int ambient_temp = (diff * new) + min_temp;
-            set_temp(ambient_temp, NULL, !conf.gamma_conf.no_smooth, 
-                    conf.gamma_conf.trans_step, conf.gamma_conf.trans_timeout); // force refresh (passing NULL time_t*)
+            const int new_temp = (diff * new) + min_temp;
+            if (force) {
+                ambient_temp = -1;
+            }
+            
+            /* Skip small changes */
+            if (ambient_temp != -1 && abs(new_temp - ambient_temp) < conf.gamma_conf.ambient_deadband) {
+                DEBUG("Ambient gamma temp %d within deadband.\n", new_temp);
+                return;
+            }
+            
+            /* Rate limit sets: latest temp is applied once ambient_interval is elapsed */
+            const time_t elapsed = clock_now() - last_ambient_set;
+            if (ambient_temp != -1 && elapsed < conf.gamma_conf.ambient_interval) {
+                DEBUG("Delaying ambient gamma temp %d.\n", new_temp);
+                pending_ambient_temp = new_temp;
+                set_timeout(conf.gamma_conf.ambient_interval - elapsed, 0, ambient_timer, 0);
+                return;
+            }
+            apply_ambient_temp(new_temp);
         }
     }
 }
 
+static void apply_ambient_temp(int temp) {
+    set_timeout(0, 0, ambient_timer, 0);
+    ambient_temp = temp;
+    last_ambient_set = clock_now();
+    set_temp(temp, NULL, !conf.gamma_conf.no_smooth, 
+             conf.gamma_conf.trans_step, conf.gamma_conf.trans_timeout); // force refresh (passing NULL time_t*)
+}
+
+static void on_ambient_timer(UNUSED void *userdata) {
+    if (conf.gamma_conf.ambient_gamma && !state.display_state) {
+        apply_ambient_temp(pending_ambient_temp);
+    }
+}
+
 static void on_new_next_dayevt(void) {    
     /* Properly reset long_transitioning when we change target event */
     if (long_transitioning) {
@@ -267,7 +477,7 @@ static void on_daytime_req(void) {
      */
     static time_t last_t;
     
-    const time_t t = time(NULL);
+    const time_t t = clock_now();
     struct tm tm_now, tm_old;
     localtime_r(&t, &tm_now);
     localtime_r(&last_t, &tm_old);
@@ -281,7 +491,10 @@ static void on_daytime_req(void) {
         
     last_t = t;
         
-    if (!long_transitioning && !conf.gamma_conf.ambient_gamma) {
+    if (solar_mode()) {
+        /* Temperature is driven by solar_timer */
+        schedule_solar_now();
+    } else if (!long_transitioning && !conf.gamma_conf.ambient_gamma) {
         set_temp(conf.gamma_conf.temp[state.day_time], &t, !conf.gamma_conf.no_smooth, 
                  conf.gamma_conf.trans_step, conf.gamma_conf.trans_timeout);
     }
@@ -289,21 +502,26 @@ static void on_daytime_req(void) {
 
 static void on_ambgamma_req(ambgamma_upd *up) {
     conf.gamma_conf.ambient_gamma = up->new;
-    if (!up->new) {
+    if (!up->new && solar_mode()) {
+        schedule_solar_now();
+    } else if (!up->new) {
         // restore correct screen temp -> force refresh (passing NULL time_t*)
         // Note that long_transitioning cannot be true because we were in ambient gamma mode
         set_temp(conf.gamma_conf.temp[state.day_time], NULL, !conf.gamma_conf.no_smooth, 
                  conf.gamma_conf.trans_step, conf.gamma_conf.trans_timeout);
     } else {
         // Immediately set correct temp for current bl pct
-        ambient_callback(true, state.current_bl_pct);
+        ambient_callback(true, state.current_bl_pct, true);
     }
 }
 
 static void interface_callback(temp_upd *req) {
     // req->new was already validated. Store it.
     conf.gamma_conf.temp[req->daytime] = req->new;
-    if (!conf.gamma_conf.ambient_gamma && req->daytime == state.day_time) {
+    if (solar_mode()) {
+        // Recompute current temp given new temperature max/min values
+        schedule_solar_now();
+    } else if (!conf.gamma_conf.ambient_gamma && req->daytime == state.day_time) {
         /*
          * When not in ambient_gamma mode, 
          * if the requested daytime matches the current one,
@@ -315,7 +533,7 @@ static void interface_callback(temp_upd *req) {
          * Immediately set correct temp for current bl pct 
          * (given new temperature max/min values
          */
-        ambient_callback(true, state.current_bl_pct);
+        ambient_callback(true, state.current_bl_pct, true);
     }
 }
 
@@ -337,8 +555,16 @@ static void pause_mod(bool pause, enum mod_pause reason) {
     if (CHECK_PAUSE(pause, reason)) {
         if (pause) {
             m_become(paused);
+            if (solar_timer >= 0) {
+                deregister_timer(solar_timer);
+            }
+            deregister_timer(ambient_timer);
         } else {
             m_unbecome();
+            if (solar_timer >= 0) {
+                register_timer(solar_timer, on_solar_timer, NULL);
+            }
+            register_timer(ambient_timer, on_ambient_timer, NULL);
             if (should_sync_temp) {
                 should_sync_temp = false;
                 on_daytime_req();
@@ -347,6 +573,83 @@ static void pause_mod(bool pause, enum mod_pause reason) {
     }
 }
 
+static bool solar_mode(void) {
+    return solar_timer >= 0 && !conf.gamma_conf.ambient_gamma && 
+           state.current_loc.lat != LAT_UNDEFINED && state.current_loc.lon != LON_UNDEFINED;
+}
+
+/* Sample sun elevation for today and tomorrow, starting from local midnight */
+static void build_solar_table(time_t now) {
+    struct tm tm;
+    localtime_r(&now, &tm);
+    tm.tm_hour = 0;
+    tm.tm_min = 0;
+    tm.tm_sec = 0;
+    solar_start = mktime(&tm);
+    for (int i = 0; i < SOLAR_SLOTS; i++) {
+        solar_elev[i] = calculate_sun_elevation(state.current_loc.lat, state.current_loc.lon, 
+                                                solar_start + (time_t)i * SOLAR_SLOT_SEC);
+    }
+    DEBUG("Solar elevation table computed.\n");
+}
+
+/* 
+ * Temperature for sun elevation at t, linearly interpolated from solar_elev table,
+ * quantized to solar_step kelvin starting from night temp.
+ */
+static int get_solar_temp(time_t t) {
+    const time_t offset = t - solar_start;
+    const double pos = (double)offset / SOLAR_SLOT_SEC;
+    const int slot = pos;
+    const double elev = solar_elev[slot] + (solar_elev[slot + 1] - solar_elev[slot]) * (pos - slot);
+
+    const double frac = clamp((elev - SOLAR_ELEV_NIGHT) / (SOLAR_ELEV_DAY - SOLAR_ELEV_NIGHT), 1.0, 0.0);
+    const int night = conf.gamma_conf.temp[NIGHT];
+    const int day = conf.gamma_conf.temp[DAY];
+    if (frac == 1.0) {
+        return day;
+    }
+    const int step = conf.gamma_conf.solar_step;
+    const int temp = night + (int)round((day - night) * frac / step) * step;
+    /* Last step may overshoot day temp */
+    return night < day ? (temp > day ? day : temp) : (temp < day ? day : temp);
+}
+
+static void on_solar_timer(UNUSED void *userdata) {
+    if (!solar_mode()) {
+        return;
+    }
+    
+    const time_t now = clock_now();
+    if (solar_start == 0 || now < solar_start || now - solar_start >= 86400) {
+        build_solar_table(now);
+    }
+    
+    const int temp = get_solar_temp(now);
+    if (temp != state.current_temp) {
+        set_temp(temp, NULL, !conf.gamma_conf.no_smooth, 
+                 conf.gamma_conf.trans_step, conf.gamma_conf.trans_timeout);
+    }
+    
+    /* Wake up when quantized temperature changes, or at most at next local midnight to refresh the table */
+    const time_t end = solar_start + SOLAR_SPAN_SEC - SOLAR_SLOT_SEC;
+    time_t next = now + SOLAR_SCAN_SEC;
+    while (next < end && get_solar_temp(next) == temp) {
+        next += SOLAR_SCAN_SEC;
+    }
+    if (next >= end) {
+        next = solar_start + 86400;
+    }
+    DEBUG("Next solar temperature check in %ld s.\n", next - now);
+    set_timeout(next - now, 0, solar_timer, 0);
+}
+
+static void schedule_solar_now(void) {
+    if (solar_mode()) {
+        set_timeout(0, 1, solar_timer, 0);
+    }
+}
+
 static int set_gamma(sd_bus *bus, const char *path, const char *interface, const char *property,
                      sd_bus_message *value, void *userdata, sd_bus_error *error) {
     VALIDATE_PARAMS(value, "i", &temp_req.temp.new);
@@ -366,6 +669,21 @@ static int set_ambgamma(sd_bus *bus, const char *path, const char *interface, co
     return r;
 }
 
+/* solar_step is a divisor: same check as conf one */
+static int set_solar_step(sd_bus *bus, const char *path, const char *interface, const char *property,
+                 sd_bus_message *value, void *userdata, sd_bus_error *error) {
+    int step;
+    VALIDATE_PARAMS(value, "i", &step);
+    
+    if (step <= 0) {
+        sd_bus_error_setf(error, SD_BUS_ERROR_INVALID_ARGS, "SolarStep must be > 0.");
+        return -EINVAL;
+    }
+    conf.gamma_conf.solar_step = step;
+    schedule_solar_now();
+    return r;
+}
+
 static int method_toggle_gamma(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
     static bool is_toggled = false;
     const int new_temp = !is_toggled ? conf.gamma_conf.temp[!state.day_time] : conf.gamma_conf.temp[state.day_time];
@@ -14,6 +14,7 @@ API(Inhibit, conf_inh_vtable, conf.inh_conf);
 MODULE("INHIBIT");
 
 static void init(void) {
+    PROFILE_FUNC();
     M_SUB(INHIBIT_REQ);
     
     init_Inhibit_api();
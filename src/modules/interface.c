@@ -3,6 +3,9 @@
 #include "my_math.h"
 #include "config.h"
 #include "utils.h"
+#include "budget.h"
+#include "statepage.h"
+#include "metrics.h"
 
 #define CLIGHT_COOKIE -1
 #define CLIGHT_INH_KEY "LockClight"
@@ -33,7 +36,28 @@ static int method_capture(sd_bus_message *m, void *userdata, sd_bus_error *ret_e
 static int method_load(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
 static int method_unload(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
 static int method_pause(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_get_state_page(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
 static int method_store_conf(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static void on_conf_stored(int error, void *userdata);
+static int method_reload_conf(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int method_apply_conf(sd_bus_message *m, void *userdata, sd_bus_error *ret_error);
+static int get_timer_wakeups(sd_bus *bus, const char *path, const char *interface, const char *property,
+                             sd_bus_message *reply, void *userdata, sd_bus_error *error);
+static int get_module_budgets(sd_bus *bus, const char *path, const char *interface, const char *property,
+                              sd_bus_message *reply, void *userdata, sd_bus_error *error);
+
+enum conf_key_type { KEY_BOOL, KEY_INT, KEY_DOUBLE, KEY_STRING, KEY_EVENT, KEY_CURVE, KEY_LOC };
+
+typedef struct {
+    const char *key;                        // fully qualified Conf property name, eg: "Backlight.AcDayTimeout"
+    enum conf_key_type type;
+    size_t offset;                          // offset in conf_t
+} conf_key_t;
+
+#define CONF_KEY(k, t, f)   { k, t, offsetof(conf_t, f) }
+
+static const conf_key_t *find_conf_key(const char *key);
+static int read_conf_key(sd_bus_message *m, const conf_key_t *k, conf_t *c);
 
 static const char object_path[] = "/org/clight/clight";
 static const char bus_interface[] = "org.clight.clight";
@@ -62,6 +86,8 @@ static const sd_bus_vtable clight_vtable[] = {
     SD_BUS_PROPERTY("Temp", "i", NULL, offsetof(state_t, current_temp), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
     SD_BUS_PROPERTY("Location", "(dd)", get_location, offsetof(state_t, current_loc), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
     SD_BUS_PROPERTY("Suspended", "b", NULL, offsetof(state_t, suspended), SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+    SD_BUS_PROPERTY("TimerWakeups", "d", get_timer_wakeups, 0, 0),
+    SD_BUS_PROPERTY("ModuleBudgets", "a(sutttdb)", get_module_budgets, 0, 0),
     SD_BUS_METHOD("Capture", "bb", NULL, method_capture, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD("Inhibit", "b", NULL, method_clight_inhibit, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD("IncBl", "d", NULL, method_clight_changebl, SD_BUS_VTABLE_UNPRIVILEGED),
@@ -69,6 +95,7 @@ static const sd_bus_vtable clight_vtable[] = {
     SD_BUS_METHOD("Load", "s", NULL, method_load, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD("Unload", "s", NULL, method_unload, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD("Pause", "b", NULL, method_pause, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("GetStatePage", NULL, "h", method_get_state_page, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_VTABLE_END
 };
 
@@ -77,9 +104,80 @@ static const sd_bus_vtable conf_vtable[] = {
     SD_BUS_WRITABLE_PROPERTY("Verbose", "b", NULL, NULL, offsetof(conf_t, verbose), 0),
     SD_BUS_WRITABLE_PROPERTY("ResumeDelay", "i", NULL, NULL, offsetof(conf_t, resumedelay), 0),
     SD_BUS_METHOD("Store", NULL, NULL, method_store_conf, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("Reload", NULL, NULL, method_reload_conf, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("Apply", "a{sv}", NULL, method_apply_conf, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_VTABLE_END
 };
 
+static const char *const conf_key_signatures[] = { "b", "i", "d", "s", "s", "ad", "(dd)" };
+
+/* Conf properties that can be set through Conf.Apply */
+static const conf_key_t conf_keys[] = {
+    CONF_KEY("Verbose", KEY_BOOL, verbose),
+    CONF_KEY("ResumeDelay", KEY_INT, resumedelay),
+    CONF_KEY("Backlight.NoAutoCalib", KEY_BOOL, bl_conf.no_auto_calib),
+    CONF_KEY("Backlight.InhibitOnLidClosed", KEY_BOOL, bl_conf.pause_on_lid_closed),
+    CONF_KEY("Backlight.CaptureOnLidOpened", KEY_BOOL, bl_conf.capture_on_lid_opened),
+    CONF_KEY("Backlight.NoSmooth", KEY_BOOL, bl_conf.smooth.no_smooth),
+    CONF_KEY("Backlight.TransStep", KEY_DOUBLE, bl_conf.smooth.trans_step),
+    CONF_KEY("Backlight.TransDuration", KEY_INT, bl_conf.smooth.trans_timeout),
+    CONF_KEY("Backlight.TransFixed", KEY_INT, bl_conf.smooth.trans_fixed),
+    CONF_KEY("Backlight.ShutterThreshold", KEY_DOUBLE, bl_conf.shutter_threshold),
+    CONF_KEY("Backlight.AcDayTimeout", KEY_INT, bl_conf.timeout[ON_AC][DAY]),
+    CONF_KEY("Backlight.AcNightTimeout", KEY_INT, bl_conf.timeout[ON_AC][NIGHT]),
+    CONF_KEY("Backlight.AcEventTimeout", KEY_INT, bl_conf.timeout[ON_AC][IN_EVENT]),
+    CONF_KEY("Backlight.BattDayTimeout", KEY_INT, bl_conf.timeout[ON_BATTERY][DAY]),
+    CONF_KEY("Backlight.BattNightTimeout", KEY_INT, bl_conf.timeout[ON_BATTERY][NIGHT]),
+    CONF_KEY("Backlight.BattEventTimeout", KEY_INT, bl_conf.timeout[ON_BATTERY][IN_EVENT]),
+    CONF_KEY("Backlight.RestoreOnExit", KEY_BOOL, bl_conf.restore),
+    CONF_KEY("Sensor.Device", KEY_STRING, sens_conf.dev_name),
+    CONF_KEY("Sensor.Settings", KEY_STRING, sens_conf.dev_opts),
+    CONF_KEY("Sensor.AcCaptures", KEY_INT, sens_conf.num_captures[ON_AC]),
+    CONF_KEY("Sensor.BattCaptures", KEY_INT, sens_conf.num_captures[ON_BATTERY]),
+    CONF_KEY("Sensor.AcPoints", KEY_CURVE, sens_conf.default_curve[ON_AC]),
+    CONF_KEY("Sensor.BattPoints", KEY_CURVE, sens_conf.default_curve[ON_BATTERY]),
+    CONF_KEY("Kbd.AcTimeout", KEY_INT, kbd_conf.timeout[ON_AC]),
+    CONF_KEY("Kbd.BattTimeout", KEY_INT, kbd_conf.timeout[ON_BATTERY]),
+    CONF_KEY("Kbd.AcPoints", KEY_CURVE, kbd_conf.curve[ON_AC]),
+    CONF_KEY("Kbd.BattPoints", KEY_CURVE, kbd_conf.curve[ON_BATTERY]),
+    CONF_KEY("Gamma.AmbientGamma", KEY_BOOL, gamma_conf.ambient_gamma),
+    CONF_KEY("Gamma.AmbientDeadband", KEY_INT, gamma_conf.ambient_deadband),
+    CONF_KEY("Gamma.AmbientInterval", KEY_INT, gamma_conf.ambient_interval),
+    CONF_KEY("Gamma.NoSmooth", KEY_BOOL, gamma_conf.no_smooth),
+    CONF_KEY("Gamma.TransStep", KEY_INT, gamma_conf.trans_step),
+    CONF_KEY("Gamma.TransDuration", KEY_INT, gamma_conf.trans_timeout),
+    CONF_KEY("Gamma.DayTemp", KEY_INT, gamma_conf.temp[DAY]),
+    CONF_KEY("Gamma.NightTemp", KEY_INT, gamma_conf.temp[NIGHT]),
+    CONF_KEY("Gamma.LongTransition", KEY_BOOL, gamma_conf.long_transition),
+    CONF_KEY("Gamma.RestoreOnExit", KEY_BOOL, gamma_conf.restore),
+    CONF_KEY("Gamma.SolarStep", KEY_INT, gamma_conf.solar_step),
+    CONF_KEY("Daytime.Sunrise", KEY_EVENT, day_conf.day_events[SUNRISE]),
+    CONF_KEY("Daytime.Sunset", KEY_EVENT, day_conf.day_events[SUNSET]),
+    CONF_KEY("Daytime.Location", KEY_LOC, day_conf.loc),
+    CONF_KEY("Daytime.EventDuration", KEY_INT, day_conf.event_duration),
+    CONF_KEY("Daytime.SunriseOffset", KEY_INT, day_conf.events_os[SUNRISE]),
+    CONF_KEY("Daytime.SunsetOffset", KEY_INT, day_conf.events_os[SUNSET]),
+    CONF_KEY("Dimmer.NoSmoothEnter", KEY_BOOL, dim_conf.smooth[ENTER].no_smooth),
+    CONF_KEY("Dimmer.NoSmoothExit", KEY_BOOL, dim_conf.smooth[EXIT].no_smooth),
+    CONF_KEY("Dimmer.DimmedPct", KEY_DOUBLE, dim_conf.dimmed_pct),
+    CONF_KEY("Dimmer.TransStepEnter", KEY_DOUBLE, dim_conf.smooth[ENTER].trans_step),
+    CONF_KEY("Dimmer.TransStepExit", KEY_DOUBLE, dim_conf.smooth[EXIT].trans_step),
+    CONF_KEY("Dimmer.TransDurationEnter", KEY_INT, dim_conf.smooth[ENTER].trans_timeout),
+    CONF_KEY("Dimmer.TransDurationExit", KEY_INT, dim_conf.smooth[EXIT].trans_timeout),
+    CONF_KEY("Dimmer.TransFixedEnter", KEY_INT, dim_conf.smooth[ENTER].trans_fixed),
+    CONF_KEY("Dimmer.TransFixedExit", KEY_INT, dim_conf.smooth[EXIT].trans_fixed),
+    CONF_KEY("Dimmer.AcTimeout", KEY_INT, dim_conf.timeout[ON_AC]),
+    CONF_KEY("Dimmer.BattTimeout", KEY_INT, dim_conf.timeout[ON_BATTERY]),
+    CONF_KEY("Dpms.AcTimeout", KEY_INT, dpms_conf.timeout[ON_AC]),
+    CONF_KEY("Dpms.BattTimeout", KEY_INT, dpms_conf.timeout[ON_BATTERY]),
+    CONF_KEY("Screen.Contrib", KEY_DOUBLE, screen_conf.contrib),
+    CONF_KEY("Screen.AcTimeout", KEY_INT, screen_conf.timeout[ON_AC]),
+    CONF_KEY("Screen.BattTimeout", KEY_INT, screen_conf.timeout[ON_BATTERY]),
+    CONF_KEY("Inhibit.InhibitDocked", KEY_BOOL, inh_conf.inhibit_docked),
+    CONF_KEY("Inhibit.InhibitPM", KEY_BOOL, inh_conf.inhibit_pm),
+    CONF_KEY("Inhibit.InhibitBL", KEY_BOOL, inh_conf.inhibit_bl),
+};
+
 static const sd_bus_vtable sc_vtable[] = {
     SD_BUS_VTABLE_START(0),
     SD_BUS_METHOD("Inhibit", "ss", "u", method_inhibit, SD_BUS_VTABLE_UNPRIVILEGED),
@@ -111,12 +209,14 @@ static sd_bus_slot *lock_slot;
 MODULE("INTERFACE");
 
 static void init(void) {
+    PROFILE_FUNC();
     const char conf_path[] = "/org/clight/clight/Conf";
     const char sc_path_full[] = "/org/freedesktop/ScreenSaver";
     const char sc_path[] = "/ScreenSaver";
     const char conf_interface[] = "org.clight.clight.Conf";
    
     userbus = get_user_bus();
+    state_page_init();
     
     /* Main State interface */
     int r = sd_bus_add_object_vtable(userbus,
@@ -226,6 +326,7 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
         // We just do not want to process it in default case
         break;
     default:
+        state_page_update();
         if (userbus) {
             DEBUG("Emitting '%s' property\n", msg->ps_msg->topic);
             sd_bus_emit_properties_changed(userbus, object_path, bus_interface, msg->ps_msg->topic, NULL);
@@ -246,6 +347,7 @@ static void destroy(void) {
         monbus = sd_bus_flush_close_unref(monbus);
     }
     map_free(lock_map);
+    state_page_destroy();
     bl_curve_message = sd_bus_message_unref(bl_curve_message);
     kbd_curve_message = sd_bus_message_unref(kbd_curve_message);
 }
@@ -405,6 +507,7 @@ static int create_inhibit(int *cookie, const char *key, const char *app_name, co
             DEBUG("New ScreenSaver inhibition held by '%s': '%s'. Cookie: %d.\n", l->app, l->reason, l->cookie);
             publish_inhibition(true, false);
             map_put(lock_map, key, l);
+            metrics_inhibit_locks(map_length(lock_map));
             
             if (map_length(lock_map) == 1) {
                 /* Start listening on NameOwnerChanged signals */
@@ -442,6 +545,7 @@ static int drop_inhibit(int *cookie, const char *key, bool force) {
             DEBUG("Dropped ScreenSaver inhibition held by '%s': '%s'. Cookie: %d.\n", l->app, l->reason, l->cookie);
             publish_inhibition(false, !strcmp(key, CLIGHT_INH_KEY)); // forcefully disable inhibition for Clight INTERFACE Inhibit "false"
             map_remove(lock_map, key);
+            metrics_inhibit_locks(map_length(lock_map));
             
             if (map_length(lock_map) == 0) {
                 /* Stop listening on NameOwnerChanged signals */
@@ -583,6 +687,16 @@ static int method_pause(sd_bus_message *m, void *userdata, sd_bus_error *ret_err
     return sd_bus_reply_method_return(m, NULL);
 }
 
+/* Hand out state page fd (sd-bus sends a dup of it): clients then read state without polling us */
+static int method_get_state_page(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    const int fd = state_page_fd();
+    if (fd == -1) {
+        sd_bus_error_set_errno(ret_error, ENODEV);
+        return -ENODEV;
+    }
+    return sd_bus_reply_method_return(m, "h", fd);
+}
+
 int get_curve(sd_bus *bus, const char *path, const char *interface, const char *property,
                      sd_bus_message *reply, void *userdata, sd_bus_error *error) {
     
@@ -640,6 +754,29 @@ int get_location(sd_bus *bus, const char *path, const char *interface, const cha
     return sd_bus_message_append(reply, "(dd)", l->lat, l->lon);
 }
 
+/* Average timer wakeups per hour; useful to compare timer_slack settings, eg: with powertop */
+static int get_timer_wakeups(sd_bus *bus, const char *path, const char *interface, const char *property,
+                             sd_bus_message *reply, void *userdata, sd_bus_error *error) {
+    return sd_bus_message_append(reply, "d", timer_wakeups_per_hour());
+}
+
+/* For each custom module: name, budget (ms), calls, overruns, dropped updates, max receive() duration (ms), throttled */
+static int get_module_budgets(sd_bus *bus, const char *path, const char *interface, const char *property,
+                              sd_bus_message *reply, void *userdata, sd_bus_error *error) {
+    int num;
+    const module_stats_t *stats = get_module_stats(&num);
+    
+    int r = sd_bus_message_open_container(reply, SD_BUS_TYPE_ARRAY, "(sutttdb)");
+    for (int i = 0; i < num && r >= 0; i++) {
+        const module_stats_t *s = &stats[i];
+        r = sd_bus_message_append(reply, "(sutttdb)", s->name, s->budget, s->calls, s->overruns, s->dropped, s->max_ms, (int)s->throttled);
+    }
+    if (r >= 0) {
+        r = sd_bus_message_close_container(reply);
+    }
+    return r;
+}
+
 int set_location(sd_bus *bus, const char *path, const char *interface, const char *property,
                         sd_bus_message *value, void *userdata, sd_bus_error *error) {
 
@@ -714,12 +851,147 @@ int set_timeouts(sd_bus *bus, const char *path, const char *interface, const cha
     return r;
 }
 
+static void on_conf_stored(int error, void *userdata) {
+    sd_bus_message *m = (sd_bus_message *)userdata;
+    if (error == 0) {
+        sd_bus_reply_method_return(m, NULL);
+    } else {
+        sd_bus_reply_method_errorf(m, SD_BUS_ERROR_FAILED, "Failed to store conf: %s.", strerror(error));
+    }
+    sd_bus_message_unref(m);
+}
+
+/* Reply once conf is actually written; STORE writes it off the loop */
 static int method_store_conf(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    if (store_config(LOCAL, on_conf_stored, sd_bus_message_ref(m)) != 0) {
+        sd_bus_message_unref(m);
+        sd_bus_error_set_const(ret_error, SD_BUS_ERROR_FAILED, "Failed to store conf.");
+        return -1;
+    }
+    return 1;
+}
+
+static int method_reload_conf(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
     int r = -1;
-    if (store_config(LOCAL) == 0) {
+    if (reload_config() >= 0) {
         r = sd_bus_reply_method_return(m, NULL);
     } else {
-        sd_bus_error_set_const(ret_error, SD_BUS_ERROR_FAILED, "Failed to store conf.");
+        sd_bus_error_set_const(ret_error, SD_BUS_ERROR_FAILED, "Failed to parse conf.");
     }
     return r;
 }
+
+static const conf_key_t *find_conf_key(const char *key) {
+    for (size_t i = 0; i < sizeof(conf_keys) / sizeof(*conf_keys); i++) {
+        if (!strcmp(conf_keys[i].key, key)) {
+            return &conf_keys[i];
+        }
+    }
+    return NULL;
+}
+
+static int read_conf_key(sd_bus_message *m, const conf_key_t *k, conf_t *c) {
+    void *ptr = (uint8_t *)c + k->offset;
+    int r = -EINVAL;
+    switch (k->type) {
+    case KEY_BOOL:
+    case KEY_INT:
+    case KEY_DOUBLE:
+        r = sd_bus_message_read_basic(m, conf_key_signatures[k->type][0], ptr);
+        break;
+    case KEY_STRING: {
+        const char *str = NULL;
+        r = sd_bus_message_read(m, "s", &str);
+        if (r >= 0) {
+            // Only valid until m is freed: apply_conf() stores a copy
+            *(const char **)ptr = str;
+        }
+        break;
+    }
+    case KEY_EVENT: {
+        const char *event = NULL;
+        r = sd_bus_message_read(m, "s", &event);
+        if (r >= 0) {
+            if (strlen(event) >= sizeof(c->day_conf.day_events[SUNRISE])) {
+                return -EINVAL;
+            }
+            strcpy(ptr, event);
+        }
+        break;
+    }
+    case KEY_CURVE: {
+        const double *data = NULL;
+        size_t length;
+        r = sd_bus_message_read_array(m, 'd', (const void **)&data, &length);
+        if (r >= 0) {
+            curve_t *curve = ptr;
+            length /= sizeof(double);
+            if (length == 0 || length > MAX_SIZE_POINTS) {
+                return -EINVAL;
+            }
+            curve->num_points = length;
+            memcpy(curve->points, data, length * sizeof(double));
+        }
+        break;
+    }
+    case KEY_LOC: {
+        loc_t *loc = ptr;
+        r = sd_bus_message_read(m, "(dd)", &loc->lat, &loc->lon);
+        break;
+    }
+    default:
+        break;
+    }
+    return r;
+}
+
+/*
+ * Set many conf values at once, eg: { "Sensor.AcPoints": <[...]>, "Backlight.AcDayTimeout": <300> }.
+ * Values are applied as a transaction: either all of them are valid and applied, or none is.
+ * Each module is requested to apply its changed values once, instead of once per property write.
+ */
+static int method_apply_conf(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+    /* Work on a copy: conf is only touched once every value was validated */
+    conf_t new;
+    memcpy(&new, &conf, sizeof(conf_t));
+
+    int r = sd_bus_message_enter_container(m, SD_BUS_TYPE_ARRAY, "{sv}");
+    while (r >= 0 && (r = sd_bus_message_enter_container(m, SD_BUS_TYPE_DICT_ENTRY, "sv")) > 0) {
+        const char *key = NULL;
+        r = sd_bus_message_read(m, "s", &key);
+        if (r < 0) {
+            break;
+        }
+
+        const conf_key_t *k = find_conf_key(key);
+        if (!k) {
+            sd_bus_error_setf(ret_error, SD_BUS_ERROR_INVALID_ARGS, "Unknown key '%s'.", key);
+            return -EINVAL;
+        }
+        r = sd_bus_message_enter_container(m, SD_BUS_TYPE_VARIANT, conf_key_signatures[k->type]);
+        if (r <= 0 || read_conf_key(m, k, &new) < 0) {
+            sd_bus_error_setf(ret_error, SD_BUS_ERROR_INVALID_ARGS, "Wrong value for key '%s'.", key);
+            return -EINVAL;
+        }
+        r = sd_bus_message_exit_container(m);
+        if (r >= 0) {
+            r = sd_bus_message_exit_container(m);
+        }
+    }
+    if (r >= 0) {
+        r = sd_bus_message_exit_container(m);
+    }
+    if (r < 0) {
+        sd_bus_error_set_errno(ret_error, -r);
+        return r;
+    }
+
+    const char *invalid = NULL;
+    const int changes = apply_conf(&new, &invalid);
+    if (changes < 0) {
+        sd_bus_error_setf(ret_error, SD_BUS_ERROR_INVALID_ARGS, "Wrong value for '%s'. Nothing applied.", invalid);
+        return -EINVAL;
+    }
+    DEBUG("%d conf values applied.\n", changes);
+    return sd_bus_reply_method_return(m, NULL);
+}
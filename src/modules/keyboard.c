@@ -27,6 +27,7 @@ API(Kbd, conf_kbd_vtable, conf.kbd_conf);
 MODULE_WITH_PAUSE("KEYBOARD");
 
 static void init(void) {
+    PROFILE_FUNC();
     if (init_kbd_backlight() == 0) {
         M_SUB(DISPLAY_UPD);
         M_SUB(BL_UPD);
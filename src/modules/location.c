@@ -14,6 +14,7 @@
 typedef enum { GEOCLUE_NONE, GEOCLUE_PRESENT, GEOCLUE_STARTED, GEOCLUE_FAILED } geoclue_state;
 
 static void fail_geoclue(geoclue_state st);
+static void on_geoclue_timeout(UNUSED void *userdata);
 static void load_cache_location(void);
 static void init_cache_file(void);
 static int geoclue_init(void);
@@ -28,7 +29,7 @@ static void cache_location(void);
 static void publish_location(double new_lat, double new_lon, message_t *l);
 
 static sd_bus_slot *slot;
-static int timeout_fd = -1;
+static int timeout_timer = -1;
 static geoclue_state geoclue_st;
 static char client[PATH_MAX + 1], cache_file[PATH_MAX + 1];
 
@@ -38,12 +39,13 @@ DECLARE_MSG(loc_req, LOCATION_REQ);
 MODULE("LOCATION");
 
 static void init(void) {
+    PROFILE_FUNC();
     init_cache_file();
     M_SUB(LOCATION_REQ);
     
     // Give 30s of time to geoclue to give us a position before killing module
-    timeout_fd = start_timer(CLOCK_BOOTTIME, GEOCLUE_TIMEOUT, 0);
-    m_register_fd(timeout_fd, true, NULL);
+    timeout_timer = start_timer(GEOCLUE_TIMEOUT, 0);
+    register_timer(timeout_timer, on_geoclue_timeout, NULL);
 }
 
 static bool check(void) {
@@ -71,36 +73,14 @@ static void destroy(void) {
     if (slot) {
         slot = sd_bus_slot_unref(slot);
     }
+    if (timeout_timer != -1) {
+        stop_timer(timeout_timer);
+        timeout_timer = -1;
+    }
 }
 
 static void receive(const msg_t *const msg, UNUSED const void* userdata) {
     switch (MSG_TYPE()) {
-    case FD_UPD:
-        read_timer(msg->fd_msg->fd);
-        /*
-         * We had no cached location and geoclue client timed out;
-         * tell other modules an go on dropping location
-         */
-        switch (geoclue_st) {
-        case GEOCLUE_NONE:
-            WARN("Failed to init (no geoclue2 present?). Killing module.\n");
-            break;
-        case GEOCLUE_PRESENT:
-        case GEOCLUE_STARTED:
-            WARN("Timed out waiting on location provided by Geoclue2. Killing module.\n");
-            break;
-        case GEOCLUE_FAILED:
-            WARN("Failed to start Geoclue2 client. Killing module.\n");
-            break;
-        }
-
-        if (state.current_loc.lat == LAT_UNDEFINED || state.current_loc.lon == LON_UNDEFINED) {
-            publish_location(LAT_UNDEFINED, LON_UNDEFINED, &loc_msg);
-        }
-        
-        // if we came here, just kill ourself
-        module_deregister((self_t **)&self());
-        break;
     case LOCATION_REQ: {
         loc_upd *l = (loc_upd *)MSG_DATA();
         if (VALIDATE_REQ(l)) {
@@ -134,7 +114,33 @@ static void receive(const msg_t *const msg, UNUSED const void* userdata) {
 
 static void fail_geoclue(geoclue_state st) {
     geoclue_st = st;
-    set_timeout(0, 1, timeout_fd, 0);
+    set_timeout(0, 1, timeout_timer, 0);
+}
+
+static void on_geoclue_timeout(UNUSED void *userdata) {
+    /*
+     * We had no cached location and geoclue client timed out;
+     * tell other modules an go on dropping location
+     */
+    switch (geoclue_st) {
+    case GEOCLUE_NONE:
+        WARN("Failed to init (no geoclue2 present?). Killing module.\n");
+        break;
+    case GEOCLUE_PRESENT:
+    case GEOCLUE_STARTED:
+        WARN("Timed out waiting on location provided by Geoclue2. Killing module.\n");
+        break;
+    case GEOCLUE_FAILED:
+        WARN("Failed to start Geoclue2 client. Killing module.\n");
+        break;
+    }
+
+    if (state.current_loc.lat == LAT_UNDEFINED || state.current_loc.lon == LON_UNDEFINED) {
+        publish_location(LAT_UNDEFINED, LON_UNDEFINED, &loc_msg);
+    }
+
+    // if we came here, just kill ourself
+    module_deregister((self_t **)&self());
 }
 
 static void load_cache_location(void) {
@@ -247,10 +253,10 @@ static int on_geoclue_new_location(sd_bus_message *m, UNUSED void *userdata, UNU
     if (!r) {
         DEBUG("%.2lf %.2lf received from Geoclue2.\n", new_lat, new_lon);
         publish_location(new_lat, new_lon, &loc_req);
-        if (timeout_fd != -1) {
-            // disable timeout_fd as geoclue is responding!
-            m_deregister_fd(timeout_fd);
-            timeout_fd = -1;
+        if (timeout_timer != -1) {
+            // disable timeout_timer as geoclue is responding!
+            stop_timer(timeout_timer);
+            timeout_timer = -1;
         }
     }
     return 0;
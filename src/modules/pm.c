@@ -10,12 +10,13 @@ static void publish_pm_msg(const bool old, const bool new);
 static void publish_susp_req(const bool new);
 static void on_pm_req(const bool new);
 static void on_suspend_req(suspend_upd *up);
+static void on_delayed_resume(void *userdata);
 
 MODULE("PM");
 
 static sd_bus_slot *slot;
 static unsigned int pm_inh_token;
-static int delayed_resume_fd;
+static int delayed_resume_timer;
 
 static enum
 {
@@ -25,6 +26,7 @@ static enum
 } inh_api;
 
 static void init(void) {
+    PROFILE_FUNC();
     pm_inh_token = -1; // UINT MAX
     
     M_SUB(PM_REQ);
@@ -34,7 +36,7 @@ static void init(void) {
     hook_suspend_signal();
     session_active_listener_init();
     
-    delayed_resume_fd = start_timer(CLOCK_BOOTTIME, 0, 0);
+    delayed_resume_timer = start_timer(0, 0);
 }
 
 static bool check(void) {
@@ -47,14 +49,6 @@ static bool evaluate() {
 
 static void receive(const msg_t *const msg, UNUSED const void* userdata) {
     switch (MSG_TYPE()) {
-        case FD_UPD: {
-            /* We are reading a message delayed of conf.resumedelay */
-            message_t *suspend_msg = (message_t *)msg->fd_msg->userptr;
-            read_timer(delayed_resume_fd);
-            M_PUB(suspend_msg);
-            m_deregister_fd(delayed_resume_fd);
-            break;
-        }
         case INHIBIT_UPD: {
             if (conf.inh_conf.inhibit_pm) {
                 DECLARE_HEAP_MSG(pm_req, PM_REQ);
@@ -93,7 +87,7 @@ static void destroy(void) {
     if (slot) {
         slot = sd_bus_slot_unref(slot);
     }
-    close(delayed_resume_fd);
+    stop_timer(delayed_resume_timer);
 }
 
 static int hook_suspend_signal(void) {
@@ -257,8 +251,8 @@ static void on_suspend_req(suspend_upd *up) {
              * sync screen temperature, failing because Xorg is still not fully resumed. 
              */
             if (!up->new && conf.resumedelay > 0) {
-                set_timeout(conf.resumedelay, 0, delayed_resume_fd, 0);
-                m_register_fd(delayed_resume_fd, false, suspend_msg);
+                set_timeout(conf.resumedelay, 0, delayed_resume_timer, 0);
+                register_timer(delayed_resume_timer, on_delayed_resume, suspend_msg);
             } else {
                 M_PUB(suspend_msg);
             }
@@ -270,3 +264,10 @@ static void on_suspend_req(suspend_upd *up) {
     }
     DEBUG("Suspend ctr: %d\n", suspend_ctr);
 }
+
+static void on_delayed_resume(void *userdata) {
+    /* We are publishing a message delayed of conf.resumedelay */
+    message_t *suspend_msg = (message_t *)userdata;
+    M_PUB(suspend_msg);
+    deregister_timer(delayed_resume_timer);
+}
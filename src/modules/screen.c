@@ -8,10 +8,11 @@ static int parse_bus_reply(sd_bus_message *reply, const char *member, void *user
 static int get_screen_brightness(void);
 static void timeout_callback(int old_val, bool reset);
 static void pause_screen(bool pause, enum mod_pause type, bool reset_screen_br);
+static void on_screen_timer(UNUSED void *userdata);
 static int set_contrib(sd_bus *bus, const char *path, const char *interface, const char *property,
                               sd_bus_message *value, void *userdata, sd_bus_error *error);
 
-static int screen_fd = -1;
+static int screen_timer = -1;
 static enum msg_type curr_msg;
 static const sd_bus_vtable conf_screen_vtable[] = {
     SD_BUS_VTABLE_START(0),
@@ -28,6 +29,7 @@ API(Screen, conf_screen_vtable, conf.screen_conf);
 MODULE_WITH_PAUSE("SCREEN");
 
 static void init(void) {
+    PROFILE_FUNC();
     M_SUB(AMBIENT_BR_UPD);
     M_SUB(SCR_TO_REQ);
     M_SUB(UPOWER_UPD);
@@ -53,8 +55,8 @@ static bool evaluate(void) {
 }
 
 static void destroy(void) {
-    if (screen_fd >= 0) {
-        close(screen_fd);
+    if (screen_timer >= 0) {
+        stop_timer(screen_timer);
     }
     deinit_Screen_api();
 }
@@ -71,8 +73,9 @@ static void receive_waiting_state(const msg_t *msg, UNUSED const void *userdata)
         m_unbecome();
         
         /* Start paused if screen timeout for current ac state is <= 0 */
-        screen_fd = start_timer(CLOCK_BOOTTIME, conf.screen_conf.timeout[state.ac_state], 0);
-        m_register_fd(screen_fd, false, NULL);
+        screen_timer = start_timer(conf.screen_conf.timeout[state.ac_state], 0);
+        set_timer_slack(screen_timer, conf.screen_conf.timer_slack);
+        register_timer(screen_timer, on_screen_timer, NULL);
         timeout_callback(-1, false);
         
         pause_screen(conf.screen_conf.contrib == 0.0f, CONTRIB, true);
@@ -92,11 +95,6 @@ static void receive(const msg_t *msg, UNUSED const void *userdata) {
             get_screen_brightness();
         }
         break;
-    case FD_UPD:
-        read_timer(screen_fd);
-        get_screen_brightness();
-        set_timeout(conf.screen_conf.timeout[state.ac_state], 0, screen_fd, 0);
-        break;
     case UPOWER_UPD: {
         upower_upd *up = (upower_upd *)MSG_DATA();
         timeout_callback(conf.screen_conf.timeout[up->old], true);
@@ -177,13 +175,18 @@ static int get_screen_brightness(void) {
     return ret;
 }
 
+static void on_screen_timer(UNUSED void *userdata) {
+    get_screen_brightness();
+    set_timeout(conf.screen_conf.timeout[state.ac_state], 0, screen_timer, 0);
+}
+
 static void timeout_callback(int old_val, bool reset) {
     if (conf.screen_conf.timeout[state.ac_state] <= 0) {
         pause_screen(true, TIMEOUT, true);
     } else {
         pause_screen(false, TIMEOUT, false);
         if (reset) {
-            reset_timer(screen_fd, old_val, conf.screen_conf.timeout[state.ac_state]);
+            reset_timer(screen_timer, old_val, conf.screen_conf.timeout[state.ac_state]);
         }
     }
 }
@@ -192,10 +195,10 @@ static void pause_screen(bool pause, enum mod_pause type, bool reset_screen_br)
     if (CHECK_PAUSE(pause, type)) {
         if (pause) {
             /* Stop capturing snapshots */
-            m_deregister_fd(screen_fd);
+            deregister_timer(screen_timer);
         } else {
             /* Resume capturing */
-            m_register_fd(screen_fd, false, NULL);
+            register_timer(screen_timer, on_screen_timer, NULL);
         }
     }
     
@@ -13,6 +13,7 @@ MODULE("SIGNAL");
  * See: https://fedoraproject.org/wiki/Changes/KillUserProcesses_by_default
  */
 static void init(void) {
+    PROFILE_FUNC();
     capture_req.capture.reset_timer = false;
     capture_req.capture.capture_only = false;
     
@@ -19,6 +19,7 @@ DECLARE_MSG(inh_req, INHIBIT_REQ);
 MODULE("UPOWER");
 
 static void init(void) {
+    PROFILE_FUNC();
     M_SUB(UPOWER_REQ);
     M_SUB(LID_REQ);
 }
@@ -41,6 +41,7 @@ static curve_t curve;
 static const char *bl_obj_path;
 
 static void init(void) {
+    PROFILE_FUNC();
     curve.num_points = WIZ_IN_POINTS;
     
     setbuf(stdout, NULL); // disable line buffer
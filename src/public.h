@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <time.h>
 #include <module/module_easy.h>
@@ -11,6 +12,20 @@
                                     static bool check(void) { return true; } \
                                     static bool evaluate(void) { return true; } \
                                     static void destroy(void) { } \
+                                    CLIGHT_BUDGET(name)
+
+/*
+ * Custom modules receive() is run through receive_budget(), that measures its duration
+ * against module budget (see "budget" conf) and drops frequent updates for modules that keep exceeding it.
+ * It is installed by the first M_SUB() call; if you use m_become(), call it after subscribing to topics.
+ */
+#define CLIGHT_BUDGET(name)         static clight_budget_t _budget = { -1 }; \
+                                    static void receive_budget(const msg_t *const msg, const void *userdata) { \
+                                        if (clight_budget_begin(&_budget, name, msg)) { \
+                                            receive(msg, userdata); \
+                                            clight_budget_end(&_budget); \
+                                        } \
+                                    } \
                                     extern int errno /* Declare errno to force a semicolon */
 
 /** PubSub Macros **/
@@ -30,7 +45,12 @@
 #define DECLARE_HEAP_MSG(name, t)   ASSERT_MSG(t); message_t *name = calloc(1, sizeof(message_t)); *((int *)&name->type) = t | MSG_FLAG_HEAP;
 
 #define M_PUB(ptr)                  m_publish(topics[(ptr)->type & MSG_FLAGS_MASK], ptr, sizeof(message_t), (ptr)->type & MSG_FLAG_HEAP);
+#ifdef CLIGHT_CORE
 #define M_SUB(type)                 ASSERT_MSG(type); m_subscribe(topics[type]);
+#else
+#define M_SUB(type)                 ASSERT_MSG(type); m_subscribe(topics[type]); \
+                                    if (_budget.id == -1) { _budget.id = -2; m_become(budget); }
+#endif
 
 /** Log Macros **/
 
@@ -40,9 +60,20 @@
 
 #define __FILENAME__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
 
-#define DEBUG(msg, ...) log_message(__FILENAME__, __LINE__, LOG_DEBUG, msg, ##__VA_ARGS__)
-#define INFO(msg, ...)  log_message(__FILENAME__, __LINE__, LOG_INFO, msg, ##__VA_ARGS__)
-#define WARN(msg, ...)  log_message(__FILENAME__, __LINE__, LOG_WARN, msg, ##__VA_ARGS__)
+/* 
+ * Minimum log level built in (CLIGHT_MIN_LOG_LEVEL cmake option): lower level messages are compiled out.
+ * DEBUG arguments are only evaluated in verbose mode.
+ */
+#define LOG_LEVEL_DEBUG     0
+#define LOG_LEVEL_INFO      1
+#define LOG_LEVEL_WARN      2
+#ifndef CLIGHT_MIN_LOG_LEVEL
+#define CLIGHT_MIN_LOG_LEVEL    LOG_LEVEL_DEBUG
+#endif
+
+#define DEBUG(msg, ...) do { if (CLIGHT_MIN_LOG_LEVEL <= LOG_LEVEL_DEBUG && log_verbose_enabled()) log_message(__FILENAME__, __LINE__, LOG_DEBUG, msg, ##__VA_ARGS__); } while (0)
+#define INFO(msg, ...)  do { if (CLIGHT_MIN_LOG_LEVEL <= LOG_LEVEL_INFO) log_message(__FILENAME__, __LINE__, LOG_INFO, msg, ##__VA_ARGS__); } while (0)
+#define WARN(msg, ...)  do { if (CLIGHT_MIN_LOG_LEVEL <= LOG_LEVEL_WARN) log_message(__FILENAME__, __LINE__, LOG_WARN, msg, ##__VA_ARGS__); } while (0)
 
 /** Generic Enums **/
 
@@ -270,3 +301,94 @@ extern const char *topics[];
 /** Log function declaration **/
 
 void log_message(const char *filename, int lineno, const char type, const char *log_msg, ...);
+bool log_verbose_enabled(void);
+
+/** Async command execution **/
+
+#define CLIGHT_SPAWN_MAX_OUTPUT     4096    // Bytes of command output (stdout and stderr) kept; any further output is discarded
+
+/*
+ * Called once command exited, with its waitpid() status (-1 if it could not be started),
+ * and its NUL terminated, possibly truncated, output.
+ */
+typedef void (*spawn_cb)(int status, const char *output, size_t len, void *userdata);
+
+/*
+ * Run argv[0] (looked up in PATH) with argv arguments, without blocking Clight loop: 
+ * use it instead of system() in custom modules.
+ * At most 4 commands run concurrently; further ones are queued.
+ * Returns 0 if command was started or queued, -1 otherwise (eg: too many queued commands).
+ * cb can be NULL.
+ */
+int clight_spawn(const char *const argv[], spawn_cb cb, void *userdata);
+
+/** Custom modules execution budget **/
+
+typedef struct {
+    int id;                     // Internal: -1 until receive_budget() is installed
+    struct timespec start;      // Internal: current receive() start time
+    int type;                   // Internal: current receive() message type
+} clight_budget_t;
+
+/*
+ * Used by CLIGHT_MODULE receive_budget(); no need to call them directly.
+ * clight_budget_begin() returns false if the message must be dropped because module is being throttled.
+ */
+bool clight_budget_begin(clight_budget_t *b, const char *name, const msg_t *const msg);
+void clight_budget_end(clight_budget_t *b);
+
+/** Shared state page **/
+
+#define CLIGHT_STATE_PAGE_VERSION   1
+
+/*
+ * Read-only snapshot of Clight public state, kept updated in a memfd
+ * whose fd is returned by org.clight.clight.GetStatePage bus method.
+ * Readers mmap() it (PROT_READ, MAP_SHARED) and read it with clight_state_page_read(),
+ * without any further bus round trip. Fields mirror org.clight.clight properties.
+ * New fields are only ever appended: check version and size before reading.
+ */
+typedef struct {
+    uint32_t version;           // CLIGHT_STATE_PAGE_VERSION
+    uint32_t size;              // sizeof(clight_state_page_t) as written by Clight
+    uint32_t seq;               // Seqlock counter: odd while Clight is updating the page
+    int32_t running;            // 0 once Clight quit: page will not be updated anymore
+    int64_t sunrise;            // Today sunrise time
+    int64_t sunset;             // Today sunset time
+    int32_t next_event;         // enum day_events
+    int32_t day_time;           // enum day_states
+    int32_t in_event;
+    int32_t display_state;      // enum display_states bitmask
+    int32_t ac_state;           // enum ac_states
+    int32_t lid_state;          // enum lid_states
+    int32_t inhibited;
+    int32_t pm_inhibited;
+    int32_t sens_avail;
+    int32_t suspended;
+    int32_t temp;
+    int32_t reserved;
+    double bl_pct;
+    double kbd_pct;
+    double ambient_br;
+    double screen_br;
+    loc_t loc;
+} clight_state_page_t;
+
+/*
+ * Copy a consistent snapshot of page into out.
+ * Returns false if Clight kept updating the page for the whole attempt; just retry later.
+ */
+static inline bool clight_state_page_read(const clight_state_page_t *page, clight_state_page_t *out) {
+    for (int i = 0; i < 64; i++) {
+        const uint32_t seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        memcpy(out, page, sizeof(clight_state_page_t));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&page->seq, __ATOMIC_RELAXED) == seq) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,243 @@
+#include "budget.h"
+#include "lagmon.h"
+#include "timer.h"
+
+/**
+ * Custom modules execution budget.
+ *
+ * Custom modules run inside Clight loop: a slow receive() delays any other module.
+ * Each receive() call is measured against module budget; a module that exceeds it
+ * "throttle" times in a row stops receiving frequent updates (ie: ones emitted on each smooth transition step
+ * or ambient brightness capture), until one of its receive() calls fits its budget again,
+ * or at most for THROTTLE_WINDOW seconds.
+ * Once unthrottled, the module is told the last dropped update of each type, so that it never misses a final value.
+ * Modules are looked up by name when telling them, as they may have been unloaded meanwhile.
+ * State updates (eg: DAYTIME_UPD, DISPLAY_UPD) and fd/system messages are always delivered.
+ */
+
+#define MAX_TRACKED_MODULES 32
+#define THROTTLE_WINDOW     10
+
+/* Internal throttling state of a stats slot */
+typedef struct {
+    int timer;                              // throttle window timer; -1 until needed
+    message_t *last_dropped[MSGS_SIZE];     // last dropped update of each type
+} throttle_t;
+
+static void throttle(int id);
+static void unthrottle(int id);
+static void on_throttle_window(void *userdata);
+static void keep_dropped(throttle_t *t, const msg_t *const msg, int type);
+static int find_budget(const char *name);
+static bool is_frequent_upd(int type);
+
+static module_stats_t stats[MAX_TRACKED_MODULES];
+static throttle_t throttles[MAX_TRACKED_MODULES];
+static int num_stats;
+
+MODULE("BUDGET");
+
+static void init(void) {
+    /* Only used to tell throttled modules their missed updates */
+}
+
+static bool check(void) {
+    return true;
+}
+
+static bool evaluate(void) {
+    return true;
+}
+
+static void destroy(void) {
+    /* Stats are freed by destroy_module_stats() */
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    /* Nothing to receive */
+}
+
+bool clight_budget_begin(clight_budget_t *b, const char *name, const msg_t *const msg) {
+    const int type = MSG_TYPE();
+    if (b->id < 0) {
+        /* Find stats slot for this module: it is kept across module reloads */
+        b->id = -3;
+        for (int i = 0; i < num_stats && b->id < 0; i++) {
+            if (!strcmp(stats[i].name, name)) {
+                b->id = i;
+            }
+        }
+        if (b->id < 0 && num_stats < MAX_TRACKED_MODULES) {
+            b->id = num_stats++;
+            stats[b->id].name = strdup(name);
+            throttles[b->id].timer = -1;
+        }
+        if (b->id >= 0) {
+            stats[b->id].budget = find_budget(name);
+            DEBUG("Module '%s' execution budget: %dms.\n", name, stats[b->id].budget);
+        } else {
+            WARN("Too many custom modules; '%s' execution budget won't be tracked.\n", name);
+        }
+    }
+
+    if (b->id < 0) {
+        return true;
+    }
+
+    module_stats_t *s = &stats[b->id];
+    if (s->budget > 0 && s->throttled && is_frequent_upd(type)) {
+        s->dropped++;
+        keep_dropped(&throttles[b->id], msg, type);
+        return false;
+    }
+    /* Untracked modules are still timed, for LAGMON */
+    b->type = type;
+    clock_gettime(CLOCK_MONOTONIC, &b->start);
+    return true;
+}
+
+void clight_budget_end(clight_budget_t *b) {
+    if (b->id < 0) {
+        return;
+    }
+
+    module_stats_t *s = &stats[b->id];
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double elapsed = (end.tv_sec - b->start.tv_sec) * 1000.0 + (end.tv_nsec - b->start.tv_nsec) / 1000000.0;
+    lag_account(s->name, b->type >= 0 ? topics[b->type] : b->type == FD_UPD ? "fd" : "system", elapsed);
+    if (s->budget <= 0) {
+        return;
+    }
+
+    s->calls++;
+    if (elapsed > s->max_ms) {
+        s->max_ms = elapsed;
+    }
+    if (elapsed > s->budget) {
+        s->overruns++;
+        s->consecutive++;
+        /* Only warn on first overrun of a streak */
+        if (s->consecutive == 1) {
+            WARN("Module '%s' receive() took %.1lfms, exceeding its %dms budget.\n", s->name, elapsed, s->budget);
+        } else {
+            DEBUG("Module '%s' receive() took %.1lfms, exceeding its %dms budget.\n", s->name, elapsed, s->budget);
+        }
+        if (!s->throttled && conf.budget_conf.throttle > 0 && s->consecutive >= conf.budget_conf.throttle) {
+            WARN("Module '%s' exceeded its budget %d times in a row. Dropping its frequent updates for %ds.\n", 
+                 s->name, s->consecutive, THROTTLE_WINDOW);
+            throttle(b->id);
+        }
+    } else {
+        s->consecutive = 0;
+        if (s->throttled) {
+            INFO("Module '%s' is back within its budget (%llu updates dropped).\n", s->name, (unsigned long long)s->dropped);
+            unthrottle(b->id);
+        }
+    }
+}
+
+static void throttle(int id) {
+    throttle_t *t = &throttles[id];
+    stats[id].throttled = true;
+    if (t->timer == -1) {
+        t->timer = start_timer(0, 0);
+        register_timer(t->timer, on_throttle_window, (void *)(intptr_t)id);
+    }
+    set_timeout(THROTTLE_WINDOW, 0, t->timer, 0);
+}
+
+/* Tell module the last update it missed for each type: they are delivered as it is no more throttled */
+static void unthrottle(int id) {
+    throttle_t *t = &throttles[id];
+    stats[id].throttled = false;
+    if (t->timer != -1) {
+        set_timeout(0, 0, t->timer, 0);
+    }
+    const self_t *ref = NULL;
+    if (m_ref(stats[id].name, &ref) != MOD_OK) {
+        DEBUG("Module '%s' is gone; discarding its missed updates.\n", stats[id].name);
+        ref = NULL;
+    }
+    for (int i = 0; i < MSGS_SIZE; i++) {
+        if (t->last_dropped[i]) {
+            if (ref) {
+                m_tell(ref, t->last_dropped[i], sizeof(message_t), true);
+            } else {
+                free(t->last_dropped[i]);
+            }
+            t->last_dropped[i] = NULL;
+        }
+    }
+}
+
+/* Give a module that only receives frequent updates a chance to get back within its budget */
+static void on_throttle_window(void *userdata) {
+    const int id = (intptr_t)userdata;
+    module_stats_t *s = &stats[id];
+    if (s->throttled) {
+        INFO("Module '%s' throttling window expired (%llu updates dropped).\n", s->name, (unsigned long long)s->dropped);
+        s->consecutive = 0;
+        unthrottle(id);
+    }
+}
+
+static void keep_dropped(throttle_t *t, const msg_t *const msg, int type) {
+    if (!t->last_dropped[type]) {
+        t->last_dropped[type] = malloc(sizeof(message_t));
+        if (!t->last_dropped[type]) {
+            return;
+        }
+    }
+    memcpy(t->last_dropped[type], msg->ps_msg->message, sizeof(message_t));
+    /* Heap flag of the original message does not matter: copy is autofreed when told */
+    *((int *)&t->last_dropped[type]->type) = type;
+}
+
+const module_stats_t *get_module_stats(int *num) {
+    *num = num_stats;
+    return stats;
+}
+
+void destroy_module_stats(void) {
+    for (int i = 0; i < num_stats; i++) {
+        free(stats[i].name);
+        if (throttles[i].timer != -1) {
+            stop_timer(throttles[i].timer);
+        }
+        for (int j = 0; j < MSGS_SIZE; j++) {
+            free(throttles[i].last_dropped[j]);
+        }
+    }
+    memset(stats, 0, sizeof(stats));
+    memset(throttles, 0, sizeof(throttles));
+    num_stats = 0;
+    
+    for (int i = 0; i < conf.budget_conf.num_modules; i++) {
+        free(conf.budget_conf.modules[i].name);
+    }
+    conf.budget_conf.num_modules = 0;
+}
+
+static int find_budget(const char *name) {
+    for (int i = 0; i < conf.budget_conf.num_modules; i++) {
+        if (!strcmp(conf.budget_conf.modules[i].name, name)) {
+            return conf.budget_conf.modules[i].budget;
+        }
+    }
+    return conf.budget_conf.budget;
+}
+
+static bool is_frequent_upd(int type) {
+    switch (type) {
+    case TEMP_UPD:
+    case AMBIENT_BR_UPD:
+    case BL_UPD:
+    case KBD_BL_UPD:
+    case SCR_BL_UPD:
+    case SCREEN_BR_UPD:
+        return true;
+    default:
+        return false;
+    }
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "commons.h"
+
+/* Execution stats of a custom module receive() */
+typedef struct {
+    char *name;
+    int budget;                             // ms; 0 if untracked
+    uint64_t calls;
+    uint64_t overruns;                      // calls that exceeded budget
+    uint64_t dropped;                       // updates dropped while throttled
+    double max_ms;                          // longest receive() call
+    int consecutive;                        // current streak of overruns
+    bool throttled;
+} module_stats_t;
+
+const module_stats_t *get_module_stats(int *num);
+void destroy_module_stats(void);
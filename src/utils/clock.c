@@ -0,0 +1,105 @@
+#include "clock.h"
+#include "utils.h"
+
+#define CLOCK_ENV   "CLIGHT_CLOCK"      // "sim:<speed>[:<start_epoch>]" to enable simulated clock
+
+static time_t real_now(void);
+static void real_identity(struct timespec *ts);
+static time_t sim_now(void);
+static void sim_to_real(struct timespec *ts);
+static void sim_from_real(struct timespec *ts);
+static double ts_to_ns(const struct timespec *ts);
+static void ns_to_ts(double ns, struct timespec *ts);
+
+static const clock_backend_t real_clock = { "real", real_now, real_identity, real_identity };
+static const clock_backend_t sim_clock = { "simulated", sim_now, sim_to_real, sim_from_real };
+static const clock_backend_t *backend = &real_clock;
+
+static double sim_speed = 1.0;
+static time_t sim_start;
+static struct timespec sim_boot;
+
+/*
+ * Select clock backend. Simulated clock is meant for test/benchmark harnesses:
+ * eg: CLIGHT_CLOCK=sim:3600 makes each real second last one clock hour,
+ * thus a full day/night cycle (long gamma transitions included) runs in 24s.
+ */
+void init_clock(void) {
+    const char *env = getenv(CLOCK_ENV);
+    if (is_string_empty(env) || strncmp(env, "sim:", strlen("sim:"))) {
+        return;
+    }
+
+    char *end = NULL;
+    sim_speed = strtod(env + strlen("sim:"), &end);
+    if (sim_speed <= 0) {
+        WARN("Wrong %s value: '%s'. Using real clock.\n", CLOCK_ENV, env);
+        sim_speed = 1.0;
+        return;
+    }
+    sim_start = (end && *end == ':') ? strtoll(end + 1, NULL, 10) : time(NULL);
+    clock_gettime(CLOCK_BOOTTIME, &sim_boot);
+    backend = &sim_clock;
+    INFO("Using %s clock: speed %.2fx, starting at %s", backend->name, sim_speed, ctime(&sim_start));
+}
+
+time_t clock_now(void) {
+    return backend->now();
+}
+
+void clock_to_real(struct timespec *ts) {
+    backend->to_real(ts);
+}
+
+void clock_from_real(struct timespec *ts) {
+    backend->from_real(ts);
+}
+
+/* Used for durations that are not timerfd driven, eg: Clightd gamma transition steps */
+int clock_real_ms(int ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000 };
+    clock_to_real(&ts);
+    const int real_ms = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    return real_ms > 0 || ms == 0 ? real_ms : 1;
+}
+
+const char *clock_name(void) {
+    return backend->name;
+}
+
+static time_t real_now(void) {
+    return time(NULL);
+}
+
+static void real_identity(UNUSED struct timespec *ts) {
+
+}
+
+static time_t sim_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    const double elapsed = (now.tv_sec - sim_boot.tv_sec) + (now.tv_nsec - sim_boot.tv_nsec) / 1e9;
+    return sim_start + (time_t)(elapsed * sim_speed);
+}
+
+static void sim_to_real(struct timespec *ts) {
+    const bool armed = ts->tv_sec != 0 || ts->tv_nsec != 0;
+    ns_to_ts(ts_to_ns(ts) / sim_speed, ts);
+    /* Never turn an armed timer into a disarmed one */
+    if (armed && ts->tv_sec == 0 && ts->tv_nsec == 0) {
+        ts->tv_nsec = 1;
+    }
+}
+
+static void sim_from_real(struct timespec *ts) {
+    ns_to_ts(ts_to_ns(ts) * sim_speed, ts);
+}
+
+static double ts_to_ns(const struct timespec *ts) {
+    return (double)ts->tv_sec * 1e9 + ts->tv_nsec;
+}
+
+static void ns_to_ts(double ns, struct timespec *ts) {
+    ts->tv_sec = ns / 1e9;
+    ts->tv_nsec = ns - (double)ts->tv_sec * 1e9;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "commons.h"
+
+/*
+ * Clock backend used by timers and by DAYTIME/GAMMA time computations.
+ * The real backend maps 1:1 on wall clock and timerfd durations;
+ * the simulated one runs the wall clock faster (and from a given start time),
+ * scaling each timer duration accordingly.
+ */
+typedef struct {
+    const char *name;
+    time_t (*now)(void);                                // current (possibly simulated) wall clock time
+    void (*to_real)(struct timespec *ts);               // clock duration -> real timerfd duration
+    void (*from_real)(struct timespec *ts);             // real timerfd duration -> clock duration
+} clock_backend_t;
+
+void init_clock(void);
+time_t clock_now(void);
+void clock_to_real(struct timespec *ts);
+void clock_from_real(struct timespec *ts);
+int clock_real_ms(int ms);
+const char *clock_name(void);
@@ -0,0 +1,124 @@
+#include <math.h>
+#include <sys/timerfd.h>
+#include "lagmon.h"
+
+/**
+ * LAGMON service probes Clight loop responsiveness.
+ *
+ * Every conf.lag_conf.interval seconds its own CLOCK_MONOTONIC timerfd expires:
+ * the delay between the expiration and the loop actually serving it is the loop lag,
+ * collected in a histogram. Monotonic clock does not advance while suspended,
+ * thus resuming is not mistaken for a lag.
+ *
+ * A probe only notices a lag once the loop is free again: whatever blocked it
+ * is reported through lag_account() (synchronous bus calls, custom modules receive()),
+ * and the longest activity since previous probe is logged together with any lag above threshold.
+ */
+
+typedef struct {
+    const char *who;                        // static string
+    char what[64];
+    double ms;
+} lag_activity_t;
+
+static void arm_probe(void);
+static uint64_t now_ns(void);
+
+static const double bounds[LAG_BUCKETS] = { 1, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, INFINITY };
+static lag_hist_t hist = { bounds };
+static lag_activity_t longest;
+static uint64_t expected_ns;
+static int probe_fd = -1;
+
+MODULE("LAGMON");
+
+static void init(void) {
+    PROFILE_FUNC();
+    probe_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (probe_fd == -1) {
+        WARN("Failed to create loop lag probe: %s\n", strerror(errno));
+        return;
+    }
+    m_register_fd(probe_fd, true, NULL);
+    arm_probe();
+}
+
+static bool check(void) {
+    return true;
+}
+
+static bool evaluate(void) {
+    return !conf.wizard && conf.lag_conf.interval > 0;
+}
+
+static void destroy(void) {
+    /* fd is closed by libmodule, as registered with autoclose */
+    probe_fd = -1;
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    switch (MSG_TYPE()) {
+    case FD_UPD: {
+        uint64_t t;
+        if (read(msg->fd_msg->fd, &t, sizeof(uint64_t)) != sizeof(uint64_t)) {
+            break;
+        }
+        const uint64_t now = now_ns();
+        const double lag_ms = now > expected_ns ? (now - expected_ns) / 1000000.0 : 0;
+        int i = 0;
+        while (lag_ms > bounds[i]) {
+            i++;
+        }
+        hist.counts[i]++;
+        hist.samples++;
+        hist.sum_ms += lag_ms;
+        if (lag_ms > hist.max_ms) {
+            hist.max_ms = lag_ms;
+        }
+
+        if (lag_ms > conf.lag_conf.threshold) {
+            if (longest.who) {
+                WARN("Loop lagged %.1lfms; longest activity meanwhile: %s (%s) took %.1lfms.\n", 
+                     lag_ms, longest.who, longest.what, longest.ms);
+            } else {
+                WARN("Loop lagged %.1lfms; no tracked activity meanwhile.\n", lag_ms);
+            }
+        }
+        memset(&longest, 0, sizeof(longest));
+        arm_probe();
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static void arm_probe(void) {
+    expected_ns = now_ns() + conf.lag_conf.interval * 1000000000ULL;
+    struct itimerspec timerValue = {{0}};
+    timerValue.it_value.tv_sec = expected_ns / 1000000000ULL;
+    timerValue.it_value.tv_nsec = expected_ns % 1000000000ULL;
+    timerfd_settime(probe_fd, TFD_TIMER_ABSTIME, &timerValue, NULL);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Report something that kept the loop busy for ms milliseconds:
+ * who is the module or function (a static string), what the topic or bus member.
+ */
+void lag_account(const char *who, const char *what, double ms) {
+    if (ms > longest.ms) {
+        longest.who = who;
+        snprintf(longest.what, sizeof(longest.what), "%s", what ? what : "");
+        longest.ms = ms;
+    }
+}
+
+const lag_hist_t *lag_histogram(void) {
+    return &hist;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "commons.h"
+
+#define LAG_BUCKETS 11
+
+/* Loop lag measured by LAGMON probe */
+typedef struct {
+    const double *bounds;                   // upper bound (ms) of each bucket; last one is +Inf
+    uint64_t counts[LAG_BUCKETS];           // non cumulative
+    uint64_t samples;
+    double sum_ms;
+    double max_ms;
+} lag_hist_t;
+
+void lag_account(const char *who, const char *what, double ms);
+const lag_hist_t *lag_histogram(void);
@@ -0,0 +1,197 @@
+#include <libconfig.h>
+#include <unistd.h>
+#include "lazy.h"
+#include "utils.h"
+
+/**
+ * LAZY service loads custom modules only once they are needed.
+ *
+ * A custom module can be shipped with a "<module>.manifest" libconfig file, listing its name
+ * (as passed to CLIGHT_MODULE()) and the topics it subscribes to, eg:
+ *      name = "NIGHTMODE";
+ *      topics = [ "DayTime" ];
+ * Topic names are the ones of Clight bus signals (see topics.c).
+ * LAZY subscribes to these topics on module behalf; when one of them is first published,
+ * module is loaded and the triggering message is forwarded to it, so that it does not miss it.
+ * Custom modules without a manifest are loaded straight away.
+ */
+
+#define MANIFEST_EXT    ".manifest"
+
+typedef struct lazy_mod {
+    char *path;
+    char *name;
+    bool topics[MSGS_SIZE];
+    struct lazy_mod *next;
+} lazy_mod_t;
+
+static lazy_mod_t *read_manifest(const char *path, const char *manifest);
+static void free_lazy_mod(lazy_mod_t *mod);
+static void load_lazy_mods(int type, const msg_t *msg);
+static bool is_topic_needed(int type);
+
+static lazy_mod_t *lazy_mods;
+
+MODULE("LAZY");
+
+static void init(void) {
+    PROFILE_FUNC();
+    for (int i = 0; i < MSGS_SIZE; i++) {
+        if (is_topic_needed(i)) {
+            DEBUG("Waiting on '%s' topic to load custom modules.\n", topics[i]);
+            m_subscribe(topics[i]);
+        }
+    }
+}
+
+static bool check(void) {
+    return true;
+}
+
+static bool evaluate(void) {
+    /* Only start if any custom module is waiting to be loaded */
+    return lazy_mods != NULL;
+}
+
+static void destroy(void) {
+    while (lazy_mods) {
+        lazy_mod_t *mod = lazy_mods;
+        lazy_mods = mod->next;
+        free_lazy_mod(mod);
+    }
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    const int type = MSG_TYPE();
+    if (type >= 0 && type < MSGS_SIZE) {
+        load_lazy_mods(type, msg);
+        if (!is_topic_needed(type)) {
+            m_unsubscribe(topics[type]);
+        }
+        if (!lazy_mods) {
+            DEBUG("All custom modules loaded.\n");
+            m_poisonpill(self());
+        }
+    }
+}
+
+/*
+ * Returns true if module at path has a manifest, and thus its loading was deferred.
+ * Returns false if it must be loaded straight away.
+ */
+bool lazy_load_module(const char *path) {
+    char manifest[PATH_MAX + 1];
+    snprintf(manifest, sizeof(manifest), "%s%s", path, MANIFEST_EXT);
+    if (access(manifest, F_OK) == -1) {
+        return false;
+    }
+    
+    lazy_mod_t *mod = read_manifest(path, manifest);
+    if (!mod) {
+        return false;
+    }
+    
+    /* Local modules are registered first and have higher priority: skip global modules with same name */
+    for (lazy_mod_t *m = lazy_mods; m; m = m->next) {
+        if (!strcmp(m->name, mod->name)) {
+            INFO("'%s' overridden by '%s'.\n", path, m->path);
+            free_lazy_mod(mod);
+            return true;
+        }
+    }
+    
+    mod->next = lazy_mods;
+    lazy_mods = mod;
+    INFO("'%s' will be loaded on first use.\n", path);
+    return true;
+}
+
+bool is_module_manifest(const char *path) {
+    const size_t len = strlen(path);
+    const size_t ext_len = strlen(MANIFEST_EXT);
+    return len > ext_len && !strcmp(path + len - ext_len, MANIFEST_EXT);
+}
+
+static lazy_mod_t *read_manifest(const char *path, const char *manifest) {
+    lazy_mod_t *mod = NULL;
+    config_t cfg;
+    
+    config_init(&cfg);
+    if (config_read_file(&cfg, manifest) == CONFIG_TRUE) {
+        const char *name = NULL;
+        config_setting_t *tps = config_lookup(&cfg, "topics");
+        if (config_lookup_string(&cfg, "name", &name) == CONFIG_TRUE && !is_string_empty(name) && tps) {
+            mod = calloc(1, sizeof(lazy_mod_t));
+            mod->path = strdup(path);
+            mod->name = strdup(name);
+            
+            bool found = false;
+            for (int i = 0; i < config_setting_length(tps); i++) {
+                const char *topic = config_setting_get_string_elem(tps, i);
+                int j;
+                for (j = 0; j < MSGS_SIZE && (!topic || strcmp(topics[j], topic)); j++);
+                if (j < MSGS_SIZE) {
+                    mod->topics[j] = true;
+                    found = true;
+                } else {
+                    WARN("Unknown topic '%s' in %s.\n", topic ? topic : "", manifest);
+                }
+            }
+            if (!found) {
+                WARN("No valid topics in %s.\n", manifest);
+                free_lazy_mod(mod);
+                mod = NULL;
+            }
+        } else {
+            WARN("Missing 'name' or 'topics' in %s.\n", manifest);
+        }
+    } else {
+        WARN("Manifest %s: %s at line %d.\n", manifest, config_error_text(&cfg), config_error_line(&cfg));
+    }
+    config_destroy(&cfg);
+    return mod;
+}
+
+static void free_lazy_mod(lazy_mod_t *mod) {
+    free(mod->path);
+    free(mod->name);
+    free(mod);
+}
+
+static void load_lazy_mods(int type, const msg_t *msg) {
+    lazy_mod_t **m = &lazy_mods;
+    while (*m) {
+        lazy_mod_t *mod = *m;
+        if (!mod->topics[type]) {
+            m = &mod->next;
+            continue;
+        }
+        
+        *m = mod->next;
+        if (m_load(mod->path) == MOD_OK) {
+            INFO("'%s' loaded on '%s' topic.\n", mod->path, topics[type]);
+            
+            /* Forward triggering message: module subscribed to topic only now */
+            const self_t *ref = NULL;
+            if (m_ref(mod->name, &ref) == MOD_OK) {
+                message_t *fwd = malloc(sizeof(message_t));
+                memcpy(fwd, msg->ps_msg->message, sizeof(message_t));
+                m_tell(ref, fwd, sizeof(message_t), true);
+            } else {
+                WARN("'%s' does not match '%s' module name.\n", mod->name, mod->path);
+            }
+        } else {
+            WARN("'%s' failed to load.\n", mod->path);
+        }
+        free_lazy_mod(mod);
+    }
+}
+
+static bool is_topic_needed(int type) {
+    for (lazy_mod_t *mod = lazy_mods; mod; mod = mod->next) {
+        if (mod->topics[type]) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "commons.h"
+
+bool lazy_load_module(const char *path);
+bool is_module_manifest(const char *path);
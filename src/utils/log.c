@@ -1,6 +1,39 @@
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
 #include <sys/file.h>
 #include <sys/stat.h>
 #include "utils.h"
+#include "clock.h"
+
+/*
+ * Log lines are formatted by the loop into a single-producer single-consumer ring,
+ * and written to log file and stdout by a writer thread, so that a slow disk never stalls the loop.
+ * When the ring is full, new lines are dropped and counted; DEBUG and PLOT lines are dropped
+ * earlier, to leave room for more important ones. Errors, and any line logged while writer is not running,
+ * are written synchronously, after flushing the ring.
+ * log_message() must only be called by Clight loop thread.
+ */
+#define LOG_RING_SLOTS      256                         // power of 2
+#define LOG_VERBOSE_SLOTS   (LOG_RING_SLOTS * 3 / 4)    // max slots used by DEBUG and PLOT lines
+#define LOG_LINE_MAX        512                         // longer lines are truncated
+#define LOG_FLUSH_MAX_MS    1000
+
+typedef struct {
+    char type;
+    int msg_off;                            // offset of message in line, after log file header
+    int len;
+    char line[LOG_LINE_MAX];
+} log_line_t;
+
+bool log_verbose_enabled(void) {
+    return conf.verbose;
+}
+
+static void format_line(log_line_t *l, const char *filename, int lineno, const char type, const char *log_msg, va_list args);
+static void write_line(const log_line_t *l);
+static void *log_writer(void *arg);
+static void drain_ring(void);
 
 static void log_bl_smooth(bl_smooth_t *smooth, const char *prefix);
 static void log_bl_conf(bl_conf_t *bl_conf);
@@ -14,6 +47,12 @@ static void log_scr_conf(screen_conf_t *screen_conf);
 static void log_inh_conf(inh_conf_t *inh_conf);
 
 static FILE *log_file;
+static log_line_t ring[LOG_RING_SLOTS];
+static uint64_t ring_head, ring_tail;      // head only moved by loop, tail only by writer
+static uint64_t dropped, reported_dropped;
+static sem_t ring_sem;
+static pthread_t writer;
+static bool writer_running, writer_quit;
 
 void open_log(void) {
     char log_path[PATH_MAX + 1] = {0};
@@ -42,6 +81,25 @@ void open_log(void) {
     } 
     
     ftruncate(fd, 0);
+    
+    if (sem_init(&ring_sem, 0, 0) == 0) {
+        /*
+         * Writer inherits a full signal mask: SIGNAL module only blocks signals on loop thread,
+         * later on; otherwise eg: SIGTERM would be delivered to writer and kill Clight without any cleanup.
+         */
+        sigset_t all, old;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        if (pthread_create(&writer, NULL, log_writer, NULL) == 0) {
+            writer_running = true;
+        } else {
+            sem_destroy(&ring_sem);
+        }
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+    }
+    if (!writer_running) {
+        WARN("Failed to start log writer. Logging synchronously.\n");
+    }
 }
 
 static void log_bl_smooth(bl_smooth_t *smooth, const char *prefix) {
@@ -63,6 +121,7 @@ static void log_bl_conf(bl_conf_t *bl_conf) {
     fprintf(log_file, "* Capture on lid opened:\t\t%s\n", bl_conf->capture_on_lid_opened ? "Enabled" : "Disabled");
     fprintf(log_file, "* Restore On Exit:\t\t%s\n", bl_conf->restore ? "Enabled" : "Disabled");
     fprintf(log_file, "* Delay on hotplug:\t\t%d\n", bl_conf->sync_monitors_delay);
+    fprintf(log_file, "* Timer slack:\t\tAC %d\tBATT %d\n", bl_conf->timer_slack[ON_AC], bl_conf->timer_slack[ON_BATTERY]);
 }
 
 static void log_sens_conf(sensor_conf_t *sens_conf) {
@@ -86,7 +145,14 @@ static void log_gamma_conf(gamma_conf_t *gamma_conf) {
     fprintf(log_file, "* Nightly screen temp:\t\t%d\n", gamma_conf->temp[NIGHT]);
     fprintf(log_file, "* Long transition:\t\t%s\n", gamma_conf->long_transition ? "Enabled" : "Disabled");
     fprintf(log_file, "* Ambient gamma:\t\t%s\n", gamma_conf->ambient_gamma ? "Enabled" : "Disabled");
+    fprintf(log_file, "* Ambient deadband:\t\t%d\n", gamma_conf->ambient_deadband);
+    fprintf(log_file, "* Ambient interval:\t\t%d\n", gamma_conf->ambient_interval);
+    fprintf(log_file, "* Solar transition:\t\t%s\n", gamma_conf->solar_transition ? "Enabled" : "Disabled");
+    fprintf(log_file, "* Solar step:\t\t%d\n", gamma_conf->solar_step);
     fprintf(log_file, "* Restore On Exit:\t\t%s\n", gamma_conf->restore ? "Enabled" : "Disabled");
+    for (int i = 0; i < gamma_conf->num_outputs; i++) {
+        fprintf(log_file, "* Output:\t\t%s (offset %d)\n", gamma_conf->outputs[i].display, gamma_conf->outputs[i].offset);
+    }
 }
 
 static void log_daytime_conf(daytime_conf_t *day_conf) {
@@ -101,6 +167,7 @@ static void log_daytime_conf(daytime_conf_t *day_conf) {
     fprintf(log_file, "* Event duration:\t\t%d\n", day_conf->event_duration);
     fprintf(log_file, "* Sunrise offset:\t\t%d\n", day_conf->events_os[SUNRISE]);
     fprintf(log_file, "* Sunset offset:\t\t%d\n", day_conf->events_os[SUNSET]);
+    fprintf(log_file, "* Timer slack:\t\tAC %d\tBATT %d\n", day_conf->timer_slack[ON_AC], day_conf->timer_slack[ON_BATTERY]);
 }
 
 static void log_dim_conf(dimmer_conf_t *dim_conf) {
@@ -119,6 +186,7 @@ static void log_dpms_conf(dpms_conf_t *dpms_conf) {
 static void log_scr_conf(screen_conf_t *screen_conf) {
     fprintf(log_file, "\n### SCREEN ###\n");
     fprintf(log_file, "* Timeouts:\t\tAC %d\tBATT %d\n", screen_conf->timeout[ON_AC], screen_conf->timeout[ON_BATTERY]);
+    fprintf(log_file, "* Timer slack:\t\tAC %d\tBATT %d\n", screen_conf->timer_slack[ON_AC], screen_conf->timer_slack[ON_BATTERY]);
 }
 
 static void log_inh_conf(inh_conf_t *inh_conf) {
@@ -130,20 +198,28 @@ static void log_inh_conf(inh_conf_t *inh_conf) {
 
 void log_conf(void) {
     if (log_file) {
-        time_t t = time(NULL);
+        /* Written directly, after any queued line */
+        log_flush();
+        time_t t = clock_now();
 
         /* Start with a newline if any log is above */
         fprintf(log_file, "%sClight\n", ftell(log_file) != 0 ? "\n" : "");
         fprintf(log_file, "* Software version:\t\t%s\n", VERSION);
         fprintf(log_file, "* Global config dir:\t\t%s\n", CONFDIR);
         fprintf(log_file, "* Global data dir:\t\t%s\n", DATADIR);
-        fprintf(log_file, "* Starting time:\t\t%s\n", ctime(&t));
+        fprintf(log_file, "* Starting time:\t\t%s", ctime(&t));
+        fprintf(log_file, "* Clock:\t\t%s\n", clock_name());
         
         fprintf(log_file, "Starting options:\n");
         
         fprintf(log_file, "\n### GENERIC ###\n");
         fprintf(log_file, "* Verbose (debug):\t\t%s\n", conf.verbose ? "Enabled" : "Disabled");
         fprintf(log_file, "* ResumeDelay:\t\t%d\n", conf.resumedelay);
+        fprintf(log_file, "* Modules budget:\t\t%d ms\n", conf.budget_conf.budget);
+        fprintf(log_file, "* Modules throttle:\t\t%d\n", conf.budget_conf.throttle);
+        for (int i = 0; i < conf.budget_conf.num_modules; i++) {
+            fprintf(log_file, "* %s budget:\t\t%d ms\n", conf.budget_conf.modules[i].name, conf.budget_conf.modules[i].budget);
+        }
         
         if (!conf.bl_conf.disabled) {
             log_bl_conf(&conf.bl_conf);
@@ -184,36 +260,129 @@ void log_conf(void) {
 void log_message(const char *filename, int lineno, const char type, const char *log_msg, ...) {
     // Debug and plot message only in verbose mode
     if ((type != LOG_DEBUG && type != LOG_PLOT) || conf.verbose) {
-        va_list file_args, args;
-
-        va_start(file_args, log_msg);
-        va_copy(args, file_args);
+        va_list args;
+        va_start(args, log_msg);
 
-        if (log_file) {
-            if (type != LOG_PLOT) {
-                time_t t = time(NULL);
-                struct tm *tm = localtime(&t);
-                fprintf(log_file, "(%c)[%02d:%02d:%02d]{%s:%d}\t", type, tm->tm_hour, tm->tm_min, tm->tm_sec, filename, lineno);
+        if (writer_running && type != LOG_ERR) {
+            const uint64_t head = ring_head;
+            const uint64_t used = head - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE);
+            if (used >= ((type == LOG_DEBUG || type == LOG_PLOT) ? LOG_VERBOSE_SLOTS : LOG_RING_SLOTS)) {
+                __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+            } else {
+                format_line(&ring[head & (LOG_RING_SLOTS - 1)], filename, lineno, type, log_msg, args);
+                __atomic_store_n(&ring_head, head + 1, __ATOMIC_RELEASE);
+                sem_post(&ring_sem);
             }
-            vfprintf(log_file, log_msg, file_args);
-            fflush(log_file);
+        } else {
+            log_line_t l;
+            format_line(&l, filename, lineno, type, log_msg, args);
+            log_flush();
+            write_line(&l);
         }
+        va_end(args);
+    }
+}
 
-        /* In case of error, log to stdout too */
-        FILE *out = stdout;
-        if (type == LOG_ERR) {
-            out = stderr;
+static void format_line(log_line_t *l, const char *filename, int lineno, const char type, const char *log_msg, va_list args) {
+    l->type = type;
+    l->msg_off = 0;
+    if (type != LOG_PLOT) {
+        time_t t = clock_now();
+        /* Do not clobber localtime() buffer of whoever is logging */
+        struct tm tm = {0};
+        localtime_r(&t, &tm);
+        l->msg_off = snprintf(l->line, LOG_LINE_MAX, "(%c)[%02d:%02d:%02d]{%s:%d}\t", type, tm.tm_hour, tm.tm_min, tm.tm_sec, filename, lineno);
+        if (l->msg_off >= LOG_LINE_MAX) {
+            l->msg_off = LOG_LINE_MAX - 1;
         }
+    }
+    l->len = l->msg_off + vsnprintf(l->line + l->msg_off, LOG_LINE_MAX - l->msg_off, log_msg, args);
+    if (l->len >= LOG_LINE_MAX) {
+        /* Truncated: keep it a line */
+        l->len = LOG_LINE_MAX - 1;
+        l->line[l->len - 1] = '\n';
+    }
+}
 
-        vfprintf(out, log_msg, args);
-        va_end(args);
-        va_end(file_args);
+static void write_line(const log_line_t *l) {
+    if (log_file) {
+        fwrite(l->line, 1, l->len, log_file);
+        fflush(log_file);
     }
+
+    /* In case of error, log to stdout too */
+    FILE *out = stdout;
+    if (l->type == LOG_ERR) {
+        out = stderr;
+    }
+    fwrite(l->line + l->msg_off, 1, l->len - l->msg_off, out);
+}
+
+static void *log_writer(UNUSED void *arg) {
+    while (!__atomic_load_n(&writer_quit, __ATOMIC_ACQUIRE)) {
+        if (sem_wait(&ring_sem) == 0) {
+            drain_ring();
+        }
+    }
+    drain_ring();
+    return NULL;
+}
+
+/* Only called by writer thread */
+static void drain_ring(void) {
+    uint64_t tail = ring_tail;
+    const uint64_t head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+    if (tail == head) {
+        return;
+    }
+    for (; tail != head; tail++) {
+        const log_line_t *l = &ring[tail & (LOG_RING_SLOTS - 1)];
+        if (log_file) {
+            fwrite(l->line, 1, l->len, log_file);
+        }
+        fwrite(l->line + l->msg_off, 1, l->len - l->msg_off, stdout);
+        __atomic_store_n(&ring_tail, tail + 1, __ATOMIC_RELEASE);
+    }
+    
+    const uint64_t d = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+    if (d != reported_dropped) {
+        if (log_file) {
+            fprintf(log_file, "(%c){%s}\t%llu log lines dropped.\n", LOG_WARN, __FILENAME__, (unsigned long long)(d - reported_dropped));
+        }
+        reported_dropped = d;
+    }
+    if (log_file) {
+        fflush(log_file);
+    }
+    fflush(stdout);
+}
+
+/* Wait (a bounded time) for writer to write every queued line */
+void log_flush(void) {
+    for (int i = 0; writer_running && i < LOG_FLUSH_MAX_MS && 
+        __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) != ring_head; i++) {
+        
+        nanosleep(&(struct timespec){ 0, 1000000 }, NULL);
+    }
+}
+
+uint64_t log_dropped_lines(void) {
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
 }
 
 void close_log(void) {
+    if (writer_running) {
+        writer_running = false;
+        __atomic_store_n(&writer_quit, true, __ATOMIC_RELEASE);
+        sem_post(&ring_sem);
+        /* We may be called by sigsegv handler while on writer thread */
+        if (!pthread_equal(pthread_self(), writer)) {
+            pthread_join(writer, NULL);
+        }
+    }
     if (log_file) {
         flock(fileno(log_file), LOCK_UN);
         fclose(log_file);
+        log_file = NULL;
     }
 }
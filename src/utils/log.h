@@ -1,6 +1,7 @@
 #pragma once
 
 #include <setjmp.h>
+#include <stdint.h>
 
 /* Internal; not exposed through public API */
 #define LOG_ERR     'E'
@@ -19,4 +20,6 @@ do { \
 
 void open_log(void);
 void log_conf(void);
+void log_flush(void);
+uint64_t log_dropped_lines(void);
 void close_log(void);
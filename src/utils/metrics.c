@@ -0,0 +1,236 @@
+#include <inttypes.h>
+#include <unistd.h>
+#include <module/map.h>
+#include "metrics.h"
+#include "timer.h"
+#include "lagmon.h"
+#include "utils.h"
+
+/**
+ * METRICS service periodically writes Clight metrics to conf.metrics_conf.file,
+ * in Prometheus text format, eg: for node_exporter textfile collector.
+ * File is written to a temp file then renamed, so that it is never scraped half written,
+ * and it is removed on exit, so that stale values are not scraped either.
+ *
+ * Counters are updated by modules through metrics_*() calls even when METRICS is not running:
+ * they are just a few increments.
+ */
+
+#define MAX_PAUSE_MODULES   16
+
+typedef struct {
+    const char *name;                       // module name, as passed to MODULE_WITH_PAUSE()
+    int paused_state;                       // enum mod_pause bitmask
+} mod_pause_t;
+
+static void on_metrics_timer(UNUSED void *userdata);
+static void write_metrics(void);
+static void write_label(FILE *f, const char *value);
+
+static uint64_t captures[2];                // failed, succeeded
+static double capture_sum_ms, capture_max_ms;
+static map_t *bl_sets;                      // monitor id -> uint64_t number of backlight Set calls
+static uint64_t bl_sets_all;                // Set calls on every monitor at once
+static mod_pause_t pauses[MAX_PAUSE_MODULES];
+static int num_pauses;
+static int inhibit_locks;
+static int metrics_timer = -1;
+static int metrics_slack[SIZE_AC];
+
+MODULE("METRICS");
+
+static void init(void) {
+    PROFILE_FUNC();
+    metrics_timer = start_timer(1, 0);
+    register_timer(metrics_timer, on_metrics_timer, NULL);
+    /* Metrics are not time critical: let them expire together with any other timer */
+    for (int i = ON_AC; i < SIZE_AC; i++) {
+        metrics_slack[i] = conf.metrics_conf.interval / 2;
+    }
+    set_timer_slack(metrics_timer, metrics_slack);
+}
+
+static bool check(void) {
+    return true;
+}
+
+static bool evaluate(void) {
+    return !conf.wizard && !is_string_empty(conf.metrics_conf.file);
+}
+
+static void destroy(void) {
+    if (metrics_timer >= 0) {
+        stop_timer(metrics_timer);
+        unlink(conf.metrics_conf.file);
+    }
+    map_free(bl_sets);
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    /* Only driven by its timer */
+}
+
+void metrics_capture(bool ok, double ms) {
+    captures[ok]++;
+    capture_sum_ms += ms;
+    if (ms > capture_max_ms) {
+        capture_max_ms = ms;
+    }
+}
+
+/* NULL mon_id: Set called on every monitor at once */
+void metrics_bl_set(const char *mon_id) {
+    if (!mon_id) {
+        bl_sets_all++;
+        return;
+    }
+
+    if (!bl_sets) {
+        bl_sets = map_new(true, free);
+    }
+    uint64_t *count = map_get(bl_sets, mon_id);
+    if (!count) {
+        count = calloc(1, sizeof(uint64_t));
+        if (!count) {
+            return;
+        }
+        map_put(bl_sets, mon_id, count);
+    }
+    (*count)++;
+}
+
+void metrics_pause(const char *module, int paused_state) {
+    for (int i = 0; i < num_pauses; i++) {
+        if (pauses[i].name == module) {
+            pauses[i].paused_state = paused_state;
+            return;
+        }
+    }
+    if (num_pauses < MAX_PAUSE_MODULES) {
+        pauses[num_pauses].name = module;
+        pauses[num_pauses++].paused_state = paused_state;
+    }
+}
+
+void metrics_inhibit_locks(int locks) {
+    inhibit_locks = locks;
+}
+
+static void on_metrics_timer(UNUSED void *userdata) {
+    write_metrics();
+    set_timeout(conf.metrics_conf.interval, 0, metrics_timer, 0);
+}
+
+#define METRIC(f, name, type, help) fprintf(f, "# HELP " name " " help "\n# TYPE " name " " type "\n")
+#define GAUGE(f, name, help, fmt, val) METRIC(f, name, "gauge", help); fprintf(f, name " " fmt "\n", val)
+
+static void write_metrics(void) {
+    char tmp_path[PATH_MAX + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", conf.metrics_conf.file);
+    FILE *f = fopen(tmp_path, "we");
+    if (!f) {
+        DEBUG("Failed to write metrics to %s: %s\n", tmp_path, strerror(errno));
+        return;
+    }
+
+    /* Backlight */
+    METRIC(f, "clight_captures_total", "counter", "Ambient brightness captures.");
+    fprintf(f, "clight_captures_total{result=\"ok\"} %" PRIu64 "\n", captures[true]);
+    fprintf(f, "clight_captures_total{result=\"error\"} %" PRIu64 "\n", captures[false]);
+    METRIC(f, "clight_capture_duration_seconds", "summary", "Ambient brightness capture duration.");
+    fprintf(f, "clight_capture_duration_seconds_sum %.6lf\n", capture_sum_ms / 1000);
+    fprintf(f, "clight_capture_duration_seconds_count %" PRIu64 "\n", captures[false] + captures[true]);
+    GAUGE(f, "clight_capture_duration_max_seconds", "Longest ambient brightness capture.", "%.6lf", capture_max_ms / 1000);
+    METRIC(f, "clight_backlight_sets_total", "counter", "Backlight Set calls, per monitor; \"*\" for calls on every monitor.");
+    fprintf(f, "clight_backlight_sets_total{monitor=\"*\"} %" PRIu64 "\n", bl_sets_all);
+    for (map_itr_t *itr = map_itr_new(bl_sets); itr; itr = map_itr_next(itr)) {
+        fprintf(f, "clight_backlight_sets_total{monitor=");
+        write_label(f, map_itr_get_key(itr));
+        fprintf(f, "} %" PRIu64 "\n", *(uint64_t *)map_itr_get_data(itr));
+    }
+
+    /* Modules */
+    static const struct { const char *name; enum mod_pause reason; } reasons[] = {
+#define X(name, value) { #name, name },
+        X_FIELDS
+#undef X
+    };
+    METRIC(f, "clight_module_paused", "gauge", "Whether a module is paused for given reason.");
+    for (int i = 0; i < num_pauses; i++) {
+        for (size_t j = 0; j < sizeof(reasons) / sizeof(*reasons); j++) {
+            if (reasons[j].reason != UNPAUSED) {
+                fprintf(f, "clight_module_paused{module=\"%s\",reason=\"%s\"} %d\n", 
+                        pauses[i].name, reasons[j].name, !!(pauses[i].paused_state & reasons[j].reason));
+            }
+        }
+    }
+    GAUGE(f, "clight_inhibit_locks", "ScreenSaver inhibitions currently held.", "%d", inhibit_locks);
+
+    /* Loop */
+    const loop_lag_t *lag = timer_loop_lag();
+    METRIC(f, "clight_loop_lag_seconds", "summary", "Delay between a timer expiration and the loop serving it.");
+    fprintf(f, "clight_loop_lag_seconds_sum %.6lf\n", lag->sum_ms / 1000);
+    fprintf(f, "clight_loop_lag_seconds_count %" PRIu64 "\n", lag->samples);
+    GAUGE(f, "clight_loop_lag_max_seconds", "Longest loop lag.", "%.6lf", lag->max_ms / 1000);
+    const lag_hist_t *probe = lag_histogram();
+    if (probe->samples > 0) {
+        METRIC(f, "clight_loop_lag_probe_seconds", "histogram", "Loop lag measured by LAGMON probe.");
+        uint64_t cumulative = 0;
+        for (int i = 0; i < LAG_BUCKETS - 1; i++) {
+            cumulative += probe->counts[i];
+            fprintf(f, "clight_loop_lag_probe_seconds_bucket{le=\"%g\"} %" PRIu64 "\n", probe->bounds[i] / 1000, cumulative);
+        }
+        fprintf(f, "clight_loop_lag_probe_seconds_bucket{le=\"+Inf\"} %" PRIu64 "\n", probe->samples);
+        fprintf(f, "clight_loop_lag_probe_seconds_sum %.6lf\n", probe->sum_ms / 1000);
+        fprintf(f, "clight_loop_lag_probe_seconds_count %" PRIu64 "\n", probe->samples);
+    }
+    METRIC(f, "clight_log_dropped_lines_total", "counter", "Log lines dropped because log writer could not keep up.");
+    fprintf(f, "clight_log_dropped_lines_total %" PRIu64 "\n", log_dropped_lines());
+    GAUGE(f, "clight_timer_wakeups_per_hour", "Timer wakeups per hour.", "%.3lf", timer_wakeups_per_hour());
+
+    /* State */
+    GAUGE(f, "clight_backlight_pct", "Current backlight level.", "%.3lf", state.current_bl_pct);
+    GAUGE(f, "clight_kbd_backlight_pct", "Current keyboard backlight level.", "%.3lf", state.current_kbd_pct);
+    GAUGE(f, "clight_ambient_brightness", "Last captured ambient brightness.", "%.3lf", state.ambient_br);
+    GAUGE(f, "clight_screen_brightness", "Current screen content brightness.", "%.3lf", state.screen_br);
+    GAUGE(f, "clight_gamma_temp_kelvin", "Current gamma temperature.", "%d", state.current_temp);
+    GAUGE(f, "clight_day_time", "Current day time: 0 day, 1 night.", "%d", state.day_time);
+    GAUGE(f, "clight_in_event", "Whether in a sunrise/sunset event.", "%d", state.in_event);
+    GAUGE(f, "clight_next_event", "Next day event: 0 sunrise, 1 sunset.", "%d", state.next_event);
+    GAUGE(f, "clight_sunrise_timestamp_seconds", "Today sunrise time.", "%ld", (long)state.day_events[SUNRISE]);
+    GAUGE(f, "clight_sunset_timestamp_seconds", "Today sunset time.", "%ld", (long)state.day_events[SUNSET]);
+    GAUGE(f, "clight_display_state", "Display state: 0 on, 1 dimmed, 2 off (bitmask).", "%d", state.display_state);
+    GAUGE(f, "clight_ac_state", "AC state: 0 on ac, 1 on battery.", "%d", state.ac_state);
+    GAUGE(f, "clight_lid_state", "Lid state: 0 open, 1 closed, 2 docked.", "%d", state.lid_state);
+    GAUGE(f, "clight_inhibited", "Whether ScreenSaver inhibition is active.", "%d", state.inhibited);
+    GAUGE(f, "clight_pm_inhibited", "Whether PowerManagement inhibition is active.", "%d", state.pm_inhibited);
+    GAUGE(f, "clight_sensor_available", "Whether a sensor is available.", "%d", state.sens_avail);
+    GAUGE(f, "clight_suspended", "Whether Clight is suspended.", "%d", state.suspended);
+
+    const bool failed = ferror(f);
+    if (fclose(f) != 0 || failed || rename(tmp_path, conf.metrics_conf.file) == -1) {
+        DEBUG("Failed to write metrics to %s: %s\n", conf.metrics_conf.file, strerror(errno));
+        unlink(tmp_path);
+    }
+}
+
+/* Quote and escape a label value */
+static void write_label(FILE *f, const char *value) {
+    fputc('"', f);
+    for (const char *c = value; *c; c++) {
+        switch (*c) {
+        case '\\':
+        case '"':
+            fputc('\\', f);
+            fputc(*c, f);
+            break;
+        case '\n':
+            fputs("\\n", f);
+            break;
+        default:
+            fputc(*c, f);
+            break;
+        }
+    }
+    fputc('"', f);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "commons.h"
+
+void metrics_capture(bool ok, double ms);
+void metrics_bl_set(const char *mon_id);
+void metrics_pause(const char *module, int paused_state);
+void metrics_inhibit_locks(int locks);
@@ -2,16 +2,36 @@
 #include <gsl/gsl_statistics_double.h>
 #include "my_math.h"
 #include "utils.h"
+#include "clock.h"
 
 #define ZENITH -0.83
+#define SOLAR_DAYS              366         // days in solar events table, leap years included
+#define SOLAR_NO_EVENT          -1.0        // no sunrise/sunset on that day (polar day/night)
+#define SOLAR_CACHE_VERSION     1
+#define SOLAR_COORD_DIGITS      2           // solar table is keyed by lat/lon rounded to this number of decimals
+#define SOLAR_COORD_PREC        100.0
+
+typedef struct {
+    bool valid;
+    double lat, lon;                                // rounded location the table was computed for
+    double events[SOLAR_DAYS][SIZE_EVENTS];         // UTC time (seconds since midnight) of each event
+} solar_table_t;
 
 static void plot_poly_curve(curve_t *curve);
 static char **init_grid(int num_points);
 static void show_grid(char **grid, int num_points);
 static void free_grid(char **grid, int num_points);
-static float to_hours(const float rad);
+static double to_hours(const double rad);
+static double round_coord(const double coord);
+static double compute_solar_event(const double lat, const double lng, const int yday, enum day_events event);
+static void get_solar_cache_path(char *path, size_t size);
+static int load_solar_table(const double lat, const double lon);
+static void store_solar_table(void);
+static const solar_table_t *get_solar_table(const float lat, const float lng);
 static int calculate_sunrise_sunset(const float lat, const float lng, time_t *tt, enum day_events event, int dayshift);
 
+static solar_table_t solar_table;
+
 /*
  * Convert degrees to radians
  */
@@ -37,7 +57,7 @@ double compute_average(const double *intensity, int num) {
 /*
  * Big thanks to https://rosettacode.org/wiki/Polynomial_regression#C
  */
-void polynomialfit(double *XPoints, curve_t *curve, const char *tag) {
+static void fit_curve(double *XPoints, curve_t *curve) {
     double chisq;
     
     gsl_matrix *X = gsl_matrix_alloc(curve->num_points, DEGREE);
@@ -69,9 +89,30 @@ void polynomialfit(double *XPoints, curve_t *curve, const char *tag) {
     gsl_matrix_free(cov);
     gsl_vector_free(y);
     gsl_vector_free(c);
+}
+
+/*
+ * Fit curve points; parameters are only recomputed if points changed since last fit
+ * (eg: they are already fitted when conf is loaded from its snapshot).
+ * Custom XPoints are never cached.
+ */
+void polynomialfit(double *XPoints, curve_t *curve, const char *tag) {
+    PROFILE_SPAN("polynomialfit(%s)", tag);
+    
+    uint64_t h = hash_data(&curve->num_points, sizeof(curve->num_points), HASH_INIT);
+    h = hash_data(curve->points, curve->num_points * sizeof(double), h);
+    if (XPoints || curve->fit_hash != h) {
+        fit_curve(XPoints, curve);
+        curve->fit_hash = XPoints ? 0 : h;
+    } else {
+        DEBUG("%s curve: points unchanged, reusing fit.\n", tag);
+    }
     
     DEBUG("%s curve: y = %lf + %lfx + %lfx^2\n", tag, curve->fit_parameters[0], curve->fit_parameters[1], curve->fit_parameters[2]);
-    plot_poly_curve(curve);
+    /* Plot is only logged in verbose mode: do not even compute it otherwise */
+    if (log_verbose_enabled()) {
+        plot_poly_curve(curve);
+    }
 }
 
 double clamp(double value, double max, double min) {
@@ -153,73 +194,58 @@ static void free_grid(char **grid, int num_points) {
     free(grid);
 }
 
-static float to_hours(const float rad) {
+static double to_hours(const double rad) {
     return rad / 15.0;// 360 degree / 24 hours = 15 degrees/h
 }
 
+static double round_coord(const double coord) {
+    return round(coord * SOLAR_COORD_PREC) / SOLAR_COORD_PREC;
+}
+
 /*
- * Just a small function to compute sunset/sunrise for today (or tomorrow).
+ * Compute UTC time (seconds since midnight) of event for given day of the year.
  * See: http://stackoverflow.com/questions/7064531/sunrise-sunset-times-in-c
- * If conf.events[event] is set, it means "event" time is user-set.
- * So, only store in *tt its corresponding time_t values.
+ * Returns SOLAR_NO_EVENT if there is no sunrise/sunset that day (polar day/night).
  */
-static int calculate_sunrise_sunset(const float lat, const float lng, time_t *tt, enum day_events event, int dayshift) {
-    // 1. compute the day of the year (timeinfo->tm_yday below)
-    time(tt);
-    struct tm *timeinfo = localtime(tt);
-    if (!timeinfo) {
-        return -1;
-    }
-    // if needed, set dayshift
-    timeinfo->tm_yday += dayshift;
-    timeinfo->tm_mday += dayshift;
-    timeinfo->tm_sec = 0;
-
-    /* If user provided a sunrise/sunset time, use them */
-    if (!is_string_empty(conf.day_conf.day_events[event])) {
-        strptime(conf.day_conf.day_events[event], "%R", timeinfo);
-        *tt = mktime(timeinfo);
-        return 0;
-    }
-
-    // 2. convert the longitude to hour value and calculate an approximate time
-    float lngHour = to_hours(lng);
-    float t;
+static double compute_solar_event(const double lat, const double lng, const int yday, enum day_events event) {
+    // 1. convert the longitude to hour value and calculate an approximate time
+    const double lngHour = to_hours(lng);
+    double t;
     if (event == SUNRISE) {
-        t = timeinfo->tm_yday + (6.0 - lngHour) / 24.0;
+        t = yday + (6.0 - lngHour) / 24.0;
     } else {
-        t = timeinfo->tm_yday + (18.0 - lngHour) / 24.0;
+        t = yday + (18.0 - lngHour) / 24.0;
     }
 
-    // 3. calculate the Sun's mean anomaly
-    float M = (0.9856 * t) - 3.289;
+    // 2. calculate the Sun's mean anomaly
+    const double M = (0.9856 * t) - 3.289;
 
-    // 4. calculate the Sun's true longitude
-    float L = fmod(M + 1.916 * sin(degToRad(M)) + 0.020 * sin(2 * degToRad(M)) + 282.634, 360.0);
+    // 3. calculate the Sun's true longitude
+    const double L = fmod(M + 1.916 * sin(degToRad(M)) + 0.020 * sin(2 * degToRad(M)) + 282.634, 360.0);
 
-    // 5a. calculate the Sun's right ascension
-    float RA = fmod(radToDeg(atan(0.91764 * tan(degToRad(L)))), 360.0);
+    // 4a. calculate the Sun's right ascension
+    double RA = fmod(radToDeg(atan(0.91764 * tan(degToRad(L)))), 360.0);
 
-    // 5b. right ascension value needs to be in the same quadrant as L
-    float Lquadrant = floor(L / 90) * 90;
-    float RAquadrant = floor(RA / 90) * 90;
+    // 4b. right ascension value needs to be in the same quadrant as L
+    const double Lquadrant = floor(L / 90) * 90;
+    const double RAquadrant = floor(RA / 90) * 90;
     RA += (Lquadrant - RAquadrant);
 
-    // 5c. right ascension value needs to be converted into hours
+    // 4c. right ascension value needs to be converted into hours
     RA = to_hours(RA);
 
-    // 6. calculate the Sun's declination
-    float sinDec = 0.39782 * sin(degToRad(L));
-    float cosDec = cos(asin(sinDec));
+    // 5. calculate the Sun's declination
+    const double sinDec = 0.39782 * sin(degToRad(L));
+    const double cosDec = cos(asin(sinDec));
 
-    // 7a. calculate the Sun's local hour angle
-    float cosH = sin(degToRad(ZENITH)) - (sinDec * sin(degToRad(lat))) / (cosDec * cos(degToRad(lat)));
-    if ((cosH > 1 && event == SUNRISE) || (cosH < -1 && event == SUNSET)) {
-        return -2; // no sunrise/sunset today!
+    // 6a. calculate the Sun's local hour angle
+    const double cosH = (sin(degToRad(ZENITH)) - (sinDec * sin(degToRad(lat)))) / (cosDec * cos(degToRad(lat)));
+    if (cosH > 1 || cosH < -1) {
+        return SOLAR_NO_EVENT; // no sunrise/sunset today!
     }
 
-    // 7b. finish calculating H and convert into hours
-    float H;
+    // 6b. finish calculating H and convert into hours
+    double H;
     if (event == SUNRISE) {
         H = 360.0 - radToDeg(acos(cosH));
     } else {
@@ -227,21 +253,135 @@ static int calculate_sunrise_sunset(const float lat, const float lng, time_t *tt
     }
     H = to_hours(H);
 
-    // 8. calculate local mean time of rising/setting
-    float T = H + RA - (0.06571 * t) - 6.622;
+    // 7. calculate local mean time of rising/setting
+    const double T = H + RA - (0.06571 * t) - 6.622;
 
-    // 9. adjust back to UTC
-    float UT = fmod(24 + fmod(T - lngHour, 24.0), 24.0);
+    // 8. adjust back to UTC
+    const double UT = fmod(24 + fmod(T - lngHour, 24.0), 24.0);
+    return UT * 3600;
+}
 
-    double hours;
-    double minutes = modf(UT, &hours) * 60;
+static void get_solar_cache_path(char *path, size_t size) {
+    if (getenv("XDG_CACHE_HOME")) {
+        snprintf(path, size, "%s/clight_solar", getenv("XDG_CACHE_HOME"));
+    } else {
+        snprintf(path, size, "%s/.cache/clight_solar", getpwuid(getuid())->pw_dir);
+    }
+}
 
-    // set correct values
-    timeinfo->tm_hour = hours;
-    timeinfo->tm_min = minutes;
+static int load_solar_table(const double lat, const double lon) {
+    char path[PATH_MAX + 1];
+    get_solar_cache_path(path, sizeof(path));
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+
+    int version, r = -1;
+    if (fscanf(f, "%d %lf %lf\n", &version, &solar_table.lat, &solar_table.lon) == 3 &&
+        version == SOLAR_CACHE_VERSION && solar_table.lat == lat && solar_table.lon == lon) {
+
+        int i = 0;
+        while (i < SOLAR_DAYS &&
+               fscanf(f, "%lf %lf\n", &solar_table.events[i][SUNRISE], &solar_table.events[i][SUNSET]) == 2) {
+            i++;
+        }
+        if (i == SOLAR_DAYS) {
+            r = 0;
+        }
+    }
+    fclose(f);
+    return r;
+}
+
+static void store_solar_table(void) {
+    char path[PATH_MAX + 1];
+    get_solar_cache_path(path, sizeof(path));
+    FILE *f = fopen(path, "w");
+    if (f) {
+        fprintf(f, "%d %.*lf %.*lf\n", SOLAR_CACHE_VERSION,
+                SOLAR_COORD_DIGITS, solar_table.lat, SOLAR_COORD_DIGITS, solar_table.lon);
+        for (int i = 0; i < SOLAR_DAYS; i++) {
+            fprintf(f, "%.3lf %.3lf\n", solar_table.events[i][SUNRISE], solar_table.events[i][SUNSET]);
+        }
+        fclose(f);
+    } else {
+        WARN("Failed to store solar events cache: %s\n", strerror(errno));
+    }
+}
+
+/*
+ * Solar events table is computed once per location (rounded to SOLAR_COORD_DIGITS decimals),
+ * and cached on disk, so that following lookups are just an array access.
+ */
+static const solar_table_t *get_solar_table(const float lat, const float lng) {
+    const double rlat = round_coord(lat);
+    const double rlon = round_coord(lng);
+    if (solar_table.valid && solar_table.lat == rlat && solar_table.lon == rlon) {
+        return &solar_table;
+    }
+
+    if (load_solar_table(rlat, rlon) == 0) {
+        DEBUG("Solar events loaded from cache for %.2lf %.2lf.\n", rlat, rlon);
+    } else {
+        solar_table.lat = rlat;
+        solar_table.lon = rlon;
+        for (int i = 0; i < SOLAR_DAYS; i++) {
+            for (int j = 0; j < SIZE_EVENTS; j++) {
+                solar_table.events[i][j] = compute_solar_event(rlat, rlon, i, j);
+            }
+        }
+        DEBUG("Solar events computed for %.2lf %.2lf.\n", rlat, rlon);
+        store_solar_table();
+    }
+    solar_table.valid = true;
+    return &solar_table;
+}
+
+/*
+ * Just a small function to compute sunset/sunrise for today (or tomorrow).
+ * If conf.events[event] is set, it means "event" time is user-set.
+ * So, only store in *tt its corresponding time_t values.
+ */
+static int calculate_sunrise_sunset(const float lat, const float lng, time_t *tt, enum day_events event, int dayshift) {
+    // 1. compute the day of the year (timeinfo.tm_yday below)
+    *tt = clock_now();
+    /* Own copy: logging (eg: from get_solar_table()) calls localtime() too */
+    struct tm timeinfo;
+    if (!localtime_r(tt, &timeinfo)) {
+        return -1;
+    }
+    // if needed, set dayshift
+    timeinfo.tm_yday += dayshift;
+    timeinfo.tm_mday += dayshift;
+    timeinfo.tm_sec = 0;
+
+    /* If user provided a sunrise/sunset time, use them */
+    if (!is_string_empty(conf.day_conf.day_events[event])) {
+        strptime(conf.day_conf.day_events[event], "%R", &timeinfo);
+        *tt = mktime(&timeinfo);
+        return 0;
+    }
+
+    // 2. dayshift may move tm_yday out of current year: let timegm() normalize it
+    struct tm day = timeinfo;
+    day.tm_hour = 12;
+    timegm(&day);
+
+    // 3. lookup UTC event time for the day
+    const solar_table_t *table = get_solar_table(lat, lng);
+    const double ev = table->events[day.tm_yday][event];
+    if (ev == SOLAR_NO_EVENT) {
+        return -2; // no sunrise/sunset today!
+    }
+
+    // set correct values; timegm() normalizes seconds into hours and minutes
+    timeinfo.tm_hour = 0;
+    timeinfo.tm_min = 0;
+    timeinfo.tm_sec = (int)ev;
 
     // store in user provided ptr correct data
-    *tt = timegm(timeinfo);
+    *tt = timegm(&timeinfo);
     if (*tt == (time_t) -1) {
         return -1;
     }
@@ -256,6 +396,34 @@ int calculate_sunset(const float lat, const float lng, time_t *tt, int dayshift)
     return calculate_sunrise_sunset(lat, lng, tt, SUNSET, dayshift);
 }
 
+/*
+ * Sun elevation angle (degrees) at given time and location.
+ * See: https://gml.noaa.gov/grad/solcalc/solareqns.PDF
+ */
+double calculate_sun_elevation(const double lat, const double lng, const time_t t) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    const double hour = tm.tm_hour + tm.tm_min / 60.0 + tm.tm_sec / 3600.0;
+
+    // 1. fractional year (radians)
+    const double g = 2 * M_PI / 365 * (tm.tm_yday + (hour - 12) / 24);
+
+    // 2. equation of time (minutes) and solar declination (radians)
+    const double eqtime = 229.18 * (0.000075 + 0.001868 * cos(g) - 0.032077 * sin(g)
+                                    - 0.014615 * cos(2 * g) - 0.040849 * sin(2 * g));
+    const double decl = 0.006918 - 0.399912 * cos(g) + 0.070257 * sin(g)
+                        - 0.006758 * cos(2 * g) + 0.000907 * sin(2 * g)
+                        - 0.002697 * cos(3 * g) + 0.00148 * sin(3 * g);
+
+    // 3. true solar time (minutes) and solar hour angle (degrees)
+    const double tst = hour * 60 + eqtime + 4 * lng;
+    const double ha = tst / 4 - 180;
+
+    // 4. solar zenith angle
+    const double cos_zenith = sin(degToRad(lat)) * sin(decl) + cos(degToRad(lat)) * cos(decl) * cos(degToRad(ha));
+    return 90.0 - radToDeg(acos(clamp(cos_zenith, 1.0, -1.0)));
+}
+
 /*
  * Get distance between 2 locations
  */
@@ -268,3 +436,16 @@ double get_distance(loc_t *loc1, loc_t *loc2) {
     DEBUG("Loc distance: %.2lf,%.2lf -> %.2lf,%.2lf : %.2lf km.\n", loc1->lat, loc1->lon, loc2->lat, loc2->lon, dist);
     return dist;
 }
+
+/*
+ * 64-bit FNV-1a hash of data; pass HASH_INIT as h to start a new hash,
+ * or a previous result to chain multiple buffers.
+ */
+uint64_t hash_data(const void *data, size_t len, uint64_t h) {
+    const uint8_t *p = (const uint8_t *)data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
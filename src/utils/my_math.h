@@ -2,6 +2,8 @@
 
 #include "commons.h"
 
+#define HASH_INIT   0xcbf29ce484222325ULL   // initial value for hash_data()
+
 double degToRad(double angleDeg);
 double radToDeg(double angleRad);
 double compute_average(const double *intensity, int num);
@@ -10,4 +12,6 @@ double clamp(double value, double max, double min);
 double get_value_from_curve(const double perc, curve_t *curve);
 int calculate_sunrise(const float lat, const float lng, time_t *tt, int dayshift);
 int calculate_sunset(const float lat, const float lng, time_t *tt, int dayshift);
+double calculate_sun_elevation(const double lat, const double lng, const time_t t);
 double get_distance(loc_t *loc1, loc_t *loc2);
+uint64_t hash_data(const void *data, size_t len, uint64_t h);
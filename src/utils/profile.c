@@ -0,0 +1,133 @@
+#include "profile.h"
+#include "commons.h"
+
+#define MAX_PROFILE_SPANS   256
+
+typedef struct {
+    char name[64];
+    double start_ms;                        // since profiler start
+    double duration_ms;
+} profile_rec_t;
+
+static double elapsed_ms(const struct timespec *from, const struct timespec *to);
+static int cmp_duration(const void *a, const void *b);
+static void log_report(double total_ms, const char *reason);
+static void write_json(double total_ms, const char *reason);
+
+static bool enabled;
+static char *json_path;
+static struct timespec t0;
+static profile_rec_t recs[MAX_PROFILE_SPANS];
+static int num_recs, num_dropped;
+
+/* Called first thing in main(), so that option parsing is profiled too */
+void profile_start(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "--profile-startup", strlen("--profile-startup"))) {
+            enabled = true;
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            break;
+        }
+    }
+}
+
+void profile_set_json(const char *path) {
+    if (enabled && path) {
+        free(json_path);
+        json_path = strdup(path);
+    }
+}
+
+profile_span_t profile_begin(const char *fmt, ...) {
+    profile_span_t span = {{0}};
+    if (enabled) {
+        va_list args;
+        va_start(args, fmt);
+        vsnprintf(span.name, sizeof(span.name), fmt, args);
+        va_end(args);
+        clock_gettime(CLOCK_MONOTONIC, &span.start);
+    }
+    return span;
+}
+
+void profile_end(profile_span_t *span) {
+    if (!enabled || span->name[0] == '\0') {
+        return;
+    }
+    if (num_recs == MAX_PROFILE_SPANS) {
+        num_dropped++;
+        return;
+    }
+    
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    profile_rec_t *r = &recs[num_recs++];
+    strncpy(r->name, span->name, sizeof(r->name) - 1);
+    r->start_ms = elapsed_ms(&t0, &span->start);
+    r->duration_ms = elapsed_ms(&span->start, &now);
+}
+
+/* Stop profiling and report; reason describes startup end */
+void profile_done(const char *reason) {
+    if (!enabled) {
+        return;
+    }
+    enabled = false;
+    
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const double total_ms = elapsed_ms(&t0, &now);
+    
+    qsort(recs, num_recs, sizeof(profile_rec_t), cmp_duration);
+    if (json_path) {
+        write_json(total_ms, reason);
+        free(json_path);
+        json_path = NULL;
+    } else {
+        log_report(total_ms, reason);
+    }
+}
+
+static double elapsed_ms(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1000.0 + (to->tv_nsec - from->tv_nsec) / 1000000.0;
+}
+
+static int cmp_duration(const void *a, const void *b) {
+    const profile_rec_t *ra = (const profile_rec_t *)a;
+    const profile_rec_t *rb = (const profile_rec_t *)b;
+    return (ra->duration_ms < rb->duration_ms) - (ra->duration_ms > rb->duration_ms);
+}
+
+static void log_report(double total_ms, const char *reason) {
+    INFO("Startup took %.1lfms (until %s):\n", total_ms, reason);
+    for (int i = 0; i < num_recs; i++) {
+        INFO("  %8.2lfms (at %8.2lfms) %s\n", recs[i].duration_ms, recs[i].start_ms, recs[i].name);
+    }
+    if (num_dropped > 0) {
+        INFO("  %d more spans not recorded.\n", num_dropped);
+    }
+}
+
+static void write_json(double total_ms, const char *reason) {
+    FILE *f = fopen(json_path, "w");
+    if (!f) {
+        WARN("Failed to write startup profile to %s: %s\n", json_path, strerror(errno));
+        return;
+    }
+    
+    fprintf(f, "{\n  \"total_ms\": %.3lf,\n  \"until\": \"%s\",\n  \"dropped\": %d,\n  \"spans\": [", total_ms, reason, num_dropped);
+    for (int i = 0; i < num_recs; i++) {
+        fprintf(f, "%s\n    { \"name\": \"", i > 0 ? "," : "");
+        /* Names are file/function names and conf paths: only quotes and backslashes need escaping */
+        for (const char *c = recs[i].name; *c; c++) {
+            if (*c == '"' || *c == '\\') {
+                fputc('\\', f);
+            }
+            fputc(*c, f);
+        }
+        fprintf(f, "\", \"start_ms\": %.3lf, \"duration_ms\": %.3lf }", recs[i].start_ms, recs[i].duration_ms);
+    }
+    fprintf(f, "\n  ]\n}\n");
+    fclose(f);
+    INFO("Startup profile written to %s.\n", json_path);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <time.h>
+
+/*
+ * Startup profiler, enabled by --profile-startup.
+ * Spans are recorded from process start until first successful backlight set
+ * (or Clight exit), then a report sorted by duration is logged,
+ * or written as json to the path given to --profile-startup.
+ */
+typedef struct {
+    char name[64];                          // empty if profiler is disabled
+    struct timespec start;
+} profile_span_t;
+
+/* Time current scope; ends when the variable goes out of scope */
+#define PROFILE_SPAN(...)   profile_span_t _profile_span __attribute__((cleanup(profile_end))) = profile_begin(__VA_ARGS__)
+#define PROFILE_FUNC()      PROFILE_SPAN("%s:%s()", __FILENAME__, __func__)
+
+void profile_start(int argc, char *argv[]);
+void profile_set_json(const char *path);
+profile_span_t profile_begin(const char *fmt, ...);
+void profile_end(profile_span_t *span);
+void profile_done(const char *reason);
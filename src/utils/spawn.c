@@ -0,0 +1,329 @@
+#include <spawn.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include "commons.h"
+#include "timer.h"
+
+/**
+ * SPAWN service runs commands for clight_spawn() without blocking the loop.
+ *
+ * Each command gets a pipe for its stdout and stderr, and a pidfd to be notified of its exit;
+ * both are registered as SPAWN fds, thus callbacks are called from SPAWN receive().
+ * Without pidfd support, a child whose output reached EOF is reaped by a retry timer, never waited on.
+ * At most SPAWN_MAX_RUNNING commands run together; SPAWN_MAX_QUEUED more can wait for a free slot.
+ */
+
+#define SPAWN_MAX_RUNNING   4
+#define SPAWN_MAX_QUEUED    32
+#define SPAWN_REAP_RETRY_NS 250000000   // retry interval to reap children without pidfd
+
+typedef struct spawn_job {
+    char **argv;                            // NULL terminated copy of command argv
+    spawn_cb cb;
+    void *userdata;
+    pid_t pid;
+    int pidfd;                              // -1 if unsupported by kernel, or once child exited
+    int out_fd;                             // -1 once output is fully read
+    bool exited;
+    int status;
+    size_t len;
+    char output[CLIGHT_SPAWN_MAX_OUTPUT + 1];
+    struct spawn_job *next;
+} spawn_job_t;
+
+static spawn_job_t *new_job(const char *const argv[], spawn_cb cb, void *userdata);
+static void free_job(spawn_job_t *job);
+static void start_job(spawn_job_t *job);
+static void read_output(spawn_job_t *job);
+static void close_output(spawn_job_t *job);
+static void on_child_exit(spawn_job_t *job);
+static bool try_reap(spawn_job_t *job);
+static void on_reap_timer(UNUSED void *userdata);
+static void finish_job(spawn_job_t *job);
+
+static spawn_job_t *running, *queue_head, *queue_tail;
+static int num_running, num_queued;
+static int reap_timer = -1;
+
+MODULE("SPAWN");
+
+static void init(void) {
+    PROFILE_FUNC();
+    /* Commands fds are registered by clight_spawn() */
+}
+
+static bool check(void) {
+    return true;
+}
+
+static bool evaluate(void) {
+    return true;
+}
+
+static void destroy(void) {
+    if (reap_timer != -1) {
+        stop_timer(reap_timer);
+    }
+    /* fds are autoclosed; children are left running */
+    while (running) {
+        spawn_job_t *job = running;
+        running = job->next;
+        free_job(job);
+    }
+    while (queue_head) {
+        spawn_job_t *job = queue_head;
+        queue_head = job->next;
+        free_job(job);
+    }
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    switch (MSG_TYPE()) {
+    case FD_UPD: {
+        spawn_job_t *job = (spawn_job_t *)msg->fd_msg->userptr;
+        if (msg->fd_msg->fd == job->out_fd) {
+            read_output(job);
+        } else {
+            on_child_exit(job);
+        }
+        if (job->exited && job->out_fd == -1) {
+            finish_job(job);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+int clight_spawn(const char *const argv[], spawn_cb cb, void *userdata) {
+    if (!argv || !argv[0]) {
+        return -1;
+    }
+
+    if (num_running >= SPAWN_MAX_RUNNING && num_queued >= SPAWN_MAX_QUEUED) {
+        WARN("Too many queued commands; discarding '%s'.\n", argv[0]);
+        return -1;
+    }
+
+    spawn_job_t *job = new_job(argv, cb, userdata);
+    if (!job) {
+        return -1;
+    }
+
+    if (num_running < SPAWN_MAX_RUNNING) {
+        start_job(job);
+    } else {
+        DEBUG("Queueing '%s'.\n", argv[0]);
+        if (queue_tail) {
+            queue_tail->next = job;
+        } else {
+            queue_head = job;
+        }
+        queue_tail = job;
+        num_queued++;
+    }
+    return 0;
+}
+
+static spawn_job_t *new_job(const char *const argv[], spawn_cb cb, void *userdata) {
+    spawn_job_t *job = calloc(1, sizeof(spawn_job_t));
+    if (!job) {
+        return NULL;
+    }
+
+    int argc = 0;
+    while (argv[argc]) {
+        argc++;
+    }
+    job->argv = calloc(argc + 1, sizeof(char *));
+    if (!job->argv) {
+        free(job);
+        return NULL;
+    }
+    for (int i = 0; i < argc; i++) {
+        job->argv[i] = strdup(argv[i]);
+    }
+    job->cb = cb;
+    job->userdata = userdata;
+    job->pidfd = -1;
+    job->out_fd = -1;
+    return job;
+}
+
+static void free_job(spawn_job_t *job) {
+    for (int i = 0; job->argv[i]; i++) {
+        free(job->argv[i]);
+    }
+    free(job->argv);
+    free(job);
+}
+
+static void start_job(spawn_job_t *job) {
+    job->next = running;
+    running = job;
+    num_running++;
+
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC | O_NONBLOCK) == -1) {
+        WARN("Failed to create pipe for '%s': %s\n", job->argv[0], strerror(errno));
+        job->exited = true;
+        job->status = -1;
+        finish_job(job);
+        return;
+    }
+
+    /* Child output goes to pipe; stdin is /dev/null */
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDERR_FILENO);
+
+    /* SIGNAL module blocks signals for the whole process: restore them in child */
+    posix_spawnattr_t attr;
+    sigset_t mask;
+    posix_spawnattr_init(&attr);
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGTSTP);
+    sigaddset(&mask, SIGCONT);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &mask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    extern char **environ;
+    int r = posix_spawnp(&job->pid, job->argv[0], &actions, &attr, job->argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(pipefd[1]);
+
+    if (r != 0) {
+        WARN("Failed to spawn '%s': %s\n", job->argv[0], strerror(r));
+        close(pipefd[0]);
+        job->exited = true;
+        job->status = -1;
+        finish_job(job);
+        return;
+    }
+
+    DEBUG("Spawned '%s' (pid %d).\n", job->argv[0], job->pid);
+    job->out_fd = pipefd[0];
+    m_register_fd(job->out_fd, true, job);
+#ifdef SYS_pidfd_open
+    job->pidfd = syscall(SYS_pidfd_open, job->pid, 0);
+#endif
+    if (job->pidfd >= 0) {
+        m_register_fd(job->pidfd, true, job);
+    } else {
+        DEBUG("pidfd unsupported; '%s' will be reaped on output EOF.\n", job->argv[0]);
+    }
+}
+
+static void read_output(spawn_job_t *job) {
+    char buf[512];
+    ssize_t r;
+    while ((r = read(job->out_fd, buf, sizeof(buf))) > 0) {
+        /* Keep first CLIGHT_SPAWN_MAX_OUTPUT bytes; discard the rest so that child never blocks */
+        const size_t avail = CLIGHT_SPAWN_MAX_OUTPUT - job->len;
+        const size_t n = (size_t)r < avail ? (size_t)r : avail;
+        memcpy(job->output + job->len, buf, n);
+        job->len += n;
+    }
+    if (r == 0 || (r == -1 && errno != EAGAIN && errno != EINTR)) {
+        close_output(job);
+        if (job->pidfd == -1 && !job->exited && !try_reap(job)) {
+            /* No pidfd: child closed its output, it should be exiting; retry later */
+            if (reap_timer == -1) {
+                reap_timer = start_timer(0, 0);
+                register_timer(reap_timer, on_reap_timer, NULL);
+            }
+            set_timeout(0, SPAWN_REAP_RETRY_NS, reap_timer, 0);
+        }
+    }
+}
+
+static void close_output(spawn_job_t *job) {
+    m_deregister_fd(job->out_fd);
+    job->out_fd = -1;
+}
+
+static void on_child_exit(spawn_job_t *job) {
+    if (waitpid(job->pid, &job->status, WNOHANG) == job->pid) {
+        job->exited = true;
+        m_deregister_fd(job->pidfd);
+        job->pidfd = -1;
+
+        /*
+         * Collect any output left, then stop reading:
+         * a background grandchild could keep the pipe open forever.
+         */
+        if (job->out_fd != -1) {
+            read_output(job);
+            if (job->out_fd != -1) {
+                close_output(job);
+            }
+        }
+    }
+}
+
+static bool try_reap(spawn_job_t *job) {
+    if (waitpid(job->pid, &job->status, WNOHANG) == job->pid) {
+        job->exited = true;
+    }
+    return job->exited;
+}
+
+/* Reap children without pidfd whose output is closed */
+static void on_reap_timer(UNUSED void *userdata) {
+    bool waiting = false;
+    for (spawn_job_t *job = running, *next; job; job = next) {
+        next = job->next;
+        if (job->pidfd == -1 && job->out_fd == -1 && !job->exited) {
+            if (try_reap(job)) {
+                finish_job(job);
+            } else {
+                waiting = true;
+            }
+        }
+    }
+    if (waiting) {
+        set_timeout(0, SPAWN_REAP_RETRY_NS, reap_timer, 0);
+    }
+}
+
+static void finish_job(spawn_job_t *job) {
+    for (spawn_job_t **j = &running; *j; j = &(*j)->next) {
+        if (*j == job) {
+            *j = job->next;
+            break;
+        }
+    }
+    num_running--;
+
+    DEBUG("'%s' exited with status %d.\n", job->argv[0], job->status);
+    job->output[job->len] = '\0';
+    if (job->cb) {
+        job->cb(job->status, job->output, job->len, job->userdata);
+    }
+    free_job(job);
+
+    /* Start next queued command */
+    if (queue_head) {
+        spawn_job_t *next = queue_head;
+        queue_head = next->next;
+        if (!queue_head) {
+            queue_tail = NULL;
+        }
+        num_queued--;
+        next->next = NULL;
+        start_job(next);
+    }
+}
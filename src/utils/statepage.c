@@ -0,0 +1,97 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "statepage.h"
+
+/**
+ * Shared state page: a memfd holding a clight_state_page_t snapshot of state,
+ * updated by INTERFACE on each _UPD message, right where it emits bus PropertiesChanged.
+ * Its size is sealed; on kernels that support it, new writable mappings are sealed too,
+ * so that readers can only ever map it read-only.
+ */
+
+static clight_state_page_t *page;
+static int page_fd = -1;
+
+int state_page_init(void) {
+    page_fd = memfd_create("clight-state", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (page_fd == -1) {
+        goto err;
+    }
+    if (ftruncate(page_fd, sizeof(clight_state_page_t)) == -1) {
+        goto err;
+    }
+    page = mmap(NULL, sizeof(clight_state_page_t), PROT_READ | PROT_WRITE, MAP_SHARED, page_fd, 0);
+    if (page == MAP_FAILED) {
+        page = NULL;
+        goto err;
+    }
+
+    int seals = F_SEAL_SHRINK | F_SEAL_GROW;
+#ifdef F_SEAL_FUTURE_WRITE
+    seals |= F_SEAL_FUTURE_WRITE;
+#endif
+    if (fcntl(page_fd, F_ADD_SEALS, seals) == -1) {
+        DEBUG("Failed to seal state page: %s\n", strerror(errno));
+    }
+
+    page->version = CLIGHT_STATE_PAGE_VERSION;
+    page->size = sizeof(clight_state_page_t);
+    page->running = 1;
+    state_page_update();
+    return 0;
+
+err:
+    WARN("Failed to create state page: %s\n", strerror(errno));
+    state_page_destroy();
+    return -1;
+}
+
+void state_page_update(void) {
+    if (!page) {
+        return;
+    }
+
+    /* Seqlock write side: readers retry while seq is odd or changed under them */
+    const uint32_t seq = page->seq;
+    __atomic_store_n(&page->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    page->sunrise = state.day_events[SUNRISE];
+    page->sunset = state.day_events[SUNSET];
+    page->next_event = state.next_event;
+    page->day_time = state.day_time;
+    page->in_event = state.in_event;
+    page->display_state = state.display_state;
+    page->ac_state = state.ac_state;
+    page->lid_state = state.lid_state;
+    page->inhibited = state.inhibited;
+    page->pm_inhibited = state.pm_inhibited;
+    page->sens_avail = state.sens_avail;
+    page->suspended = state.suspended;
+    page->temp = state.current_temp;
+    page->bl_pct = state.current_bl_pct;
+    page->kbd_pct = state.current_kbd_pct;
+    page->ambient_br = state.ambient_br;
+    page->screen_br = state.screen_br;
+    page->loc = state.current_loc;
+
+    __atomic_store_n(&page->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+int state_page_fd(void) {
+    return page_fd;
+}
+
+void state_page_destroy(void) {
+    if (page) {
+        /* Let readers know page is stale; they may keep their mapping as long as they want */
+        __atomic_store_n(&page->running, 0, __ATOMIC_RELEASE);
+        munmap(page, sizeof(clight_state_page_t));
+        page = NULL;
+    }
+    if (page_fd != -1) {
+        close(page_fd);
+        page_fd = -1;
+    }
+}
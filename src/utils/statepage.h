@@ -0,0 +1,8 @@
+#pragma once
+
+#include "commons.h"
+
+int state_page_init(void);
+void state_page_update(void);
+int state_page_fd(void);
+void state_page_destroy(void);
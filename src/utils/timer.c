@@ -1,80 +1,486 @@
 #include <sys/timerfd.h>
 #include "timer.h"
 
-static time_t get_timeout_sec(int fd);
+/**
+ * TIMER service multiplexes every module timer onto a single CLOCK_BOOTTIME timerfd.
+ *
+ * Timers are kept in a hierarchical timing wheel: WHEEL_LEVELS levels of WHEEL_SLOTS slots each,
+ * with a 1s tick on level 0; each upper level tick spans a whole lower level.
+ * Timers farther than wheel range are parked in the farthest slot and re-cascaded later.
+ * The timerfd is always armed at the exact (ns) earliest deadline,
+ * thus the wheel resolution only affects bucketing, not expiration precision.
+ *
+ * Timers follow timerfd semantics: set_timeout() and reset_timer() behave as before;
+ * register_timer()/deregister_timer() mimic m_register_fd()/m_deregister_fd():
+ * a deregistered timer that expires is remembered and delivered as soon as it gets registered again.
+ *
+ * To reduce wakeups, a timer can be given a slack (per ac state, in seconds):
+ * its relative deadlines are then delayed by up to slack to expire together with another timer,
+ * or aligned to a slack multiple, so that timers with same slack naturally expire together.
+ */
+
+#define WHEEL_LEVELS    4
+#define WHEEL_BITS      6
+#define WHEEL_SLOTS     (1 << WHEEL_BITS)
+#define WHEEL_MASK      (WHEEL_SLOTS - 1)
+#define NS_PER_TICK     1000000000ULL
+#define LEVEL_SHIFT(l)  (WHEEL_BITS * (l))
+
+typedef struct clight_timer {
+    int id;
+    uint64_t deadline;              // absolute CLOCK_BOOTTIME deadline in ns; 0 when disarmed
+    uint64_t armed_at;              // CLOCK_BOOTTIME time (ns) of last relative timeout; 0 otherwise
+    int level;                      // wheel level the timer is linked in; -1 otherwise
+    bool registered;                // whether expirations are delivered to cb
+    bool pending;                   // expired while not registered
+    const int *slack;               // coalescing window (s) for each ac state; NULL if unset
+    timer_cb cb;
+    void *userdata;
+    struct clight_timer *next;
+    struct clight_timer **pprev;    // NULL when not linked in any list
+} clight_timer_t;
+
+static uint64_t now_ns(void);
+static clight_timer_t *get_timer(int id);
+static void link_timer(clight_timer_t **head, clight_timer_t *t, int level);
+static void unlink_timer(clight_timer_t *t);
+static void wheel_insert(clight_timer_t *t);
+static void wheel_cascade(int level);
+static void wheel_collect(clight_timer_t **expired, uint64_t now);
+static uint64_t wheel_next_step(uint64_t target);
+static void wheel_run(void);
+static void arm_timerfd(void);
+static uint64_t coalesce_deadline(const clight_timer_t *t, uint64_t deadline, uint64_t slack);
+static time_t get_timeout_sec(clight_timer_t *t);
+static time_t get_elapsed_sec(clight_timer_t *t, int old_timer, time_t timeout);
+
+static int timer_fd = -1;
+static uint64_t armed_deadline;
+static uint64_t wheel_tick;
+static clight_timer_t *wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+static int level_count[WHEEL_LEVELS];
+static clight_timer_t **timers;
+static int num_timers;
+static uint64_t start_ns, num_wakeups;
+static loop_lag_t loop_lag;
+
+MODULE("TIMER");
+
+static void module_pre_start(void) {
+    /* Create the timerfd before any module init() can start a timer */
+    timer_fd = timerfd_create(CLOCK_BOOTTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    start_ns = now_ns();
+    wheel_tick = start_ns / NS_PER_TICK;
+}
+
+static void init(void) {
+    PROFILE_FUNC();
+    if (timer_fd == -1) {
+        ERROR("TIMER: timerfd_create() failed: %s\n", strerror(errno));
+    }
+    m_register_fd(timer_fd, false, NULL);
+}
+
+static bool check(void) {
+    return true;
+}
+
+static bool evaluate(void) {
+    return true;
+}
+
+static void destroy(void) {
+    /* Timers are owned (and stopped) by their modules */
+    if (timer_fd >= 0) {
+        close(timer_fd);
+        timer_fd = -1;
+    }
+}
+
+static void receive(const msg_t *const msg, UNUSED const void* userdata) {
+    switch (MSG_TYPE()) {
+    case FD_UPD: {
+        uint64_t t;
+        read(msg->fd_msg->fd, &t, sizeof(uint64_t));
+        num_wakeups++;
+        if (armed_deadline > 0) {
+            /* Time the loop spent busy elsewhere before serving the expiration */
+            const uint64_t now = now_ns();
+            const double lag_ms = now > armed_deadline ? (now - armed_deadline) / 1000000.0 : 0;
+            loop_lag.samples++;
+            loop_lag.sum_ms += lag_ms;
+            if (lag_ms > loop_lag.max_ms) {
+                loop_lag.max_ms = lag_ms;
+            }
+        }
+        armed_deadline = 0;
+        wheel_run();
+        arm_timerfd();
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return ts.tv_sec * NS_PER_TICK + ts.tv_nsec;
+}
+
+static clight_timer_t *get_timer(int id) {
+    if (id >= 0 && id < num_timers && timers[id]) {
+        return timers[id];
+    }
+    WARN("Wrong timer id: %d.\n", id);
+    return NULL;
+}
+
+static void link_timer(clight_timer_t **head, clight_timer_t *t, int level) {
+    t->next = *head;
+    if (t->next) {
+        t->next->pprev = &t->next;
+    }
+    t->pprev = head;
+    *head = t;
+    t->level = level;
+    if (level >= 0) {
+        level_count[level]++;
+    }
+}
+
+static void unlink_timer(clight_timer_t *t) {
+    if (t->pprev) {
+        *t->pprev = t->next;
+        if (t->next) {
+            t->next->pprev = t->pprev;
+        }
+        t->next = NULL;
+        t->pprev = NULL;
+        if (t->level >= 0) {
+            level_count[t->level]--;
+        }
+        t->level = -1;
+    }
+}
+
+static void wheel_insert(clight_timer_t *t) {
+    uint64_t tick = t->deadline / NS_PER_TICK;
+    if (tick < wheel_tick) {
+        tick = wheel_tick;
+    }
+    const uint64_t delta = tick - wheel_tick;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ULL << LEVEL_SHIFT(level + 1))) {
+        level++;
+    }
+    if (delta >= (1ULL << LEVEL_SHIFT(WHEEL_LEVELS))) {
+        /* Out of wheel range: park it in the farthest slot */
+        tick = wheel_tick + (1ULL << LEVEL_SHIFT(WHEEL_LEVELS)) - 1;
+    }
+    link_timer(&wheel[level][(tick >> LEVEL_SHIFT(level)) & WHEEL_MASK], t, level);
+}
+
+/* Move timers of current slot of level down to lower levels */
+static void wheel_cascade(int level) {
+    clight_timer_t **slot = &wheel[level][(wheel_tick >> LEVEL_SHIFT(level)) & WHEEL_MASK];
+    while (*slot) {
+        clight_timer_t *t = *slot;
+        unlink_timer(t);
+        wheel_insert(t);
+    }
+}
+
+/* Move expired timers of current level 0 slot to expired list */
+static void wheel_collect(clight_timer_t **expired, uint64_t now) {
+    clight_timer_t *t = wheel[0][wheel_tick & WHEEL_MASK];
+    while (t) {
+        clight_timer_t *next = t->next;
+        if (t->deadline <= now) {
+            unlink_timer(t);
+            link_timer(expired, t, -1);
+        }
+        t = next;
+    }
+}
+
+/*
+ * Number of ticks the wheel can be advanced without missing anything:
+ * if lower levels are empty, jump straight to next boundary of lowest non-empty level.
+ */
+static uint64_t wheel_next_step(uint64_t target) {
+    int level = 0;
+    while (level < WHEEL_LEVELS && level_count[level] == 0) {
+        level++;
+    }
+    uint64_t next = target;
+    if (level == 0) {
+        next = wheel_tick + 1;
+    } else if (level < WHEEL_LEVELS) {
+        const uint64_t span = 1ULL << LEVEL_SHIFT(level);
+        next = (wheel_tick / span + 1) * span;
+    }
+    return (next < target ? next : target) - wheel_tick;
+}
+
+static void wheel_run(void) {
+    const uint64_t now = now_ns();
+    const uint64_t target = now / NS_PER_TICK;
+    clight_timer_t *expired = NULL;
+
+    wheel_collect(&expired, now);
+    while (wheel_tick < target) {
+        wheel_tick += wheel_next_step(target);
+        for (int level = 1; level < WHEEL_LEVELS && (wheel_tick & ((1ULL << LEVEL_SHIFT(level)) - 1)) == 0; level++) {
+            wheel_cascade(level);
+        }
+        wheel_collect(&expired, now);
+    }
 
-int start_timer(int clockid, int initial_s, int initial_ns) {
-    int timerfd = timerfd_create(clockid, TFD_NONBLOCK);
-    if (timerfd == -1) {
-        ERROR("timerfd_create() failed: %s\n", strerror(errno));
-    } 
-    set_timeout(initial_s, initial_ns, timerfd, 0);
-    return timerfd;
+    /* Callbacks can freely set, stop or register any timer, including expired ones */
+    while (expired) {
+        clight_timer_t *t = expired;
+        unlink_timer(t);
+        t->deadline = 0;
+        if (t->registered) {
+            t->cb(t->userdata);
+        } else {
+            t->pending = true;
+        }
+    }
+}
+
+/* Arm the timerfd on earliest deadline: first non-empty slot of each level holds its earliest timers */
+static void arm_timerfd(void) {
+    uint64_t min = UINT64_MAX;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        if (level_count[level] == 0) {
+            continue;
+        }
+        const uint64_t curr = (wheel_tick >> LEVEL_SHIFT(level)) & WHEEL_MASK;
+        /* Upper levels' current slot can only hold timers wrapped around the whole level: check it last */
+        for (int i = level > 0; i < WHEEL_SLOTS + (level > 0); i++) {
+            const clight_timer_t *t = wheel[level][(curr + i) & WHEEL_MASK];
+            if (t) {
+                for (; t; t = t->next) {
+                    if (t->deadline < min) {
+                        min = t->deadline;
+                    }
+                }
+                break;
+            }
+        }
+    }
+
+    if (min == UINT64_MAX) {
+        min = 0;
+    }
+    if (timer_fd >= 0 && min != armed_deadline) {
+        struct itimerspec timerValue = {{0}};
+        timerValue.it_value.tv_sec = min / NS_PER_TICK;
+        timerValue.it_value.tv_nsec = min % NS_PER_TICK;
+        if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &timerValue, NULL) == -1) {
+            ERROR("timerfd_settime(%d) failed: %s\n", timer_fd, strerror(errno));
+        }
+        armed_deadline = min;
+    }
+}
+
+int start_timer(int initial_s, int initial_ns) {
+    int id = 0;
+    while (id < num_timers && timers[id]) {
+        id++;
+    }
+    if (id == num_timers) {
+        clight_timer_t **tmp = realloc(timers, (num_timers + 1) * sizeof(clight_timer_t *));
+        if (!tmp) {
+            ERROR("Failed to allocate timer: %s\n", strerror(errno));
+        }
+        timers = tmp;
+        num_timers++;
+    }
+    timers[id] = calloc(1, sizeof(clight_timer_t));
+    if (!timers[id]) {
+        ERROR("Failed to allocate timer: %s\n", strerror(errno));
+    }
+    timers[id]->id = id;
+    timers[id]->level = -1;
+    set_timeout(initial_s, initial_ns, id, 0);
+    return id;
 }
 
 /*
- * Helper to set a new trigger on timerfd in sec seconds and nsec nanoseconds
+ * Helper to set a new trigger on timer in sec seconds and nsec nanoseconds.
+ * flag can be TFD_TIMER_ABSTIME to set an absolute CLOCK_BOOTTIME deadline.
  */
-void set_timeout(int sec, int nsec, int fd, int flag) {
-    struct itimerspec timerValue = {{0}};
+void set_timeout(int sec, int nsec, int id, int flag) {
+    clight_timer_t *t = get_timer(id);
+    if (!t) {
+        return;
+    }
 
     if (sec < 0) {
         sec = 0;
     }
-    timerValue.it_value.tv_sec = sec;
-    timerValue.it_value.tv_nsec = nsec;
-    int r = timerfd_settime(fd, flag, &timerValue, NULL);
-    if (r == -1) {
-        ERROR("timerfd_settime(%d) failed: %s\n", fd, strerror(errno));
-    }
-    if (flag == 0) {
-        if (sec != 0 || nsec != 0) {
-            DEBUG("Set timeout of %ds %dns on fd %d.\n", sec, nsec, fd);
+    unlink_timer(t);
+    t->pending = false;
+    t->armed_at = 0;
+    if (sec != 0 || nsec != 0) {
+        struct timespec ts = { sec, nsec };
+        if (flag == 0) {
+            /* Relative timeouts are expressed in clock time */
+            clock_to_real(&ts);
+            const uint64_t timeout = ts.tv_sec * NS_PER_TICK + ts.tv_nsec;
+            t->armed_at = now_ns();
+            t->deadline = t->armed_at + timeout;
+            if (t->slack && t->slack[state.ac_state] > 0) {
+                /* Never delay a timer by more than its own timeout, eg: to "fire now" */
+                const uint64_t slack = t->slack[state.ac_state] * NS_PER_TICK;
+                t->deadline = coalesce_deadline(t, t->deadline, slack < timeout ? slack : timeout);
+            }
+            DEBUG("Set timeout of %ds %dns on timer %d.\n", sec, nsec, id);
         } else {
-            DEBUG("Disarmed timerfd on fd %d.\n", fd);
+            t->deadline = ts.tv_sec * NS_PER_TICK + ts.tv_nsec;
+        }
+        wheel_insert(t);
+    } else {
+        t->deadline = 0;
+        if (flag == 0) {
+            DEBUG("Disarmed timer %d.\n", id);
         }
     }
+    arm_timerfd();
 }
 
-static time_t get_timeout_sec(int fd) {
-    struct itimerspec curr_value;
-    if (timerfd_gettime(fd, &curr_value) == 0) {
-        return curr_value.it_value.tv_sec;
+/*
+ * Join earliest running timer expiring within [deadline, deadline + slack];
+ * otherwise align deadline to next slack multiple.
+ */
+static uint64_t coalesce_deadline(const clight_timer_t *t, uint64_t deadline, uint64_t slack) {
+    uint64_t best = deadline + slack + 1;
+    for (int i = 0; i < num_timers; i++) {
+        const clight_timer_t *other = timers[i];
+        if (other && other != t && other->level != -1 &&
+            other->deadline >= deadline && other->deadline < best) {
+
+            best = other->deadline;
+        }
+    }
+    if (best <= deadline + slack) {
+        return best;
     }
-    WARN("timerfd_gettime(%d) failed: %s\n", fd, strerror(errno));
-    return 0;
+    return (deadline + slack - 1) / slack * slack;
 }
 
-void reset_timer(int fd, int old_timer, int new_timer) {
+static time_t get_timeout_sec(clight_timer_t *t) {
+    const uint64_t now = now_ns();
+    if (t->deadline <= now) {
+        return 0;
+    }
+    const uint64_t left = t->deadline - now;
+    struct timespec ts = { left / NS_PER_TICK, left % NS_PER_TICK };
+    clock_from_real(&ts);
+    return ts.tv_sec;
+}
+
+/*
+ * Seconds elapsed since timer was set with old_timer timeout.
+ * Remaining timeout may include slack: only use it when start time is unknown,
+ * and never return a negative elapsed time.
+ */
+static time_t get_elapsed_sec(clight_timer_t *t, int old_timer, time_t timeout) {
+    if (t->armed_at > 0) {
+        const uint64_t elapsed = now_ns() - t->armed_at;
+        struct timespec ts = { elapsed / NS_PER_TICK, elapsed % NS_PER_TICK };
+        clock_from_real(&ts);
+        return ts.tv_sec;
+    }
+    return timeout < old_timer ? old_timer - timeout : 0;
+}
+
+void reset_timer(int id, int old_timer, int new_timer) {
+    clight_timer_t *t = get_timer(id);
+    if (!t) {
+        return;
+    }
+
     if (old_timer <= 0) {
-        /* We had a paused fd; resume it */
-        set_timeout(new_timer, 0, fd, 0);
+        /* We had a paused timer; resume it */
+        set_timeout(new_timer, 0, id, 0);
     } else {
-        time_t fd_timeout = get_timeout_sec(fd);
-        if (fd_timeout == 0 && new_timer > 0) {
-            /* 
-             * fd was ready to fire; we are not pausing it 
+        time_t timeout = get_timeout_sec(t);
+        if (timeout == 0 && new_timer > 0) {
+            /*
+             * timer was ready to fire; we are not pausing it
              * thus we can safely let it fire.
              * Note: this happens after eg: a long night suspend
              */
-            return; 
+            return;
         }
-    
-        unsigned int elapsed_time = old_timer - fd_timeout;
+
+        const time_t elapsed_time = get_elapsed_sec(t, old_timer, timeout);
         /* if we still need to wait some seconds */
         if (new_timer > elapsed_time) {
-            set_timeout(new_timer - elapsed_time, 0, fd, 0);
+            set_timeout(new_timer - elapsed_time, 0, id, 0);
         } else if (new_timer > 0) {
             /* with new timeout, old_timeout would already have elapsed */
-            set_timeout(0, 1, fd, 0);
+            set_timeout(0, 1, id, 0);
         } else {
-            /* pause fd as a timeout <= 0 has been set */
-            set_timeout(0, 0, fd, 0);
+            /* pause timer as a timeout <= 0 has been set */
+            set_timeout(0, 0, id, 0);
+        }
+    }
+}
+
+/*
+ * Start delivering timer expirations to cb.
+ * If timer expired while deregistered, cb is called on next loop iteration.
+ */
+void register_timer(int id, timer_cb cb, void *userdata) {
+    clight_timer_t *t = get_timer(id);
+    if (t) {
+        t->cb = cb;
+        t->userdata = userdata;
+        t->registered = true;
+        if (t->pending) {
+            set_timeout(0, 1, id, 0);
         }
     }
 }
 
-void read_timer(int fd) {
-    uint64_t t;
-    read(fd, &t, sizeof(uint64_t));
+/* Stop delivering timer expirations; timer keeps running */
+void deregister_timer(int id) {
+    clight_timer_t *t = get_timer(id);
+    if (t) {
+        t->registered = false;
+    }
+}
+
+void stop_timer(int id) {
+    clight_timer_t *t = get_timer(id);
+    if (t) {
+        unlink_timer(t);
+        timers[id] = NULL;
+        free(t);
+        arm_timerfd();
+    }
+}
+
+/* Slack is read on each set_timeout(), thus it follows ac state and config changes */
+void set_timer_slack(int id, const int *slack) {
+    clight_timer_t *t = get_timer(id);
+    if (t) {
+        t->slack = slack;
+    }
+}
+
+/* Average number of timerfd wakeups per hour since startup */
+double timer_wakeups_per_hour(void) {
+    const double hours = (now_ns() - start_ns) / (3600.0 * NS_PER_TICK);
+    return hours > 0 ? num_wakeups / hours : 0;
+}
+
+const loop_lag_t *timer_loop_lag(void) {
+    return &loop_lag;
 }
@@ -1,8 +1,23 @@
 #pragma once
 
-#include "commons.h"
+#include "clock.h"
 
-int start_timer(int clockid, int initial_s, int initial_ns);
-void set_timeout(int sec, int nsec, int fd, int flag);
-void reset_timer(int fd, int old_timer, int new_timer);
-void read_timer(int fd);
+/* Delay between timerfd deadlines and the loop actually serving them */
+typedef struct {
+    uint64_t samples;
+    double sum_ms;
+    double max_ms;
+} loop_lag_t;
+
+/* Called on timer expiration, only while timer is registered */
+typedef void (*timer_cb)(void *userdata);
+
+int start_timer(int initial_s, int initial_ns);
+void set_timeout(int sec, int nsec, int id, int flag);
+void reset_timer(int id, int old_timer, int new_timer);
+void register_timer(int id, timer_cb cb, void *userdata);
+void deregister_timer(int id);
+void stop_timer(int id);
+void set_timer_slack(int id, const int *slack);
+double timer_wakeups_per_hour(void);
+const loop_lag_t *timer_loop_lag(void);
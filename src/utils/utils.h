@@ -1,13 +1,18 @@
 #pragma once
 
 #include "commons.h"
+#include "metrics.h"
 
 #define MODULE_WITH_PAUSE(name) \
     static int paused_state; \
     static const char *_name = name; \
     MODULE(name)
 
-#define CHECK_PAUSE(pause, reason) mod_check_pause(pause, &paused_state, reason, _name)
+/* Pause state is recorded for metrics here, keeping mod_check_pause() free of module dependencies */
+#define CHECK_PAUSE(pause, reason) ({ \
+    const bool _changed = mod_check_pause(pause, &paused_state, reason, _name); \
+    metrics_pause(_name, paused_state); \
+    _changed; })
 
 #define X_FIELDS \
     X(UNPAUSED,     0) \